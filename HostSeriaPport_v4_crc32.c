@@ -26,10 +26,33 @@ Transfers occur with 32bit crc checking
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
 #include <dirent.h>
 
+#include "batch.h"
+#include "cardlist.h"
+#include "crc32.h"
+#include "daemon.h"
+#include "delta.h"
+#include "devsim.h"
+#include "fec.h"
+#include "fileio.h"
+#include "host.h"
+#include "metrics.h"
+#include "pack.h"
+#include "pacing.h"
+#include "protocol.h"
+#include "resume.h"
+#include "script.h"
+#include "serialio.h"
+#include "settings.h"
+#include "stripe.h"
+#include "verify.h"
+#include "window.h"
+
 #define  uint32_t u_int32_t
 #define  uint16_t u_int16_t
 
@@ -43,51 +66,263 @@ unsigned char SOK = 0x07;
 unsigned char NOK = 0x08;
 
 #define RETRYCOUNT 2
+#define LINK_TIMEOUT_MS 2000		// longest wait for the device mid transfer
+#define CONSOLE_TIMEOUT_MS 10000	// longest silence while draining console output
+#define CONSOLE_DEADLINE_MS 120000	// longest console answer, however chatty
+#define DELTA_TIMEOUT_MS 30000		// the device reads its whole copy before answering
+#define VERIFY_TIMEOUT_MS 60000		// and for VERIFY every file it is asked about
 
 //fallocate -l $((20*1024)) file.txt
 
-//	int bufSize = 1024;
-const int bufSize = 64;
+#define HOST_MAX_FRAME 8192
+#define HOST_FEATURES (HDR_FLAG_WINDOW | HDR_FLAG_BAUD | HDR_FLAG_BATCH | HDR_FLAG_RESUME | HDR_FLAG_PACK | HDR_FLAG_DELTA | HDR_FLAG_STRIPE | \
+		HDR_FLAG_FEC | HDR_FLAG_VERIFY | HDR_FLAG_LIST | HDR_FLAG_COBS | HDR_FLAG_STREAM | HDR_FLAG_ADAPT | HDR_FLAG_SPARSE)
+
+union crcOverlap {
+	uint32_t crcInt;
+	unsigned char crcArray[4];
+};
+
+// offer parity on window frames for noisy lines, -fec
+int hostFec = 0;
+
 int inputBufferSize = 64;
-unsigned char oneKbuf[64];
 
 int32_t crcX = 0xffffffff;
 int32_t poly = 0x11223344;
 int32_t initX = 0x55667788;
 
-unsigned char tmpCrc = 0;
 int crcSize = 4;
 
-typedef struct header {
-	int32_t fileSize;
-	int32_t bufSize;
-	//	int32_t numFrames;
-	int32_t crcX;
-	unsigned char fileName[64];
-	int32_t poly;
-	int32_t initX;
-	uint32_t crcCheck;
-} header;
-
-union crcOverlap {
-	uint32_t crcInt;
-	unsigned char crcArray[4];
-};
-
-union crcOverlap crcClcData;
-union crcOverlap crcSntData;
-union crcOverlap crcRcvData;
-
-void cleanUp(int fd){
-	unsigned char ch;
+void cleanUp(serialPort *sp){
+	int64_t deadline = serialNowMs() + CONSOLE_DEADLINE_MS;
+	int ch;
 	while(1) {
 		//	printf("here \n");
-		read(fd, &ch, 1);
+		int left = serialMsLeft(deadline);
+
+		ch = serialReadByte(sp, left < CONSOLE_TIMEOUT_MS ? left : CONSOLE_TIMEOUT_MS);
+		if (ch < 0) {
+			printf("\n<local><cleanUp> : no EOT from device in %d ms\n", left < CONSOLE_TIMEOUT_MS ? CONSOLE_DEADLINE_MS : CONSOLE_TIMEOUT_MS);
+			break;
+		}
 		if (ch == EOT) break;
 		printf("%c", ch);
 	}
 }
 
+// deadline for 'bytes' from the device, the time they need on the wire plus slack
+int frameTimeoutMs(const hostSession *hs, int bytes){
+	return(LINK_TIMEOUT_MS + (int)((int64_t)bytes * 10 * 1000 / hs->baudRate));
+}
+
+// a session on one link at 'baud', nothing agreed with the device yet
+void sessionInit(hostSession *hs, serialPort *port, int baud){
+	memset(hs, 0, sizeof(*hs));
+	hs->bufSize = V4_FRAME_SIZE;
+	hs->hostLink[0] = port;
+	hs->hostLinks = 1;
+	hs->linkStripes = 1;
+	hs->baudRate = baud;
+}
+
+/*
+Agrees frame size, window and features with the device, see caps in
+protocol.h.  returns 1 if the device took part, 0 for v4 firmware.
+*/
+int negotiateCaps(hostSession *hs){
+	serialPort *sp = hs->hostLink[0];
+	uint32_t offered = HOST_FEATURES;
+	int64_t deadline;
+	char line[64];
+	caps theirs;
+	int ch;
+
+	hs->bufSize = V4_FRAME_SIZE;
+	hs->linkWindow = 0;
+	hs->linkFeatures = 0;
+	hs->linkStripes = 1;
+	hs->capsDone = 1;
+	cardListInvalidate(&hs->cardDir);
+
+	// striping only means something with a second link, parity costs 3% and is asked for
+	if (hs->hostLinks < 2) offered &= ~HDR_FLAG_STRIPE;
+	if (!hostFec) offered &= ~HDR_FLAG_FEC;
+	snprintf(line, sizeof(line), "CAPS %d %d %u %d\n", HOST_MAX_FRAME, WINDOW_MAX, offered, hs->hostLinks);
+	serialWrite(sp, line, strlen(line));
+
+	// v4 firmware answers with console text and EOT, newer firmware starts with BOT
+	deadline = serialNowMs() + CONSOLE_TIMEOUT_MS;
+	while (1) {
+		int left = serialMsLeft(deadline);
+
+		ch = serialReadByte(sp, left < LINK_TIMEOUT_MS ? left : LINK_TIMEOUT_MS);
+		if (ch < 0 || ch == EOT) {
+			printf("<local><caps> : v4 device, %d byte stop and wait frames\n", hs->bufSize);
+			return(0);
+		}
+		if (ch == BOT) break;
+	}
+
+	if (serialReadExact(sp, &theirs, sizeof(theirs), LINK_TIMEOUT_MS) < sizeof(theirs) ||
+			theirs.magic != CAPS_MAGIC ||
+			theirs.crcCheck != crc32Compute(&theirs, sizeof(theirs) - 4)) {
+		printf("<local><caps> : bad caps reply, staying with v4 frames\n");
+		cleanUp(sp);
+		return(0);
+	}
+
+	if (theirs.maxFrame >= V4_FRAME_SIZE) {
+		hs->bufSize = theirs.maxFrame < HOST_MAX_FRAME ? theirs.maxFrame : HOST_MAX_FRAME;
+	}
+	hs->linkFeatures = theirs.features & offered;
+	if (hs->linkFeatures & HDR_FLAG_WINDOW) {
+		hs->linkWindow = theirs.maxWindow < WINDOW_MAX ? theirs.maxWindow : WINDOW_MAX;
+		if (hs->linkWindow < 1) hs->linkFeatures &= ~HDR_FLAG_WINDOW;
+	}
+	if (hs->linkFeatures & HDR_FLAG_STRIPE) {
+		int32_t theirLinks = 0;
+
+		// no count in time, or part of one, and only the command link is used
+		if (serialReadExact(sp, &theirLinks, sizeof(theirLinks), LINK_TIMEOUT_MS) < (int)sizeof(theirLinks)) {
+			printf("<local><caps> : no link count from the device, using one link\n");
+			theirLinks = 1;
+		}
+		hs->linkStripes = theirLinks < hs->hostLinks ? theirLinks : hs->hostLinks;
+		if (hs->linkStripes < 2 || !(hs->linkFeatures & HDR_FLAG_WINDOW)) {
+			hs->linkStripes = 1;
+			hs->linkFeatures &= ~HDR_FLAG_STRIPE;
+		}
+	}
+	cleanUp(sp);
+
+	printf("<local><caps> : device v%d, frame %d window %d features %x links %d\n",
+			theirs.version, hs->bufSize, hs->linkWindow, hs->linkFeatures, hs->linkStripes);
+	return(1);
+}
+
+#define PROBE_FRAMES 32
+#define PROBE_LEN 252
+#define PROBE_MAX_BAD 1			// frames of PROBE_FRAMES allowed to fail
+
+/*
+Sends n test frames for the device to echo, see BAUD in protocol.h.
+returns how many came back damaged or not at all.
+*/
+int probeLink(hostSession *hs, int n, int len){
+	serialPort *sp = hs->hostLink[0];
+	unsigned char *out, *back;
+	char line[64];
+	int frame = len + 4;
+	int got, bad = 0;
+	uint32_t seed = 0x12345678;
+
+	out = (unsigned char *)malloc((size_t)n * frame);
+	back = (unsigned char *)malloc((size_t)n * frame);
+
+	for (int i = 0; i < n; i++) {
+		unsigned char *f = out + (size_t)i * frame;
+		uint32_t crc;
+
+		// every byte value, in a different order each frame
+		for (int j = 0; j < len; j++) {
+			seed = seed * 1103515245 + 12345;
+			f[j] = (unsigned char)(seed >> 16);
+		}
+		crc = crc32Compute(f, len);
+		memcpy(f + len, &crc, 4);
+	}
+
+	serialFlushInput(sp);
+	snprintf(line, sizeof(line), "PROBE %d %d\n", n, len);
+	serialWrite(sp, line, strlen(line));
+
+	if (!serialWaitFor(sp, BOT, LINK_TIMEOUT_MS)) {
+		free(out);
+		free(back);
+		return(n);
+	}
+
+	serialWrite(sp, out, n * frame);
+	got = serialReadExact(sp, back, n * frame, frameTimeoutMs(hs, 2 * n * frame));
+
+	for (int i = 0; i < n; i++) {
+		unsigned char *f = back + (size_t)i * frame;
+		uint32_t crc;
+
+		if ((i + 1) * frame > got) {
+			bad++;
+			continue;
+		}
+		crc = crc32Compute(f, len);
+		if (memcmp(f + len, &crc, 4) != 0 || memcmp(f, out + (size_t)i * frame, frame) != 0) bad++;
+	}
+	cleanUp(sp);
+
+	free(out);
+	free(back);
+	return(bad);
+}
+
+/*
+Moves host and device to 'rate' and keeps it only if a probe at the new
+rate comes back clean.  returns 0 on success, -1 if both are back at the
+old rate.
+*/
+int changeBaud(hostSession *hs, int rate){
+	serialPort *sp = hs->hostLink[0];
+	int old = hs->baudRate;
+	char line[64];
+	int64_t switched;
+	int bad;
+
+	if (!(hs->linkFeatures & HDR_FLAG_BAUD)) {
+		printf("<local><baud> : device can not change speed\n");
+		return(-1);
+	}
+
+	snprintf(line, sizeof(line), "BAUD %d\n", rate);
+	serialWrite(sp, line, strlen(line));
+	cleanUp(sp);
+
+	tcdrain(sp->fd);
+	if (settingsSetBaud(sp->fd, rate) < 0) return(-1);
+	switched = serialNowMs();
+	hs->baudRate = rate;
+	usleep(50000);		// let the device finish switching
+	serialFlushInput(sp);
+
+	bad = probeLink(hs, PROBE_FRAMES, PROBE_LEN);
+	printf("<local><baud> : %d baud, %d of %d probe frames bad\n", rate, bad, PROBE_FRAMES);
+
+	if (bad <= PROBE_MAX_BAD) {
+		serialWrite(sp, "BAUD OK\n", 8);
+		cleanUp(sp);
+		return(0);
+	}
+
+	// not good enough, the device goes back on its own when BAUD OK never comes
+	settingsSetBaud(sp->fd, old);
+	hs->baudRate = old;
+	while (serialNowMs() - switched < BAUD_REVERT_MS + 200) usleep(50000);
+	serialFlushInput(sp);
+	return(-1);
+}
+
+// steps the line speed up while the link stays clean, stops at the first failure
+void probeSpeed(hostSession *hs, int maxRate){
+	static const int rates[] = {57600, 115200, 230400, 460800, 500000, 576000,
+			921600, 1000000, 1500000, 2000000, 3000000, 4000000};
+
+	if (!hs->capsDone) negotiateCaps(hs);
+
+	for (int i = 0; i < (int)(sizeof(rates) / sizeof(rates[0])); i++) {
+		if (rates[i] <= hs->baudRate || rates[i] > maxRate) continue;
+		if (changeBaud(hs, rates[i]) < 0) break;
+	}
+	printf("<local><baud> : link running at %d baud\n", hs->baudRate);
+}
+
 int set_interface_attribs(int fd, int speed)
 {
 	struct termios tty;
@@ -97,9 +332,6 @@ int set_interface_attribs(int fd, int speed)
 		return -1;
 	}
 
-	cfsetospeed(&tty, (speed_t)speed);
-	cfsetispeed(&tty, (speed_t)speed);
-
 	tty.c_cflag |= (CLOCAL | CREAD);    /* ignore modem controls */
 	tty.c_cflag &= ~CSIZE;
 	tty.c_cflag |= CS8;         /* 8-bit characters */
@@ -120,7 +352,9 @@ int set_interface_attribs(int fd, int speed)
 		printf("Error from tcsetattr: %s\n", strerror(errno));
 		return -1;
 	}
-	return 0;
+
+	// any rate, not just the Bxxx constants
+	return settingsSetBaud(fd, speed);
 }
 
 void set_mincount(int fd, int mcount)
@@ -189,144 +423,96 @@ unsigned char *removeSpace(char *text, int len){
 	return cmdStr;
 }
 
-// add in the crc material
-const int32_t order = 32;
-const uint32_t polynom = 0x4c11db7;
-const int32_t direct = 1;
-const uint32_t crcinit = 0xffffffff;
-const uint32_t crcxor = 0xffffffff;
-const int32_t refin = 1;
-const int32_t refout = 1;
-uint32_t crcinit_direct;
-uint32_t crcmask;
-uint32_t crchighbit;
-uint32_t crcinit_nondirect;
-
-uint32_t reflect (uint32_t crc, int32_t bitnum) {
-
-	// reflects the lower 'bitnum' bits of 'crc'
-
-	uint32_t i, j=1, crcout=0;
-
-	for (i=(uint32_t)1<<(bitnum-1); i; i>>=1) {
-		if (crc & i) crcout|=j;
-		j<<= 1;
-	}
-	return (crcout);
-}
-
-uint32_t crcbitbybitfast(unsigned char* p, uint32_t len) {
-
-	// fast bit by bit algorithm without augmented zero bytes.
-	// does not use lookup table, suited for polynom orders between 1...32.
-
-	uint32_t i, j, c, bit;
-	uint32_t crc = crcinit_direct;
-
-	//	printf("crcbitbybitfast entering\n");
-
-	for (i=0; i<len; i++) {
-		c = (uint32_t)*p++;
-		//	printf("crc is %d\n", i);
-
-		if (refin) c = reflect(c, 8);
-
-		for (j=0x80; j; j>>=1) {
-
-			bit = crc & crchighbit;
-			crc<<= 1;
-			if (c & j) bit^= crchighbit;
-			if (bit) crc^= polynom;
-		}
-	}
-
-	if (refout) crc=reflect(crc, order);
-	crc^= crcxor;
-	crc&= crcmask;
-	//	printf("crcbitbybitfast exiting\n");
-
-	return(crc);
-}
-
-uint32_t checkMaskEtc(){
-	crcmask = ((((uint32_t )1 << (order - 1)) - 1) << 1) | 1;
-	crchighbit = (uint32_t )1 << (order-1);
+// how much frame compression saved, if any was used, and the zeros that went as extents either way
+void packReport(const windowStats *stats, const char *who, int sending){
+	int64_t plain = stats->plainBytes - stats->zeroBytes;
 
-	return(0);
+	if (stats->zeroBytes > 0) printf("<local><%s> : %ld bytes of zeros %s as extents\n", who, (long)stats->zeroBytes,
+			sending ? "sent" : "received");
+	if (stats->packedBytes >= plain || stats->packedBytes == 0) return;
+	printf("<local><%s> : compressed %ld to %ld bytes, ratio %.2f\n", who,
+			(long)plain, (long)stats->packedBytes, (double)plain / stats->packedBytes);
 }
 
+void recvFile(hostSession *hs, int *nargs, unsigned char **argv){
+	serialPort *sp = hs->hostLink[0];
 
-
-
-
-void recvFile(int fd, int *nargs, unsigned char **argv){
-
-	unsigned char arduinoFileToSend[20];
-	unsigned char hostFileToSaveAs[20];
+	unsigned char arduinoFileToSend[64];
+	unsigned char hostFileToSaveAs[256];
 
 	if (*nargs == 1){
 		strcpy(arduinoFileToSend, "dummyFile");
 		strcpy(hostFileToSaveAs, "dummyFile");
 	} else if (*nargs == 2) {
-		strcpy(arduinoFileToSend, argv[1]);
-		strcpy(hostFileToSaveAs, argv[1]);
+		snprintf(arduinoFileToSend, sizeof(arduinoFileToSend), "%s", argv[1]);
+		snprintf(hostFileToSaveAs, sizeof(hostFileToSaveAs), "%s", argv[1]);
 	} else {
-		strcpy(arduinoFileToSend, argv[1]);
-		strcpy(hostFileToSaveAs, argv[2]);
+		snprintf(arduinoFileToSend, sizeof(arduinoFileToSend), "%s", argv[1]);
+		snprintf(hostFileToSaveAs, sizeof(hostFileToSaveAs), "%s", argv[2]);
 	}
 
-	header recv;
+	memset(&hs->transferStats, 0, sizeof(hs->transferStats));
+	hs->transferStats.metrics.progress = metricsProgressOn();
+	hs->transferFailed = 1;
 
-	int32_t error = checkMaskEtc();
+	header recv;
 
 	unsigned char ch;
 
 	printf("\n > local recvFile \n");
 	int wlen, rlen;
 
-	while(1) {
-		read(fd, &ch, 1);
-		if (ch == BOT) break;
-	}
-	wlen = write(fd, &BOT, 1);
+	pacer pace;
+	pacerInit(&pace, hs->baudRate);
+	int64_t startUs = pacerClockUs();
 
-	unsigned char *chr;
-	chr = (unsigned char *)&recv;
-	rlen = 0;
-	int recved = 0;
+	if (!pacerReady(&pace, sp, BOT, LINK_TIMEOUT_MS)) {
+		printf(" > local no BOT from device\n");
+		return;
+	}
+	wlen = serialWrite(sp, &BOT, 1);
 
-	while(rlen < sizeof(header)){
-		if (read(fd, chr, 1) > 0){
-			rlen++;
-			chr++;
-		}
+	rlen = serialReadExact(sp, &recv, sizeof(header), LINK_TIMEOUT_MS);
+	if (rlen < sizeof(header)) {
+		printf(" > local header short, %d bytes\n", rlen);
+		return;
 	}
 
 	printf(" > local header rlen %d\n", rlen);
 	printf(" > local header recv fileSize %d\n", recv.fileSize );
 	printf(" > local header recv bufSize %d\n", recv.bufSize );
-	printf(" > local header recv crcX %d\n", recv.crcX );
+	printf(" > local header recv flags %d\n", recv.flags );
 	printf(" > local header recv fileName %s\n", recv.fileName );
-	printf(" > local header recv poly %d\n", recv.poly );
+	printf(" > local header recv window %d\n", recv.window );
 	printf(" > local header recv initX %d\n", recv.initX );
 	printf(" > local header recv crcCheck %d\n", recv.crcCheck );
 
 	int bufSize = recv.bufSize;
+	unsigned char *frameBuf;
 	int numFrames;
 	int remainder;
 	int fileSize = recv.fileSize;
 	int crcSize = 4;
 	uint32_t crc;
 	uint32_t crcTmp;
-	char filename[20];
-
-	// check crc
-	crcClcData.crcInt = recv.crcCheck;
+	union crcOverlap crcClcData, crcRcvData;
+	char filename[256];
 
-	crcClcData.crcInt = crcbitbybitfast((unsigned char *)(&recv), sizeof(recv) - 4);
+	// check crc, flags and window pick the mode and fileSize sizes the file
+	crcClcData.crcInt = crc32Compute((unsigned char *)(&recv), sizeof(recv) - 4);
+	if (crcClcData.crcInt != recv.crcCheck) {
+		printf(" > local header crc %x, expected %x\n", recv.crcCheck, crcClcData.crcInt);
+		return;
+	}
 
 	strcpy(filename, hostFileToSaveAs);
 
+	if (bufSize <= crcSize || bufSize > HOST_MAX_FRAME) {
+		printf(" > local frame size %d not supported\n", bufSize);
+		return;
+	}
+	frameBuf = (unsigned char *)malloc(bufSize);
+
 	printf(" > local filename %s\n", filename );
 
 	numFrames = fileSize/(bufSize - crcSize);
@@ -337,39 +523,88 @@ void recvFile(int fd, int *nargs, unsigned char **argv){
 	//	unsigned char *ptr;
 	int returnvalue;
 	FILE *ptr_myfile;
+	resumeLog resume;
+	int64_t resumeFrom = 0;
+	int resumable = (recv.flags & HDR_FLAG_WINDOW) && (recv.flags & HDR_FLAG_RESUME);
+
+	// a resumable transfer keeps what a broken earlier one left behind
+	if (resumable) ptr_myfile = resumeOpen(&resume, filename, fileSize, (uint32_t)recv.initX, &resumeFrom);
+	else ptr_myfile = fopen(filename,"wb");
+	if (ptr_myfile == NULL) {
+		printf(" > local can not create %s\n", filename);
+		free(frameBuf);
+		return;
+	}
 
-	ptr_myfile = fopen(filename,"wb");
+	if (recv.flags & HDR_FLAG_WINDOW) {
+		windowOptions opt;
+		windowStats stats;
+		int ok;
+
+		memset(&stats, 0, sizeof(stats));
+		stats.pace = pace;
+		stats.metrics.progress = metricsProgressOn();
+		windowDefaults(&opt, bufSize, recv.window, hs->baudRate);
+		windowOptionsFromLink(&opt, hs->linkFeatures);
+		if (resumable) {
+			opt.start = resumeFrom;
+			opt.resume = &resume;
+		}
+		printf(" > local window %d payload %d\n", opt.window, windowPayload(&opt));
 
-	// read and write the bulk
+		if (recv.flags & HDR_FLAG_STRIPE) {
+			printf(" > local striped over up to %d links\n", hs->hostLinks);
+			ok = stripeRecv(hs->hostLink, hs->hostLinks, ptr_myfile, fileSize, &opt, &stats) == 0;
+		} else {
+			ok = windowRecv(sp, ptr_myfile, fileSize, &opt, &stats) == 0;
+		}
+		if (!ok) printf(" > local window transfer failed\n");
+		if (resumable && resumeFinish(&resume, ptr_myfile, ok) < 0) ok = 0;
+		hs->transferFailed = !ok;
+		hs->transferStats = stats;
+		packReport(&stats, "recvFile", 0);
+		if (resumeFrom > 0) printf(" > local resumed at byte %ld\n", (long)resumeFrom);
+		printf(" > local frames %ld corrected %ld naks %ld timeouts %ld read calls %ld\n",
+				(long)stats.frames, (long)stats.corrected, (long)stats.naks, (long)stats.timeouts,
+				(long)sp->readCalls);
+		pacerReport(&stats.pace, pacerClockUs() - startUs, "recvFile");
+		metricsReport(&stats, "recvFile", filename, fileSize, pacerClockUs() - startUs, !ok);
+
+		fclose(ptr_myfile);
+		free(frameBuf);
+		printf(" > local closing file\n");
+		printf(" > local : ");
+		return;
+	}
+
+	// read and write the bulk, in place in a file reserved up front
 	int count = 0;
+	int gaveUp = 0;
+	filePrealloc(ptr_myfile, fileSize);
 
 	for(int32_t j = 0; j < numFrames; j++) {
-		if (j%10 == 0) printf("<local><010> : local frame is %d\n", j );
+		int64_t frameUs = pacerClockUs();
 
+		metricsProgress(&hs->transferStats.metrics, (int64_t)j * (bufSize - crcSize), fileSize);
 		count = 0;
+		hs->transferStats.frames++;
 
 		while(1) {
-			wlen = write(fd, &EOT, 1);
+			if (count > 0) hs->transferStats.resent++;
+			wlen = serialWrite(sp, &EOT, 1);
 
 			// read data from arduino
 //			usleep(20000);
-			for(int32_t i = 0; i < bufSize; i++){
-				read(fd, &(oneKbuf[i]), 1);
-			}
+			hs->transferStats.wireBytes += serialReadExact(sp, frameBuf, bufSize, frameTimeoutMs(hs, bufSize));
 //			usleep(20000);
-			// 	corrupting received data
-			//		if (j == 10 && count ==0) oneKbuf[0] = 'a';
-			//		 	for(int32_t i = 0; i < bufSize; i++){
-			//				printf("%c",oneKbuf[i]);
-			//			}
-
-			crcClcData.crcInt = crcbitbybitfast(oneKbuf, bufSize - crcSize);
+			crcClcData.crcInt = bufSize == V4_FRAME_SIZE ? metricsCrcV4(&hs->transferStats.metrics, frameBuf) :
+					metricsCrc(&hs->transferStats.metrics, frameBuf, bufSize - crcSize);
 
 			for(int32_t i = 0; i < crcSize; i++){
-				crcRcvData.crcArray[i] = oneKbuf[bufSize - crcSize + i];
+				crcRcvData.crcArray[i] = frameBuf[bufSize - crcSize + i];
 			}
 
-			/*		printf("<local><011> : oneKbuf[0] is %c \n", oneKbuf[0]);
+			/*		printf("<local><011> : frameBuf[0] is %c \n", frameBuf[0]);
 
 		printf("<local><012> : local crcClcData is %x %x %x %x \n",
 					crcClcData.crcArray[0],
@@ -385,23 +620,27 @@ void recvFile(int fd, int *nargs, unsigned char **argv){
 
 //			usleep(20000);
 
-			wlen = write(fd, &SYNC, 1);
+			wlen = serialWrite(sp, &SYNC, 1);
 
-			while(1) {
-				read(fd, &ch, 1);
-				if (ch == SYNC) break;
+			if (!pacerReady(&pace, sp, SYNC, LINK_TIMEOUT_MS)) {
+				printf("<local> : frame %d no SYNC from device\n", j);
 			}
 
 			if (crcClcData.crcInt == crcRcvData.crcInt) {
-				wlen = write(fd, &SOK, 1);
+				wlen = serialWrite(sp, &SOK, 1);
 				break;
 			} else {
-				wlen = write(fd, &NOK, 1);
+				wlen = serialWrite(sp, &NOK, 1);
+				hs->transferStats.naks++;
 				count++;
-				if (count == RETRYCOUNT) break;
+				if (count == RETRYCOUNT) {
+					gaveUp++;
+					break;
+				}
 			}
 		} 	// infinite resend loop
-		fwrite(oneKbuf, bufSize - crcSize, 1, ptr_myfile);
+		metricsFrame(&hs->transferStats.metrics, count, count == 0 ? pacerClockUs() - frameUs : -1);
+		fileWriteAt(ptr_myfile, frameBuf, bufSize - crcSize, (int64_t)j * (bufSize - crcSize));
 	}
 
 	//	now do the remainder
@@ -410,29 +649,22 @@ void recvFile(int fd, int *nargs, unsigned char **argv){
 	printf("<local> : --------- \n");
 
 	count = 0;
+	hs->transferStats.frames++;
+	int64_t frameUs = pacerClockUs();
 
 	while(1) {
-		wlen = write(fd, &EOT, 1);
+		if (count > 0) hs->transferStats.resent++;
+		wlen = serialWrite(sp, &EOT, 1);
 
 		// read data from arduino
-		usleep(20000);
-		for(int32_t i = 0; i < remainder + crcSize; i++){
-			read(fd, &(oneKbuf[i]), 1);
-		}
-		usleep(20000);
-		// 	corrupting received data
-		/*		if (j == 0 && count ==0) oneKbuf[0] = 'a';
-		 	for(int32_t i = 0; i < bufSize; i++){
-				printf("%c",oneKbuf[i]);
-			}
-		 */
-		crcClcData.crcInt = crcbitbybitfast(oneKbuf, remainder);
+		hs->transferStats.wireBytes += serialReadExact(sp, frameBuf, remainder + crcSize, frameTimeoutMs(hs, remainder + crcSize));
+		crcClcData.crcInt = metricsCrc(&hs->transferStats.metrics, frameBuf, remainder);
 
 		for(int32_t i = 0; i < crcSize; i++){
-			crcRcvData.crcArray[i] = oneKbuf[remainder + i];
+			crcRcvData.crcArray[i] = frameBuf[remainder + i];
 		}
 		/*
-		printf("<local><011> : oneKbuf[0] is %c \n", oneKbuf[0]);
+		printf("<local><011> : frameBuf[0] is %c \n", frameBuf[0]);
 
 		printf("<local><012> : local crcClcData is %x %x %x %x \n",
 					crcClcData.crcArray[0],
@@ -445,28 +677,39 @@ void recvFile(int fd, int *nargs, unsigned char **argv){
 					crcRcvData.crcArray[1],
 					crcRcvData.crcArray[2],
 					crcRcvData.crcArray[3]);	*/
-		usleep(20000);
 
-		wlen = write(fd, &SYNC, 1);
+		wlen = serialWrite(sp, &SYNC, 1);
 
-		while(1) {
-			read(fd, &ch, 1);
-			if (ch == SYNC) break;
+		if (!pacerReady(&pace, sp, SYNC, LINK_TIMEOUT_MS)) {
+			printf("<local> : remainder no SYNC from device\n");
 		}
 
 		if (crcClcData.crcInt == crcRcvData.crcInt) {
-			wlen = write(fd, &SOK, 1);
+			wlen = serialWrite(sp, &SOK, 1);
 			break;
 		} else {
-			wlen = write(fd, &NOK, 1);
+			wlen = serialWrite(sp, &NOK, 1);
+			hs->transferStats.naks++;
 			count++;
-			if (count == RETRYCOUNT) break;
+			if (count == RETRYCOUNT) {
+				gaveUp++;
+				break;
+			}
 		}
 	} 	// infinite resend loop
-	fwrite(oneKbuf, remainder, 1, ptr_myfile);
+	metricsFrame(&hs->transferStats.metrics, count, count == 0 ? pacerClockUs() - frameUs : -1);
+	metricsProgress(&hs->transferStats.metrics, fileSize, fileSize);
+	fileWriteAt(ptr_myfile, frameBuf, remainder, (int64_t)numFrames * (bufSize - crcSize));
+	hs->transferFailed = gaveUp > 0;
 
 
 	fclose(ptr_myfile);
+	free(frameBuf);
+
+	hs->transferStats.pace = pace;
+	hs->transferStats.plainBytes = fileSize;
+	pacerReport(&pace, pacerClockUs() - startUs, "recvFile");
+	metricsReport(&hs->transferStats, "recvFile", filename, fileSize, pacerClockUs() - startUs, hs->transferFailed);
 
 	printf(" > local closing file\n");
 	printf(" > local : ");
@@ -475,53 +718,184 @@ void recvFile(int fd, int *nargs, unsigned char **argv){
 
 //*****************************
 
-
-void sendFile(int fd, int *nargs, unsigned char **argv){
+/*
+The delta half of HTOA, see HDR_FLAG_DELTA in protocol.h: fetches the
+signature of the card's copy and sends only what differs from it.  returns
+1 if the device wants the whole file after all, 0 once the delta is
+across, -1 if it failed.
+*/
+int sendDelta(hostSession *hs, FILE *src, int fileSize, const header *send, windowStats *stats){
+	serialPort *sp = hs->hostLink[0];
+	windowStats sigStats;
+	windowOptions opt;
+	header reply, ops;
+	FILE *sigs, *delta;
+	int64_t deltaSize, matched;
 	unsigned char ch;
-	printf("<local><sendFile><01> : sending file %s file name length %ld as ", argv[1], strlen(argv[1]));
-	printf(" file %s file name length %ld \n", argv[2], strlen(argv[2]));
+	int rc;
+
+	if (serialReadExact(sp, &reply, sizeof(reply), DELTA_TIMEOUT_MS) < (int)sizeof(reply) ||
+			reply.crcCheck != crc32Compute((unsigned char *)(&reply), sizeof(reply) - 4)) {
+		printf("<local><sendDelta> : bad answer from the device\n");
+		return(-1);
+	}
+	if (!(reply.flags & HDR_FLAG_DELTA)) {
+		printf("<local><sendDelta> : nothing on the card to work from, sending it all\n");
+		return(1);
+	}
+	if (reply.bufSize <= WF_OVERHEAD || reply.bufSize > HOST_MAX_FRAME || reply.fileSize < (int)sizeof(sigHead)) {
+		printf("<local><sendDelta> : bad signature header\n");
+		return(-1);
+	}
+
+	// the signature comes back in window frames from the device
+	memset(&sigStats, 0, sizeof(sigStats));
+	sigStats.pace = stats->pace;
+	sigs = tmpfile();
+	windowDefaults(&opt, reply.bufSize, reply.window, hs->baudRate);
+	windowOptionsFromLink(&opt, hs->linkFeatures);
+	if (sigs == NULL || windowRecv(sp, sigs, reply.fileSize, &opt, &sigStats) < 0) {
+		printf("<local><sendDelta> : signature transfer failed\n");
+		if (sigs) fclose(sigs);
+		return(-1);
+	}
+	stats->pace = sigStats.pace;
+
+	delta = deltaBuild(sigs, reply.fileSize, src, fileSize, &deltaSize, &matched);
+	fclose(sigs);
+	if (delta == NULL || deltaSize > INT32_MAX) {
+		if (delta) fclose(delta);
+		return(-1);
+	}
+	printf("<local><sendDelta> : %ld of %d bytes already on the card, sending a %ld byte delta\n",
+			(long)matched, fileSize, (long)deltaSize);
+
+	windowDefaults(&opt, send->bufSize, send->window, hs->baudRate);
+	windowOptionsFromLink(&opt, hs->linkFeatures);
+	memset(&ops, 0, sizeof(ops));
+	ops.fileSize = (int32_t)deltaSize;
+	ops.bufSize = send->bufSize;
+	ops.flags = HDR_FLAG_WINDOW | HDR_FLAG_DELTA;
+	memcpy(ops.fileName, send->fileName, sizeof(ops.fileName));
+	ops.window = send->window;
+	ops.initX = send->initX;
+	if ((hs->linkFeatures & HDR_FLAG_PACK) && packWorthIt(delta, deltaSize, windowPayload(&opt))) {
+		ops.flags |= HDR_FLAG_PACK;
+		opt.pack = 1;
+	}
+	ops.crcCheck = crc32Compute((unsigned char *)(&ops), sizeof(ops) - 4);
+	serialWrite(sp, &ops, sizeof(ops));
+	pacerDrain(&stats->pace, sp);
+
+	rc = windowSend(sp, delta, deltaSize, &opt, stats);
+	stats->frames += sigStats.frames;
+	stats->resent += sigStats.resent;
+	fclose(delta);
+
+	// only the device knows whether the file it rebuilt matches
+	if (rc == 0 && (serialReadExact(sp, &ch, 1, DELTA_TIMEOUT_MS) < 1 || ch != OK)) {
+		printf("<local><sendDelta> : the card's rebuilt copy did not match, it kept the old one\n");
+		rc = -1;
+	}
+	return(rc < 0 ? -1 : 0);
+}
+
+void sendFile(hostSession *hs, int *nargs, unsigned char **argv){
+	serialPort *sp = hs->hostLink[0];
+	unsigned char ch, tmpCrc;
 	//	read(fd, &send, sizeof(send));
-	// copy args into local buffer as they are still in the oneKbuf
+	// copy args into local buffer as they are still in the keyBoardInput
 
-	unsigned char hostFileToSend[20];
-	unsigned char ArduinoSaveAs[20];
+	unsigned char hostFileToSend[256];
+	unsigned char ArduinoSaveAs[64];
 
 	if (*nargs == 1){
 		strcpy(hostFileToSend, "dummyFile");
 		strcpy(ArduinoSaveAs, "dummyFile");
 	} else if (*nargs == 2) {
-		strcpy(hostFileToSend, argv[1]);
-		strcpy(ArduinoSaveAs, argv[1]);
+		snprintf(hostFileToSend, sizeof(hostFileToSend), "%s", argv[1]);
+		snprintf(ArduinoSaveAs, sizeof(ArduinoSaveAs), "%s", argv[1]);
 	} else {
-		strcpy(hostFileToSend, argv[1]);
-		strcpy(ArduinoSaveAs, argv[2]);
+		snprintf(hostFileToSend, sizeof(hostFileToSend), "%s", argv[1]);
+		snprintf(ArduinoSaveAs, sizeof(ArduinoSaveAs), "%s", argv[2]);
+	}
+	// argv[2] is not there with one name, print the copies
+	printf("<local><sendFile><01> : sending file %s file name length %ld as ", hostFileToSend, strlen((char *)hostFileToSend));
+	printf(" file %s file name length %ld \n", ArduinoSaveAs, strlen((char *)ArduinoSaveAs));
+
+	memset(&hs->transferStats, 0, sizeof(hs->transferStats));
+	hs->transferStats.metrics.progress = metricsProgressOn();
+	hs->transferFailed = 1;
+
+	// window agreed with the device, a fourth argument overrides it, 0 for stop and wait
+	int window = hs->linkWindow;
+	if (*nargs > 3) window = atoi((char *)argv[3]);
+	unsigned char *frameBuf;
+
+	// stdin as -, a fifo, a character device or a file too big for the header's fileSize goes as a stream
+	struct stat st;
+	FILE *streamSrc = NULL;
+	int stream = !strcmp((char *)hostFileToSend, "-");
+	if (!stream && stat((char *)hostFileToSend, &st) == 0) {
+		if (!S_ISREG(st.st_mode) && !S_ISFIFO(st.st_mode) && !S_ISCHR(st.st_mode)) {
+			printf("<local><sendFile> : %s is not a file, fifo or device\n", hostFileToSend);
+			return;
+		}
+		stream = !S_ISREG(st.st_mode) || st.st_size > INT32_MAX;
+	}
+	if (stream) {
+		if (window <= 0 || !(hs->linkFeatures & HDR_FLAG_STREAM)) {
+			printf("<local><sendFile> : %s can only be streamed, the device does not take streams\n", hostFileToSend);
+			return;
+		}
+		if (*nargs < 3 && !strcmp((char *)hostFileToSend, "-")) {
+			printf("<local><sendFile> : HTOA - needs a name for the card\n");
+			return;
+		}
+		// a fifo's open waits for its writer, better before the device is waiting for us
+		streamSrc = strcmp((char *)hostFileToSend, "-") ? fopen((char *)hostFileToSend, "rb") : stdin;
+		if (streamSrc == NULL) {
+			printf("<local><sendFile> : can not open %s\n", hostFileToSend);
+			return;
+		}
+	}
+
+	// a missing file fails this command alone, before the device waits for a header
+	FILE *ptr_myfile = stream ? streamSrc : fopen((char *)hostFileToSend, "rb");
+	if (ptr_myfile == NULL) {
+		printf("<local><sendFile> : can not open %s: %s\n", hostFileToSend, strerror(errno));
+		return;
 	}
 
 	printf("<local><sendFile><02> : sending file %s file name length %ld as ", hostFileToSend, strlen(hostFileToSend));
 	printf(" file %s save length %ld \n", ArduinoSaveAs, strlen(ArduinoSaveAs));
 
-	write(fd, &BOT, 1);
+	pacer pace;
+	pacerInit(&pace, hs->baudRate);
+	int64_t startUs = pacerClockUs();
 
-	while(1) {
-		//	 printf("<local><sendFile><02> : begin transmission\n");
+	serialWrite(sp, &BOT, 1);
 
-		read(fd, &ch, 1);
-		if (ch == BOT) break;
+	//	 printf("<local><sendFile><02> : begin transmission\n");
+	if (!pacerReady(&pace, sp, BOT, LINK_TIMEOUT_MS)) {
+		printf("<local><sendFile><02> : no BOT from device\n");
+		if (ptr_myfile != stdin) fclose(ptr_myfile);
+		return;
 	}
 
 
 	//		 printf("<local><sendFile><03> : done syncing\n");
 
-	FILE *ptr_myfile;
-
-	ptr_myfile = fopen(hostFileToSend,"rb");
+	int fileSize = -1;
 
-	int fileSize;
+	if (!stream) {
+		fseek(ptr_myfile, 0L, SEEK_END);
+		fileSize = ftell(ptr_myfile);
 
-	fseek(ptr_myfile, 0L, SEEK_END);
-	fileSize = ftell(ptr_myfile);
+		rewind(ptr_myfile);
+	}
 
-	rewind(ptr_myfile);
+	frameBuf = (unsigned char *)malloc(hs->bufSize);
 
 	union crcOverlap {
 		uint32_t crcInt;
@@ -536,79 +910,161 @@ void sendFile(int fd, int *nargs, unsigned char **argv){
 
 	header send;
 
-	send.bufSize = bufSize;
+	windowOptions opt;
+	windowDefaults(&opt, hs->bufSize, window, hs->baudRate);
+	windowOptionsFromLink(&opt, hs->linkFeatures);
+	opt.stream = stream;
+
+	memset(&send, 0, sizeof(send));
+	send.bufSize = hs->bufSize;
 	send.fileSize = fileSize;
-	send.crcX = 365;
-	strcpy(send.fileName, ArduinoSaveAs);
-	send.poly = 7777;
+	send.flags = window > 0 ? HDR_FLAG_WINDOW : 0;
+	if (stream) send.flags |= HDR_FLAG_STREAM;
+	strncpy(send.fileName, ArduinoSaveAs, sizeof(send.fileName) - 1);
+	send.window = window > 0 ? opt.window : 0;
 	send.initX = 6666;
-	send.crcCheck = 12345;
+	// big files go over every link, a striped file is not resumed
+	int stripes = window > 0 && !stream && (hs->linkFeatures & HDR_FLAG_STRIPE) ? stripeCount(fileSize, hs->linkStripes) : 1;
+	if (stripes > 1) send.flags |= HDR_FLAG_STRIPE;
+	else if (window > 0 && !stream && (hs->linkFeatures & HDR_FLAG_RESUME)) send.flags |= HDR_FLAG_RESUME;
+	// the card may hold an older copy, see sendDelta, unless its listing says otherwise
+	if (window > 0 && !stream && (hs->linkFeatures & HDR_FLAG_DELTA) && cardListHas(&hs->cardDir, (char *)ArduinoSaveAs) != 0) {
+		send.flags |= HDR_FLAG_DELTA;
+	}
+	if (send.flags & (HDR_FLAG_RESUME | HDR_FLAG_DELTA)) send.initX = (int32_t)verifyCrcOf(ptr_myfile, fileSize);
+	// compress only files whose samples shrink, jpegs and the like go raw; a stream can not be sampled
+	if (window > 0 && (hs->linkFeatures & HDR_FLAG_PACK) &&
+			(stream || packWorthIt(ptr_myfile, fileSize, windowPayload(&opt)))) {
+		send.flags |= HDR_FLAG_PACK;
+		opt.pack = 1;
+	}
+	send.crcCheck = crc32Compute((unsigned char *)(&send), sizeof(send) - 4);
 
 	int  wlen;
 
 	crcClcData.crcInt = 4500;
 
 	//	delay(100);
-	wlen = write(fd, &send, sizeof(header));
-	usleep(2000);
+	wlen = serialWrite(sp, &send, sizeof(header));
+	pacerDrain(&pace, sp);
 
 	printf("wlen = %d \n", wlen);
 
+	if (window > 0) {
+		windowStats stats;
+
+		memset(&stats, 0, sizeof(stats));
+		stats.pace = pace;
+		stats.metrics.progress = metricsProgressOn();
+		printf("<local><sendFile> : window %d payload %d\n", opt.window, windowPayload(&opt));
+
+		int rc = 1;
+		if (send.flags & HDR_FLAG_DELTA) rc = sendDelta(hs, ptr_myfile, fileSize, &send, &stats);
+		if (rc > 0 && stripes > 1) {
+			printf("<local><sendFile> : striped over %d links\n", stripes);
+			rc = stripeSend(hs->hostLink, stripes, (char *)hostFileToSend, fileSize, &opt, &stats);
+		} else if (rc > 0) {
+			rc = windowSend(sp, ptr_myfile, fileSize, &opt, &stats);
+		}
+
+		if (rc < 0) {
+			printf("<local><sendFile> : window transfer failed\n");
+		} else {
+			hs->transferFailed = 0;
+		}
+		hs->transferStats = stats;
+		packReport(&stats, "sendFile", 1);
+		printf("<local><sendFile> : frames %ld resent %ld corrected %ld naks %ld timeouts %ld\n",
+				(long)stats.frames, (long)stats.resent, (long)stats.corrected, (long)stats.naks,
+				(long)stats.timeouts);
+		if (stats.resized > 0) printf("<local><sendFile> : frame size changed %ld times, last payload %d\n",
+				(long)stats.resized, stats.payload);
+		if (stats.start > 0) printf("<local><sendFile> : resumed at byte %ld\n", (long)stats.start);
+		if (stream) printf("<local><sendFile> : streamed %ld bytes\n", (long)stats.plainBytes);
+		pacerReport(&stats.pace, pacerClockUs() - startUs, "sendFile");
+		metricsReport(&stats, "sendFile", (char *)hostFileToSend, stream ? stats.plainBytes : fileSize,
+				pacerClockUs() - startUs, rc < 0);
+
+		if (ptr_myfile != stdin) fclose(ptr_myfile);
+		free(frameBuf);
+		printf("<local><sendFile> : closing file afer sending file\n");
+		printf("<local><sendFile> : ending");
+		return;
+	}
+
 	int numFrames;
 	int remainder;
 
-	numFrames = fileSize/(bufSize - crcSize);
-	remainder = fileSize % (bufSize - crcSize);
+	numFrames = fileSize/(hs->bufSize - crcSize);
+	remainder = fileSize % (hs->bufSize - crcSize);
 
 	printf(" > local numFrames %d\n", numFrames );
 	printf(" > local remainder %d\n", remainder );
 
 
+	// frames are copied straight out of a mapping of the file
+	fileMap map;
+	const unsigned char *mapped = fileMapOpen(&map, ptr_myfile, fileSize);
+
 	// read and write the bulk
+	int gaveUp = 0;
 	for(int32_t j = 0; j < numFrames; j++) {
-		printf("<local><sendFile> : frame is %d of %d\n", j, numFrames);
+		metricsProgress(&hs->transferStats.metrics, (int64_t)j * (hs->bufSize - crcSize), fileSize);
+		hs->transferStats.frames++;
 
 		// read data from file
-		fread(oneKbuf, bufSize - crcSize, 1, ptr_myfile);
+		if (mapped) memcpy(frameBuf, mapped + (int64_t)j * (hs->bufSize - crcSize), hs->bufSize - crcSize);
+		else fread(frameBuf, hs->bufSize - crcSize, 1, ptr_myfile);
 		//		printf("<local><sendFile> : frame read \n");
 
-		crcClcData.crcInt = crcbitbybitfast(oneKbuf, bufSize - crcSize);
+		crcClcData.crcInt = hs->bufSize == V4_FRAME_SIZE ? metricsCrcV4(&hs->transferStats.metrics, frameBuf) :
+				metricsCrc(&hs->transferStats.metrics, frameBuf, hs->bufSize - crcSize);
 
-		for(int i = 0; i < crcSize; i++) oneKbuf[bufSize - crcSize + i] = crcClcData.crcArray[i];
+		for(int i = 0; i < crcSize; i++) frameBuf[hs->bufSize - crcSize + i] = crcClcData.crcArray[i];
 
 		int count = 0;
+		int64_t frameUs = 0;
 		while (1) {
+			if (count > 0) hs->transferStats.resent++;
 			//		printf("<local><sendFile><04> : trying to send frame\n");
-			cleanUp(fd);
-
-			wlen = write(fd, oneKbuf, bufSize);
-			usleep(20000);
-			//		usleep(1000);
+			// the device asks for each frame with an EOT
+			int64_t readyUs = pacerClockUs();
+			cleanUp(sp);
+			pacerAccount(&pace, PACE_READY, readyUs);
+
+			if (count == 0) frameUs = pacerClockUs();
+			wlen = serialWrite(sp, frameBuf, hs->bufSize);
+			hs->transferStats.wireBytes += hs->bufSize;
 			//	printf("<local><sendFile><05> : sent frame\n");
 			//	cleanUp(fd);
 
-			read(fd, &ch, 1);
+			ch = pacerNextByte(&pace, sp, LINK_TIMEOUT_MS);
 
 			//		printf("<local><sendFile><06> : getting sync signal\n");
 
 			if (ch == SYNC) {
 				//				printf("<local><sendFile><02> : syncing\n");
-				read(fd, &tmpCrc, 1);
+				tmpCrc = serialReadByte(sp, LINK_TIMEOUT_MS);
 				if (tmpCrc == SOK){
 					//					printf("<local><sendFile><02> : crc code match: send ok\n");
 					break;
 				} else if (tmpCrc == NOK){
 					count++;
+					hs->transferStats.naks++;
 					//					printf("<local><sendFile><02> : crc code no match: re send count number %d \n", count);
 
 					if (count == 10) break;
 				} else {
 					printf("<local><sendFile><02> : dont recognize send code\n");
+					if (++count == 10) break;
 				}
 			} else {
 				printf("<local><sendFile><02> : syncing dont know\n");
+				if (++count == 10) break;
 			}
 		}
+		if (count == 10) gaveUp++;
+		metricsFrame(&hs->transferStats.metrics, count, count == 0 ? pacerClockUs() - frameUs : -1);
 
 		//	tcdrain(fd);    /* delay for output *
 
@@ -617,43 +1073,61 @@ void sendFile(int fd, int *nargs, unsigned char **argv){
 	}
 
 
-	fread(oneKbuf, remainder, 1, ptr_myfile);
+	if (mapped) memcpy(frameBuf, mapped + (int64_t)numFrames * (hs->bufSize - crcSize), remainder);
+	else fread(frameBuf, remainder, 1, ptr_myfile);
+	fileMapClose(&map);
 
-	crcClcData.crcInt = crcbitbybitfast(oneKbuf, remainder);
+	crcClcData.crcInt = metricsCrc(&hs->transferStats.metrics, frameBuf, remainder);
 
-	for(int i = 0; i < crcSize; i++) oneKbuf[remainder + i] = crcClcData.crcArray[i];
+	for(int i = 0; i < crcSize; i++) frameBuf[remainder + i] = crcClcData.crcArray[i];
 
 	int count = 0;
+	int64_t frameUs = pacerClockUs();
+	hs->transferStats.frames++;
 	while (1) {
-		write(fd, oneKbuf, remainder + crcSize);
+		if (count > 0) hs->transferStats.resent++;
+		serialWrite(sp, frameBuf, remainder + crcSize);
+		hs->transferStats.wireBytes += remainder + crcSize;
 
-		read(fd, &ch, 1);
+		ch = pacerNextByte(&pace, sp, LINK_TIMEOUT_MS);
 
 		if (ch == SYNC) {
 			printf("<local><sendFile><02> : syncing\n");
-			read(fd, &tmpCrc, 1);
+			tmpCrc = serialReadByte(sp, LINK_TIMEOUT_MS);
 			if (tmpCrc == SOK){
 				printf("<local><sendFile><03> : remainder crc code match: send ok\n");
 				break;
 			} else if (tmpCrc == NOK){
 				count++;
+				hs->transferStats.naks++;
 				printf("<local><sendFile><03> : remainder crc code no match: re send count number %d \n", count);
 
 				if (count == 10) break;
 			} else {
 				printf("<local><sendFile><02> : remainder dont recognize send code\n");
+				if (++count == 10) break;
 			}
 		} else {
 			printf("<local><sendFile><02> : remainder syncing dont know\n");
+			if (++count == 10) break;
 		}
 
 
 
 	}
+	if (count == 10) gaveUp++;
+	metricsFrame(&hs->transferStats.metrics, count, count == 0 ? pacerClockUs() - frameUs : -1);
+	metricsProgress(&hs->transferStats.metrics, fileSize, fileSize);
+	hs->transferFailed = gaveUp > 0;
 	printf("<local><sendFile> : sync complete %d \n", wlen);
 
 	fclose(ptr_myfile);
+	free(frameBuf);
 
+	hs->transferStats.pace = pace;
+	hs->transferStats.plainBytes = fileSize;
+	pacerReport(&pace, pacerClockUs() - startUs, "sendFile");
+	metricsReport(&hs->transferStats, "sendFile", (char *)hostFileToSend, fileSize, pacerClockUs() - startUs, hs->transferFailed);
 
 	printf("<local><sendFile> : closing file afer sending file\n");
 	printf("<local><sendFile> : ending");
@@ -661,6 +1135,344 @@ void sendFile(int fd, int *nargs, unsigned char **argv){
 
 
 
+/*
+MHTOA <glob | @manifest> ...  sends every file named in one stream, see
+batch.h.  Devices without batch support get one HTOA per file instead.
+*/
+void sendBatch(hostSession *hs, int nargs, unsigned char **argv){
+	serialPort *sp = hs->hostLink[0];
+	batchList bl = {0};
+	char line[BATCH_LINE_MAX];
+	windowOptions opt;
+	windowStats stats;
+	header send;
+	FILE *stream;
+	int64_t size;
+
+	for (int i = 1; i < nargs; i++) batchAdd(&bl, (char *)argv[i]);
+	if (bl.count == 0) {
+		printf("<local><sendBatch> : no files to send\n");
+		return;
+	}
+
+	if (!(hs->linkFeatures & HDR_FLAG_BATCH) || hs->linkWindow < 1) {
+		printf("<local><sendBatch> : device has no batch mode, sending %d files one by one\n", bl.count);
+		for (int i = 0; i < bl.count; i++) {
+			char *base = strrchr(bl.names[i], '/');
+
+			snprintf(line, sizeof(line), "HTOA %s %s\n", bl.names[i], base ? base + 1 : bl.names[i]);
+			runCommand(hs, (unsigned char *)line);
+		}
+		batchFree(&bl);
+		return;
+	}
+
+	stream = batchPack(&bl, &size);
+	if (stream == NULL || size > INT32_MAX) {
+		printf("<local><sendBatch> : can not build a stream of %d files\n", bl.count);
+		if (stream) fclose(stream);
+		batchFree(&bl);
+		return;
+	}
+
+	memset(&hs->transferStats, 0, sizeof(hs->transferStats));
+	hs->transferFailed = 1;
+	memset(&stats, 0, sizeof(stats));
+	pacerInit(&stats.pace, hs->baudRate);
+	stats.metrics.progress = metricsProgressOn();
+	int64_t startUs = pacerClockUs();
+
+	serialWrite(sp, "MHTOA\n", 6);
+	serialWrite(sp, &BOT, 1);
+	if (!pacerReady(&stats.pace, sp, BOT, LINK_TIMEOUT_MS)) {
+		printf("<local><sendBatch> : no BOT from device\n");
+		fclose(stream);
+		batchFree(&bl);
+		cleanUp(sp);
+		return;
+	}
+
+	windowDefaults(&opt, hs->bufSize, hs->linkWindow, hs->baudRate);
+	windowOptionsFromLink(&opt, hs->linkFeatures);
+	memset(&send, 0, sizeof(send));
+	send.fileSize = (int32_t)size;
+	send.bufSize = hs->bufSize;
+	send.flags = HDR_FLAG_WINDOW | HDR_FLAG_BATCH;
+	if ((hs->linkFeatures & HDR_FLAG_PACK) && packWorthIt(stream, size, windowPayload(&opt))) {
+		send.flags |= HDR_FLAG_PACK;
+		opt.pack = 1;
+	}
+	strncpy((char *)send.fileName, (char *)argv[1], sizeof(send.fileName) - 1);
+	send.window = opt.window;
+	send.crcCheck = crc32Compute((unsigned char *)(&send), sizeof(send) - 4);
+	serialWrite(sp, &send, sizeof(send));
+	pacerDrain(&stats.pace, sp);
+
+	if (windowSend(sp, stream, size, &opt, &stats) < 0) {
+		printf("<local><sendBatch> : batch transfer failed\n");
+	} else {
+		hs->transferFailed = 0;
+	}
+	hs->transferStats = stats;
+	packReport(&stats, "sendBatch", 1);
+
+	printf("<local><sendBatch> : %d files, %ld bytes in one stream, frames %ld resent %ld\n",
+			bl.count, (long)size, (long)stats.frames, (long)stats.resent);
+	pacerReport(&stats.pace, pacerClockUs() - startUs, "sendBatch");
+	metricsReport(&stats, "sendBatch", (char *)argv[1], size, pacerClockUs() - startUs, hs->transferFailed);
+
+	fclose(stream);
+	batchFree(&bl);
+	cleanUp(sp);
+}
+
+/*
+MATOH <pattern | @manifest> ...  fetches the card files matching the
+patterns, or named in the manifest, in one stream into the current
+directory.
+*/
+void recvBatch(hostSession *hs, int nargs, unsigned char **argv){
+	serialPort *sp = hs->hostLink[0];
+	char line[BATCH_LINE_MAX];
+	batchList bl = {0};
+	windowOptions opt;
+	windowStats stats;
+	header recv;
+	FILE *stream;
+	int len, files, bad;
+
+	// manifests are read here, patterns are matched on the card
+	len = snprintf(line, sizeof(line), "MATOH");
+	for (int i = 1; i < nargs; i++) {
+		if (argv[i][0] == '@') {
+			int first = bl.count;
+
+			batchAdd(&bl, (char *)argv[i]);
+			for (int j = first; j < bl.count; j++) {
+				len += snprintf(line + len, sizeof(line) - len, " %s", bl.names[j]);
+			}
+		} else {
+			len += snprintf(line + len, sizeof(line) - len, " %s", argv[i]);
+		}
+		if (len >= (int)sizeof(line) - 1) break;
+	}
+	batchFree(&bl);
+
+	if (len >= (int)sizeof(line) - 1) {
+		printf("<local><recvBatch> : more names than fit on one %d byte command line\n", BATCH_LINE_MAX);
+		return;
+	}
+	if (nargs < 2) {
+		printf("<local><recvBatch> : no files named\n");
+		return;
+	}
+
+	if (!(hs->linkFeatures & HDR_FLAG_BATCH) || hs->linkWindow < 1) {
+		char one[BATCH_LINE_MAX + 16];
+
+		printf("<local><recvBatch> : device has no batch mode, fetching files one by one\n");
+		char *save = NULL;
+
+		for (char *name = strtok_r(line + 6, " ", &save); name != NULL; name = strtok_r(NULL, " ", &save)) {
+			const cardEntry *found[256];
+			char names[256][64];
+			int n;
+
+			if (!strpbrk(name, "*?[")) {
+				snprintf(one, sizeof(one), "ATOH %s %s\n", name, name);
+				runCommand(hs, (unsigned char *)one);
+				continue;
+			}
+			// patterns are matched against the card's listing here instead
+			if (!(hs->linkFeatures & HDR_FLAG_LIST)) {
+				printf("<local><recvBatch> : %s needs batch mode to match on the card\n", name);
+				continue;
+			}
+			if (!hs->cardDir.valid) {
+				cardListFetch(&hs->cardDir, sp, 0);
+				cleanUp(sp);
+			}
+			n = cardListMatch(&hs->cardDir, name, found, 256);
+			for (int i = 0; i < n; i++) memcpy(names[i], found[i]->fileName, 64);
+			for (int i = 0; i < n; i++) {
+				snprintf(one, sizeof(one), "ATOH %.63s %.63s\n", names[i], names[i]);
+				runCommand(hs, (unsigned char *)one);
+			}
+		}
+		return;
+	}
+
+	memset(&hs->transferStats, 0, sizeof(hs->transferStats));
+	hs->transferFailed = 1;
+	memset(&stats, 0, sizeof(stats));
+	pacerInit(&stats.pace, hs->baudRate);
+	stats.metrics.progress = metricsProgressOn();
+	int64_t startUs = pacerClockUs();
+
+	line[len++] = '\n';
+	serialWrite(sp, line, len);
+
+	if (!pacerReady(&stats.pace, sp, BOT, LINK_TIMEOUT_MS)) {
+		printf("<local><recvBatch> : no BOT from device\n");
+		cleanUp(sp);
+		return;
+	}
+	serialWrite(sp, &BOT, 1);
+
+	if (serialReadExact(sp, &recv, sizeof(recv), LINK_TIMEOUT_MS) < (int)sizeof(recv) ||
+			recv.crcCheck != crc32Compute((unsigned char *)(&recv), sizeof(recv) - 4) ||
+			!(recv.flags & HDR_FLAG_BATCH) ||
+			recv.bufSize <= WF_OVERHEAD || recv.bufSize > HOST_MAX_FRAME) {
+		printf("<local><recvBatch> : bad batch header\n");
+		cleanUp(sp);
+		return;
+	}
+
+	stream = tmpfile();
+	windowDefaults(&opt, recv.bufSize, recv.window, hs->baudRate);
+	windowOptionsFromLink(&opt, hs->linkFeatures);
+	if (windowRecv(sp, stream, recv.fileSize, &opt, &stats) < 0) {
+		printf("<local><recvBatch> : batch transfer failed\n");
+	} else {
+		bad = batchUnpack(stream, recv.fileSize, ".", &files);
+		if (bad < 0) {
+			printf("<local><recvBatch> : batch stream is damaged\n");
+		} else {
+			printf("<local><recvBatch> : %d files, %d bad, %d bytes in one stream\n", files, bad, recv.fileSize);
+			hs->transferFailed = bad > 0;
+		}
+	}
+	hs->transferStats = stats;
+	packReport(&stats, "recvBatch", 0);
+	pacerReport(&stats.pace, pacerClockUs() - startUs, "recvBatch");
+	metricsReport(&stats, "recvBatch", "batch", recv.fileSize, pacerClockUs() - startUs, hs->transferFailed);
+
+	fclose(stream);
+	cleanUp(sp);
+}
+
+/*
+VERIFY <pattern | @manifest> ...  checks the local files matching the
+patterns against the card's copies by size and crc32 without moving them.
+The local crcs are worked out while the device reads its copies.
+*/
+void verifyFiles(hostSession *hs, int nargs, unsigned char **argv){
+	serialPort *sp = hs->hostLink[0];
+	char line[BATCH_LINE_MAX];
+	batchList bl = {0};
+	int len = snprintf(line, sizeof(line), "VERIFY");
+	int same = 0, differ = 0, missing = 0, damaged = 0;
+	int64_t *size, deadline;
+	uint32_t *crc;
+	digest *card, d;
+	int ch;
+
+	for (int i = 1; i < nargs; i++) {
+		int first = bl.count;
+
+		batchAdd(&bl, (char *)argv[i]);
+		// the card has no directories, it is asked for the names or patterns without them
+		for (int j = first; j < bl.count && argv[i][0] == '@'; j++) {
+			char *base = strrchr(bl.names[j], '/');
+
+			len += snprintf(line + len, sizeof(line) - len, " %s", base ? base + 1 : bl.names[j]);
+		}
+		if (argv[i][0] != '@') {
+			char *base = strrchr((char *)argv[i], '/');
+
+			len += snprintf(line + len, sizeof(line) - len, " %s", base ? base + 1 : (char *)argv[i]);
+		}
+		if (len >= (int)sizeof(line) - 1) break;
+	}
+	if (len >= (int)sizeof(line) - 1) {
+		printf("<local><verify> : more names than fit on one %d byte command line\n", BATCH_LINE_MAX);
+		batchFree(&bl);
+		return;
+	}
+	if (bl.count == 0) {
+		printf("<local><verify> : no local files to check\n");
+		return;
+	}
+	if (!(hs->linkFeatures & HDR_FLAG_VERIFY)) {
+		printf("<local><verify> : device can not VERIFY, fetch the files with ATOH to compare them\n");
+		batchFree(&bl);
+		return;
+	}
+
+	hs->transferFailed = 1;
+	int64_t startUs = pacerClockUs();
+	len += snprintf(line + len, sizeof(line) - len, "\n");
+	serialWrite(sp, line, len);
+
+	size = (int64_t *)malloc(sizeof(int64_t) * bl.count);
+	crc = (uint32_t *)malloc(sizeof(uint32_t) * bl.count);
+	card = (digest *)malloc(sizeof(digest) * bl.count);
+	for (int i = 0; i < bl.count; i++) {
+		if (verifyFileCrc(bl.names[i], &size[i], &crc[i]) < 0) size[i] = -1;
+		card[i].fileSize = -1;
+	}
+
+	deadline = serialNowMs() + VERIFY_TIMEOUT_MS;
+	while (1) {
+		ch = serialReadByte(sp, serialMsLeft(deadline));
+		if (ch < 0 || ch == EOT || ch == BOT) break;
+		putchar(ch);
+	}
+	if (ch != BOT) {
+		printf("<local><verify> : no answer from device\n");
+		free(size);
+		free(crc);
+		free(card);
+		batchFree(&bl);
+		return;
+	}
+
+	// one digest per card file, in the order the card found them
+	while (1) {
+		if (serialReadExact(sp, &d, sizeof(d), VERIFY_TIMEOUT_MS) < (int)sizeof(d) ||
+				d.crcCheck != crc32Compute(&d, sizeof(d) - 4)) {
+			printf("<local><verify> : digest list damaged\n");
+			damaged = 1;
+			break;
+		}
+		if (d.fileSize < 0) break;
+		d.fileName[sizeof(d.fileName) - 1] = '\0';
+		for (int i = 0; i < bl.count; i++) {
+			char *base = strrchr(bl.names[i], '/');
+
+			if (card[i].fileSize < 0 && !strcmp(base ? base + 1 : bl.names[i], (char *)d.fileName)) {
+				card[i] = d;
+				break;
+			}
+		}
+	}
+
+	for (int i = 0; i < bl.count; i++) {
+		if (size[i] < 0) {
+			printf("<local><verify> : %-24s can not be read here\n", bl.names[i]);
+			missing++;
+		} else if (card[i].fileSize < 0) {
+			printf("<local><verify> : %-24s not on the card\n", bl.names[i]);
+			missing++;
+		} else if (card[i].fileSize != size[i] || card[i].fileCrc != crc[i]) {
+			printf("<local><verify> : %-24s differs, %ld bytes crc %08x here, %ld bytes crc %08x on the card\n",
+					bl.names[i], (long)size[i], crc[i], (long)card[i].fileSize, card[i].fileCrc);
+			differ++;
+		} else {
+			same++;
+		}
+	}
+	printf("<local><verify> : %d same, %d differ, %d missing, %.1f ms\n",
+			same, differ, missing, (pacerClockUs() - startUs) / 1000.0);
+	hs->transferFailed = damaged || differ > 0 || missing > 0;
+
+	free(size);
+	free(crc);
+	free(card);
+	batchFree(&bl);
+	cleanUp(sp);
+}
+
 void getArguments(unsigned char *keyBoardInput, int inputBufferSize, int *nargs, unsigned char *argv[10]){
 
 	*nargs = 0;
@@ -724,100 +1536,281 @@ void listing(){
 
 
 
-int main()
-{
-	printf("> local : ");
-	unsigned char keyBoardInput[inputBufferSize];
-	char *portname = "/dev/ttyS5";
-	int fd;
+/*
+Runs one console line against the device: BAUD and PROBE are handled here,
+anything else is sent on and its answer read up to the EOT.  returns 1
+after QUIT.
+*/
+int runCommand(hostSession *hs, unsigned char *line){
+	serialPort *sp = hs->hostLink[0];
+	int nargs = 0;
+	unsigned char *argv[10];
 	int wlen;
-	int32_t error = checkMaskEtc();
 
-	fd = open(portname, O_RDWR | O_NOCTTY | O_SYNC);
-	if (fd < 0) {
-		printf("Error opening %s: %s\n", portname, strerror(errno));
-		return -1;
+	printf("<local><main><01> : input length =  %ld \n", strlen((char *)line));
+
+	// agree frame size and features before the first transfer or listing
+	if (!hs->capsDone && (!strncasecmp((char *)line, "HTOA", 4) ||
+			!strncasecmp((char *)line, "ATOH", 4) || !strncasecmp((char *)line, "DIR", 3) ||
+			!strncasecmp((char *)line, "LDIR", 4))) {
+		negotiateCaps(hs);
 	}
-	/*baudrate 115200, 8 bits, no parity, 1 stop bit */
-	    set_interface_attribs(fd, 115200);
-//	set_interface_attribs(fd, 57600);
-	//   set_interface_attribs(fd, 9600);
-	//   set_mincount(fd, 0);                /* set to pure timed read */
-	set_blocking(fd, 0);
-	//   sleep(10);
-	unsigned char ch;
 
-	/* simple output */
-	char * pch;
-	unsigned char *cmdStr;
-	char *cmd;
-	char *param;
-	int len;
+	// the listing comes back as records and is kept, DIR CRC has the card crc every file
+	if ((hs->linkFeatures & HDR_FLAG_LIST) && (!strncasecmp((char *)line, "DIR", 3) ||
+			!strncasecmp((char *)line, "LDIR", 4))) {
+		getArguments(line, strlen((char *)line), &nargs, argv);
+		if (argv[0][0] == 'L') {
+			printf("<local> : listing local directory\n");
+			listing();
+		}
+		printf("<local> : listing remote directory\n");
+		if (cardListFetch(&hs->cardDir, sp, nargs > 1 && !strcasecmp((char *)argv[1], "CRC")) == 0) {
+			cardListPrint(&hs->cardDir);
+		}
+		cleanUp(sp);
+		return(0);
+	}
 
-	/*
-//unsigned char ch;
-	while(1) {
-//	printf("here \n");
-		read(fd, &ch, 1);
-		//if (ch == EOT) break;
-			printf("%c", ch);
+	// speed changes are run by the host, the device sees its own BAUD / PROBE lines
+	if (!strncasecmp((char *)line, "BAUD ", 5)) {
+		if (!hs->capsDone) negotiateCaps(hs);
+		if (changeBaud(hs, atoi((char *)line + 5)) < 0) {
+			printf("<local> : staying at %d baud\n", hs->baudRate);
+		}
+		return(0);
+	}
+	if (!strncasecmp((char *)line, "PROBE", 5)) {
+		int maxRate = atoi((char *)line + 5);
+		probeSpeed(hs, maxRate > 0 ? maxRate : DEFAULT_PROBE_MAX);
+		return(0);
 	}
-	//		cleanUp(fd);
-	 */
-	while (1){
-		for(int i = 0; i < inputBufferSize; i++ ) keyBoardInput[i] = '\n';
 
-		// poll keyboard
-		fgets(keyBoardInput, strlen((char *)keyBoardInput), stdin);
+	// batches write their own command line, or fall back to single transfers
+	if (!strncasecmp((char *)line, "MHTOA", 5) || !strncasecmp((char *)line, "MATOH", 5)) {
+		if (!hs->capsDone) negotiateCaps(hs);
+		if (line[1] == 'H' || line[1] == 'h') cardListInvalidate(&hs->cardDir);
+		getArguments(line, strlen((char *)line), &nargs, argv);
+		if (argv[0][1] == 'H') sendBatch(hs, nargs, argv);
+		else recvBatch(hs, nargs, argv);
+		return(0);
+	}
 
-		// send tidied input to arduino
+	// VERIFY sends the card names only, the local paths stay here
+	if (!strncasecmp((char *)line, "VERIFY", 6)) {
+		if (!hs->capsDone) negotiateCaps(hs);
+		getArguments(line, strlen((char *)line), &nargs, argv);
+		verifyFiles(hs, nargs, argv);
+		return(0);
+	}
 
-		printf("<local><main><01> : input length =  %ld \n", strlen((char *)keyBoardInput));
+	wlen = serialWrite(sp, line, strlen((char *)line));
 
-		wlen = write(fd, keyBoardInput, strlen((char *)keyBoardInput));
+	getArguments(line, strlen((char *)line), &nargs, argv);
+	printf("<local><main><02> : \n");
+	if (nargs == 0) {
+		cleanUp(sp);
+		return(0);
+	}
 
-		//	cleanUp(fd);
+	if (!strcmp((char *)argv[0], "HELP")){
+		printf("<local> : help\n");
+		cleanUp(sp);
+	} else if (!strcmp((char *)argv[0], "DIR")){
+		printf("<local> : listing remote directory\n");
+		cleanUp(sp);
+	} else if (!strcmp((char *)argv[0], "LDIR")){
+		printf("<local> : listing local directory\n");
+		listing();
+		printf("<local> : listing remote directory\n");
+		cleanUp(sp);
+	} else if (!strcmp((char *)argv[0], "ATOH")){
+		printf("<local> : expecting file xx \n");
+		printf("<local> : recvFile xxxx \n");
+		recvFile(hs, &nargs, argv);
+		cleanUp(sp);
+	} else if (!strcmp((char *)argv[0], "HTOA")){
+		printf("<local> : sending file\n");
+		printf("<local> : send to arduino \n ");
+		printf("<local> : sending file %s as %s\n", argv[1] ? (char *)argv[1] : "", argv[2] ? (char *)argv[2] : "");
+		sendFile(hs, &nargs, argv);
+		cardListInvalidate(&hs->cardDir);
+		cleanUp(sp);
+	} else if (!strcmp((char *)argv[0], "QUIT")){
+		printf("<local> : exiting \n");
+		cleanUp(sp);
+		return(1);
+	} else  {
+		// it may have been a firmware command that changes the card
+		printf("<local> : other command?\n");
+		cardListInvalidate(&hs->cardDir);
+		cleanUp(sp);
+	}
+	return(0);
+}
 
-		int nargs = 0;
-		unsigned char *argv[10];
-		getArguments(keyBoardInput, strlen((char *)keyBoardInput), &nargs, argv);
-		printf("<local><main><02> : \n");
+/*
+Waits for the next console line, printing whatever the device says in the
+meantime: one epoll loop over the keyboard and the command link, so
+output the device sends between commands shows up as it arrives instead of
+sitting in the port until the next cleanUp().  stdin is read with plain
+read()s and lines are cut out here, several lines pasted or piped at once
+are handed over one per call.  returns 0 with a line in 'line', -1 at the
+end of input.
+*/
+int consoleLine(serialPort *sp, unsigned char *line, int size){
+	static char pending[1024];
+	static int have = 0, eof = 0;
+	static int ep = -1, keyboard = 0;
+	struct epoll_event ev;
+
+	if (ep < 0) {
+		ep = epoll_create1(EPOLL_CLOEXEC);
+		ev.events = EPOLLIN;
+		ev.data.fd = sp->fd;
+		epoll_ctl(ep, EPOLL_CTL_ADD, sp->fd, &ev);
+		// a script redirected from a plain file can not be polled, it is always ready
+		ev.data.fd = STDIN_FILENO;
+		keyboard = epoll_ctl(ep, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+	}
 
+	while (1) {
+		char *nl = memchr(pending, '\n', have);
+		int n;
+
+		// a whole line, or a last one without its newline, or one too long to wait for
+		if (nl != NULL || (eof && have > 0) || have >= size - 1) {
+			int len = nl != NULL ? (int)(nl - pending) + 1 : have;
+
+			if (len > size - 1) len = size - 1;
+			memcpy(line, pending, len);
+			line[len] = '\0';
+			memmove(pending, pending + len, have - len);
+			have -= len;
+			return(0);
+		}
+		if (eof) return(-1);
 
-		if (!strcmp((char *)argv[0], "HELP")){
-			printf("<local> : help\n");
-			cleanUp(fd);
-		} else if (!strcmp((char *)argv[0], "DIR")){
-			printf("<local> : listing remote directory\n");
-			cleanUp(fd);
-		} else if (!strcmp((char *)argv[0], "LDIR")){
-			printf("<local> : listing local directory\n");
-			listing();
-			printf("<local> : listing remote directory\n");
-			cleanUp(fd);
-		} else if (!strcmp((char *)argv[0], "ATOH")){
-			printf("<local> : expecting file xx \n");
-			printf("<local> : recvFile xxxx \n");
-			recvFile(fd, &nargs, argv);
-			cleanUp(fd);
-		} else if (!strcmp((char *)argv[0], "HTOA")){
-			printf("<local> : sending file\n");
-			printf("<local> : send to arduino \n ");
-			printf("<local> : sending file %s file name length %ld as ", argv[1], strlen(argv[1]));
-			printf(" file %s file name length %ld \n", argv[2], strlen(argv[2]));
-			sendFile(fd, &nargs, argv);
-			cleanUp(fd);
-		} else if (!strcmp((char *)argv[0], "QUIT")){
-			printf("<local> : exiting \n");
-			cleanUp(fd);
-			return (0);
-		} else  {
-			printf("<local> : other command?\n");
-			cleanUp(fd);
+		while (serialAvailable(sp) > 0) putchar(serialReadByte(sp, 0));
+		fflush(stdout);
+
+		if (keyboard) {
+			n = epoll_wait(ep, &ev, 1, -1);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) {
+				eof = 1;
+				continue;
+			}
+			if (ev.data.fd == sp->fd) {
+				int ch, got = 0;
+
+				while ((ch = serialReadByte(sp, 0)) >= 0) {
+					putchar(ch);
+					got++;
+				}
+				fflush(stdout);
+				// a link that hung up stays readable, stop watching it
+				if (got == 0 && (ev.events & (EPOLLHUP | EPOLLERR))) epoll_ctl(ep, EPOLL_CTL_DEL, sp->fd, NULL);
+				continue;
+			}
 		}
-		printf("<local> : ");
+		n = read(STDIN_FILENO, pending + have, sizeof(pending) - have);
+		if (n > 0) have += n;
+		else if (n == 0 || errno != EINTR) eof = 1;
+	}
+}
 
+// opens and sets up every port in ls, the first carries the commands; -1 if one fails
+int openLinks(const linkSettings *ls, int *fd){
+	for (int i = 0; i < ls->links; i++) {
+		fd[i] = open(ls->ports[i], O_RDWR | O_NOCTTY | O_SYNC);
+		if (fd[i] < 0) {
+			printf("Error opening %s: %s\n", ls->ports[i], strerror(errno));
+			while (--i >= 0) close(fd[i]);
+			return(-1);
+		}
+		/*baudrate from the command line, 8 bits, no parity, 1 stop bit */
+		set_interface_attribs(fd[i], ls->portBaud[i]);
+		//   set_mincount(fd, 0);                /* set to pure timed read */
+		set_blocking(fd[i], 0);
+	}
+	return(0);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char keyBoardInput[inputBufferSize];
+	linkSettings settings;
+	scriptQueue script = {0};
+	pid_t simPid = 0;
+	int fd[LINKS_MAX];
+	int setupFailed = -1;
+	crc32Init();
+	fecInit();
+
+	if (settingsParse(argc, argv, &settings) < 0) return -1;
+	metricsOutput(settings.metricsFile, settings.progress);
+	hostFec = settings.fec;
+
+	if (settings.bench) return(benchRun(&settings));
+	if (settings.jobSocket != NULL) return(daemonSubmit(&settings));
+	if (settings.daemonSocket != NULL) return(daemonRun(&settings));
+
+	// commands from -c and -script run unattended, see script.h
+	for (int i = 0; i < settings.commandCount; i++) scriptAdd(&script, settings.commands[i]);
+	if (settings.script != NULL && scriptLoad(&script, settings.script) < 0) return(SCRIPT_EXIT_USAGE);
+	script.keepGoing = settings.keepGoing;
+	if (settings.commandCount > 0 || settings.script != NULL) setupFailed = SCRIPT_EXIT_USAGE;
+
+	if (settings.sim) {
+		devsimOptions sim;
+
+		devsimDefaults(&sim);
+		sim.cardDir = settings.cardDir;
+		sim.baud = settings.baud;
+		sim.latencyMs = settings.latencyMs;
+		sim.v4 = settings.v4;
+		sim.bitErrors = settings.bitErrors;
+		sim.dropRate = settings.dropRate;
+		sim.dupRate = settings.dupRate;
+		sim.links = settings.links;
+		simPid = devsimStart(&sim, fd);
+		if (simPid < 0) return(setupFailed);
+	} else {
+		if (openLinks(&settings, fd) < 0) return(setupFailed);
+	}
+
+	static serialPort port;
+	static hostSession session;
+	serialInit(&port, fd[0]);
+	sessionInit(&session, &port, settings.baud);
+	session.hostLinks = settings.links;
+	for (int i = 1; i < session.hostLinks; i++) {
+		session.hostLink[i] = (serialPort *)malloc(sizeof(serialPort));
+		serialInit(session.hostLink[i], fd[i]);
+	}
+
+	if (settings.probeMax > 0) probeSpeed(&session, settings.probeMax);
+
+	if (setupFailed == SCRIPT_EXIT_USAGE) {
+		int rc = script.count > 0 ? scriptRun(&script, &session) : SCRIPT_EXIT_OK;
+
+		scriptFree(&script);
+		if (simPid > 0) devsimStop(simPid, fd, settings.links);
+		return(rc);
+	}
+	printf("> local : ");
+
+	while (1){
+		// keyboard or device, end of input quits
+		if (consoleLine(&port, keyBoardInput, inputBufferSize) < 0) {
+			strcpy((char *)keyBoardInput, "QUIT\n");
+		}
+
+		if (runCommand(&session, keyBoardInput)) break;
+		printf("<local> : ");
 	}
 
-	sleep(100);
+	if (simPid > 0) devsimStop(simPid, fd, settings.links);
+	return (0);
 }
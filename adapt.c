@@ -0,0 +1,64 @@
+/*
+Frame size adaptation, see adapt.h
+*/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "adapt.h"
+
+void adaptInit(frameAdapt *a, int maxPayload, int overhead){
+	a->payload = maxPayload;
+	a->maxPayload = maxPayload;
+	a->overhead = overhead;
+	a->next = 0;
+	a->count = 0;
+	a->since = 0;
+}
+
+/*
+A frame of 'wire' bytes is acknowledged after 'retries' resends.  returns 1
+when a new payload is chosen.
+*/
+int adaptSent(frameAdapt *a, int wire, int retries){
+	double h = a->overhead, mean = 0.0, best;
+	int failed = 0, payload;
+
+	for (int i = 0; i <= retries; i++) {
+		a->wire[a->next] = wire;
+		a->failed[a->next] = i < retries;
+		a->next = (a->next + 1) % ADAPT_HISTORY;
+		if (a->count < ADAPT_HISTORY) a->count++;
+		a->since++;
+	}
+	if (a->since < ADAPT_EVERY) return(0);
+	a->since = 0;
+
+	for (int i = 0; i < a->count; i++) {
+		mean += a->wire[i];
+		failed += a->failed[i];
+	}
+	mean /= a->count;
+
+	if (failed == 0) {
+		// a clean run has to be a long one before it says much
+		if (a->count < ADAPT_HISTORY) return(0);
+		best = 2 * mean;
+	} else {
+		double rate = (double)failed / a->count;
+		double lnq;
+
+		if (rate > 0.9) rate = 0.9;
+		lnq = log(1.0 - rate) / mean;
+		best = h / 2 + sqrt(h * h / 4 - h / lnq);
+	}
+
+	payload = best - h > a->maxPayload ? a->maxPayload : (int)(best - h) / ADAPT_STEP * ADAPT_STEP;
+	if (payload < ADAPT_MIN_PAYLOAD) payload = ADAPT_MIN_PAYLOAD;
+	if (payload > a->maxPayload) payload = a->maxPayload;
+
+	// moves of less than an eighth are noise in the estimate
+	if (abs(payload - a->payload) * 8 < a->payload) return(0);
+	a->payload = payload;
+	return(1);
+}
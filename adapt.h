@@ -0,0 +1,46 @@
+/*
+Frame size fitted to the line while a window transfer runs.
+
+Big frames waste least on headers, small ones lose least to an error.  A
+frame of n bytes on the wire gets through whole with probability q^n, q
+the chance one byte does, and carries n - h bytes of file, h being what a
+frame costs besides its payload.  Goodput goes as (n - h) / n * q^n, which
+is largest at
+
+	n = h / 2 + sqrt(h * h / 4 - h / ln q)
+
+q is worked out from the last ADAPT_HISTORY frames sent: the share that had
+to be resent, at the size they were.  With none resent the frames double,
+up to the agreed size.  The sender's disk stage cuts each new frame to the
+payload chosen, so frames already staged keep theirs.
+
+	adaptInit(&a, windowPayload(&opt), overhead);
+	...
+	if (adaptSent(&a, wireLen, retries)) newPayload = a.payload;
+*/
+
+#ifndef ADAPT_H
+#define ADAPT_H
+
+#include <stdint.h>
+
+#define ADAPT_HISTORY 64	// sends the error rate is taken over
+#define ADAPT_EVERY 8		// sends between looks at it
+#define ADAPT_MIN_PAYLOAD 64
+#define ADAPT_STEP 32		// payloads are a multiple of this, or the agreed size
+
+typedef struct frameAdapt {
+	int payload;		// for the frames cut next
+	int maxPayload;		// agreed in CAPS
+	int overhead;		// wire bytes a frame costs besides its payload
+	int wire[ADAPT_HISTORY];	// recent sends, their length on the wire
+	unsigned char failed[ADAPT_HISTORY];	// and whether it had to go again
+	int next;
+	int count;
+	int since;		// sends since the last look
+} frameAdapt;
+
+void adaptInit(frameAdapt *a, int maxPayload, int overhead);
+int adaptSent(frameAdapt *a, int wire, int retries);
+
+#endif
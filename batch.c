@@ -0,0 +1,160 @@
+/*
+Batch stream packing, see batch.h
+*/
+
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "crc32.h"
+#include "protocol.h"
+
+static void batchPush(batchList *bl, const char *name){
+	bl->names = (char **)realloc(bl->names, sizeof(char *) * (bl->count + 1));
+	bl->names[bl->count++] = strdup(name);
+}
+
+// the name a file is stored under on the other side, no directories
+static const char *batchBase(const char *path){
+	const char *slash = strrchr(path, '/');
+	return(slash ? slash + 1 : path);
+}
+
+/*
+Adds the files named by 'spec', a glob pattern or @manifest.  returns the
+number added, -1 if a manifest can not be read.
+*/
+int batchAdd(batchList *bl, const char *spec){
+	int before = bl->count;
+
+	if (spec[0] == '@') {
+		FILE *mf = fopen(spec + 1, "r");
+		char line[256];
+
+		if (mf == NULL) {
+			printf("<batchAdd> : can not open manifest %s\n", spec + 1);
+			return(-1);
+		}
+		while (fgets(line, sizeof(line), mf) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if (line[0] != '\0' && line[0] != '#') batchPush(bl, line);
+		}
+		fclose(mf);
+	} else {
+		glob_t g;
+
+		if (glob(spec, 0, NULL, &g) == 0) {
+			for (size_t i = 0; i < g.gl_pathc; i++) batchPush(bl, g.gl_pathv[i]);
+		}
+		globfree(&g);
+	}
+	return(bl->count - before);
+}
+
+void batchFree(batchList *bl){
+	for (int i = 0; i < bl->count; i++) free(bl->names[i]);
+	free(bl->names);
+	bl->names = NULL;
+	bl->count = 0;
+}
+
+/*
+Packs the list into a temporary file: for each file an entry then its
+bytes.  Files that can not be read are left out.  returns the stream
+rewound, with its length in 'size'.
+*/
+FILE *batchPack(const batchList *bl, int64_t *size){
+	FILE *stream = tmpfile();
+	unsigned char buf[16384];
+
+	*size = 0;
+	if (stream == NULL) return(NULL);
+
+	for (int i = 0; i < bl->count; i++) {
+		FILE *f = fopen(bl->names[i], "rb");
+		long start, end;
+		entry e;
+		size_t n;
+
+		if (f == NULL) {
+			printf("<batchPack> : skipping %s, can not open it\n", bl->names[i]);
+			continue;
+		}
+
+		// the entry is written twice, the second time with size and crc filled in
+		memset(&e, 0, sizeof(e));
+		strncpy((char *)e.fileName, batchBase(bl->names[i]), sizeof(e.fileName) - 1);
+		start = ftell(stream);
+		fwrite(&e, sizeof(e), 1, stream);
+
+		e.crcCheck = CRC32_START;
+		while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+			e.crcCheck = crc32Update(e.crcCheck, buf, n);
+			fwrite(buf, 1, n, stream);
+			e.fileSize += n;
+		}
+		fclose(f);
+
+		end = ftell(stream);
+		fseek(stream, start, SEEK_SET);
+		fwrite(&e, sizeof(e), 1, stream);
+		fseek(stream, end, SEEK_SET);
+	}
+
+	*size = ftell(stream);
+	rewind(stream);
+	return(stream);
+}
+
+/*
+Writes every file in the stream into 'dir' and checks its crc.  returns
+the number of files that failed, or -1 if the stream itself is broken.
+*/
+int batchUnpack(FILE *stream, int64_t size, const char *dir, int *files){
+	unsigned char buf[16384];
+	int64_t pos = 0;
+	int bad = 0;
+
+	*files = 0;
+	rewind(stream);
+
+	while (pos < size) {
+		char path[512];
+		uint32_t crc = CRC32_START;
+		int32_t left;
+		FILE *f;
+		entry e;
+
+		if (size - pos < (int64_t)sizeof(e) || fread(&e, sizeof(e), 1, stream) != 1) return(-1);
+		pos += sizeof(e);
+		e.fileName[sizeof(e.fileName) - 1] = '\0';
+		if (e.fileSize < 0 || e.fileSize > size - pos) return(-1);
+
+		snprintf(path, sizeof(path), "%s/%s", dir, batchBase((char *)e.fileName));
+		f = fopen(path, "wb");
+		if (f == NULL) printf("<batchUnpack> : can not create %s\n", path);
+
+		for (left = e.fileSize; left > 0; ) {
+			size_t n = left < (int32_t)sizeof(buf) ? (size_t)left : sizeof(buf);
+
+			if (fread(buf, 1, n, stream) != n) {
+				if (f) fclose(f);
+				return(-1);
+			}
+			crc = crc32Update(crc, buf, n);
+			if (f) fwrite(buf, 1, n, f);
+			left -= n;
+		}
+		pos += e.fileSize;
+
+		if (f) fclose(f);
+		if (f == NULL || crc != e.crcCheck) {
+			printf("<batchUnpack> : %s failed its crc check\n", e.fileName);
+			bad++;
+		}
+		(*files)++;
+	}
+	return(bad);
+}
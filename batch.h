@@ -0,0 +1,33 @@
+/*
+Batch transfers: many files sent as one stream with one handshake.
+
+The sender packs every file behind an entry sub-header (protocol.h) into a
+single stream, the receiver unpacks it again.  Files are named by shell
+globs or by a manifest, a text file with one name per line given as
+@list.txt.
+
+	batchList bl = {0};
+	batchAdd(&bl, "@list.txt");
+	stream = batchPack(&bl, &size);		// then windowSend(stream)
+	...
+	batchUnpack(stream, size, ".", &files);	// after windowRecv(stream)
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct batchList {
+	int count;
+	char **names;		// paths as they open on this side
+} batchList;
+
+int batchAdd(batchList *bl, const char *spec);
+void batchFree(batchList *bl);
+
+FILE *batchPack(const batchList *bl, int64_t *size);
+int batchUnpack(FILE *stream, int64_t size, const char *dir, int *files);
+
+#endif
@@ -0,0 +1,286 @@
+/*
+End to end transfer benchmark against the device simulator.
+
+Each sample file goes to the simulated card with HTOA and comes back with
+ATOH, once with v4 firmware (64 byte stop and wait frames) and once with
+the negotiated sliding window, at the -sim baud rate and latency.  The
+.bmp files then go both ways again as one MHTOA / MATOH batch, and a
+lightly edited pony.jpg is sent over the card's copy as a delta.  Last
+the window legs run again striped over -links links (2 if not given).  The
+round trip copy is compared with the original, and each leg reports
+bytes/s, frames/s, resent frames, the compression ratio and the host's
+cpu time.  The transfers'
+own console chatter is discarded.
+
+	./HostSeriaPport_v4_crc32 2000000 -bench -latency 5
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "devsim.h"
+#include "host.h"
+#include "pacing.h"
+#include "protocol.h"
+
+static const char *benchFiles[] = {
+	"file.txt", "one.bmp", "eight.bmp", "stop.bmp", "pony.jpg", NULL
+};
+
+static int64_t cpuUs(void){
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return((int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+			ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+static int sameFile(const char *a, const char *b){
+	FILE *fa = fopen(a, "rb");
+	FILE *fb = fopen(b, "rb");
+	int same = fa != NULL && fb != NULL;
+
+	while (same) {
+		unsigned char ba[4096], bb[4096];
+		size_t na = fread(ba, 1, sizeof(ba), fa);
+		size_t nb = fread(bb, 1, sizeof(bb), fb);
+
+		if (na != nb || memcmp(ba, bb, na)) same = 0;
+		if (na == 0) break;
+	}
+	if (fa) fclose(fa);
+	if (fb) fclose(fb);
+	return(same);
+}
+
+// src with 4 KB changed a third of the way in and 64 bytes inserted at two thirds
+static int benchEdit(const char *src, const char *dst){
+	FILE *in = fopen(src, "rb");
+	FILE *out = fopen(dst, "wb");
+	unsigned char *data = NULL;
+	long size = 0;
+	int rc = -1;
+
+	if (in != NULL && out != NULL && fseek(in, 0, SEEK_END) == 0 && (size = ftell(in)) > 3 * 4096) {
+		data = (unsigned char *)malloc(size);
+		rewind(in);
+		if (fread(data, 1, size, in) == (size_t)size) {
+			for (long i = size / 3; i < size / 3 + 4096; i++) data[i] ^= 0x5a;
+			fwrite(data, 1, size * 2 / 3, out);
+			for (int i = 0; i < 64; i++) fputc(i, out);
+			fwrite(data + size * 2 / 3, 1, size - size * 2 / 3, out);
+			rc = 0;
+		}
+	}
+	if (in) fclose(in);
+	if (out) fclose(out);
+	free(data);
+	return(rc);
+}
+
+static void benchClearCard(const char *card){
+	char pattern[300];
+	batchList bl = {0};
+
+	snprintf(pattern, sizeof(pattern), "%s/*", card);
+	batchAdd(&bl, pattern);
+	for (int i = 0; i < bl.count; i++) unlink(bl.names[i]);
+	batchFree(&bl);
+}
+
+// runs one command with stdout pointed at /dev/null
+static void benchQuiet(hostSession *hs, const char *cmd){
+	unsigned char line[512];
+	int quiet, saved;
+
+	snprintf((char *)line, sizeof(line), "%s\n", cmd);
+
+	fflush(stdout);
+	saved = dup(1);
+	quiet = open("/dev/null", O_WRONLY);
+	dup2(quiet, 1);
+	close(quiet);
+
+	runCommand(hs, line);
+
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+}
+
+static void benchLeg(hostSession *hs, const char *cmd, long bytes, const char *mode, const char *file){
+	int64_t t0, c0, wallUs, cpu;
+	double ratio;
+	char dir[6];
+
+	snprintf(dir, sizeof(dir), "%.*s", (int)strcspn(cmd, " "), cmd);
+
+	t0 = pacerClockUs();
+	c0 = cpuUs();
+	benchQuiet(hs, cmd);
+	wallUs = pacerClockUs() - t0;
+	cpu = cpuUs() - c0;
+
+	if (wallUs < 1) wallUs = 1;
+	// compression ratio, 1 for v4 and raw transfers
+	ratio = hs->transferStats.packedBytes > 0 ? (double)hs->transferStats.plainBytes / hs->transferStats.packedBytes : 1.0;
+	printf("%-7s %-5s %-10s %9ld %10.0f %9.1f %7ld %7ld %6.2f %8.3f %8.3f%s\n",
+			mode, dir, file, bytes,
+			bytes * 1e6 / wallUs, hs->transferStats.frames * 1e6 / wallUs,
+			(long)hs->transferStats.resent, (long)hs->transferStats.naks, ratio,
+			wallUs / 1e6, cpu / 1e6, hs->transferFailed ? "  FAILED" : "");
+}
+
+int benchRun(const linkSettings *ls){
+	char card[] = "/tmp/simcardXXXXXX";
+	char out[] = "/tmp/simoutXXXXXX";
+	int stripeLinks = ls->links > 1 ? ls->links : 2;
+	int bad = 0;
+
+	if (mkdtemp(card) == NULL || mkdtemp(out) == NULL) {
+		printf("bench : can not make temporary directories\n");
+		return(-1);
+	}
+
+	printf("bench : %d baud, %d ms latency, card %s\n", ls->baud, ls->latencyMs, card);
+	printf("%-7s %-5s %-10s %9s %10s %9s %7s %7s %6s %8s %8s\n",
+			"mode", "dir", "file", "bytes", "bytes/s", "frames/s", "resent", "naks", "ratio", "wall s", "cpu s");
+
+	for (int m = 0; m < 3; m++) {
+		int v4 = m == 0;
+		int links = m == 2 ? stripeLinks : 1;
+		char mode[24];		// "stripe" and any int
+		devsimOptions sim;
+		static serialPort port;
+		static hostSession hs;
+		pid_t pid;
+		int fd[LINKS_MAX];
+
+		if (m == 2) snprintf(mode, sizeof(mode), "stripe%d", links);
+		else snprintf(mode, sizeof(mode), "%s", v4 ? "v4" : "window");
+
+		devsimDefaults(&sim);
+		sim.cardDir = card;
+		sim.baud = ls->baud;
+		sim.latencyMs = ls->latencyMs;
+		sim.v4 = v4;
+		sim.bitErrors = ls->bitErrors;
+		sim.dropRate = ls->dropRate;
+		sim.dupRate = ls->dupRate;
+		sim.links = links;
+		pid = devsimStart(&sim, fd);
+		if (pid < 0) return(-1);
+
+		serialInit(&port, fd[0]);
+		// a fresh session, so caps are agreed again with this mode's device
+		sessionInit(&hs, &port, ls->baud);
+		hs.hostLinks = links;
+		for (int i = 1; i < links; i++) {
+			hs.hostLink[i] = (serialPort *)malloc(sizeof(serialPort));
+			serialInit(hs.hostLink[i], fd[i]);
+		}
+		// every mode starts from an empty card, or HTOA would go as a delta
+		benchClearCard(card);
+
+		for (int i = 0; benchFiles[i] != NULL; i++) {
+			const char *file = benchFiles[i];
+			char cmd[400], back[300];
+			struct stat st;
+
+			if (stat(file, &st) < 0) continue;
+			snprintf(back, sizeof(back), "%s/%s", out, file);
+
+			snprintf(cmd, sizeof(cmd), "HTOA %s %s", file, file);
+			benchLeg(&hs, cmd, (long)st.st_size, mode, file);
+
+			snprintf(cmd, sizeof(cmd), "ATOH %s %s", file, back);
+			benchLeg(&hs, cmd, (long)st.st_size, mode, file);
+
+			if (!sameFile(file, back)) {
+				printf("bench : %s %s came back different\n", mode, file);
+				bad++;
+			}
+			unlink(back);
+		}
+
+		// the small files again, as one batch each way
+		{
+			char cmd[400], here[256], back[600];
+			batchList bl = {0};
+			long bytes = 0;
+			int len;
+
+			batchAdd(&bl, "*.bmp");
+			len = snprintf(cmd, sizeof(cmd), "MATOH");
+			for (int i = 0; i < bl.count; i++) {
+				struct stat st;
+
+				if (stat(bl.names[i], &st) == 0) bytes += st.st_size;
+				len += snprintf(cmd + len, sizeof(cmd) - len, " %s", bl.names[i]);
+			}
+
+			if (bl.count > 0 && getcwd(here, sizeof(here)) != NULL) {
+				char put[300];
+
+				snprintf(put, sizeof(put), "MHTOA %s/*.bmp", here);
+				benchLeg(&hs, put, bytes, mode, "*.bmp");
+
+				// fetched files land in the current directory
+				if (chdir(out) == 0) {
+					benchLeg(&hs, cmd, bytes, mode, "*.bmp");
+					if (chdir(here) < 0) return(-1);
+				}
+				for (int i = 0; i < bl.count; i++) {
+					snprintf(back, sizeof(back), "%s/%s", out, bl.names[i]);
+					if (!sameFile(bl.names[i], back)) {
+						printf("bench : %s batch %s came back different\n", mode, bl.names[i]);
+						bad++;
+					}
+					unlink(back);
+				}
+			}
+			batchFree(&bl);
+		}
+
+		// an edited copy over the card's pony.jpg, checked on the card itself
+		if (m == 1 && access("pony.jpg", R_OK) == 0) {
+			char edited[300], onCard[300], cmd[700];
+			struct stat st;
+
+			snprintf(edited, sizeof(edited), "%s/pony.jpg", out);
+			snprintf(onCard, sizeof(onCard), "%s/pony.jpg", card);
+			if (benchEdit("pony.jpg", edited) == 0 && stat(edited, &st) == 0) {
+				snprintf(cmd, sizeof(cmd), "HTOA %s pony.jpg", edited);
+				benchLeg(&hs, cmd, (long)st.st_size, "delta", "pony.jpg");
+				if (!sameFile(edited, onCard)) {
+					printf("bench : delta pony.jpg came out different on the card\n");
+					bad++;
+				}
+				// open ended frames once broke the delta's FIN check, keep the leg on them
+				if (!(hs.linkFeatures & HDR_FLAG_ADAPT)) {
+					printf("bench : delta leg ran without adaptive frames\n");
+					bad++;
+				}
+			}
+			unlink(edited);
+		}
+
+		benchQuiet(&hs, "QUIT");
+		devsimStop(pid, fd, links);
+		for (int i = 1; i < links; i++) free(hs.hostLink[i]);
+		cardListInvalidate(&hs.cardDir);
+	}
+
+	benchClearCard(card);
+	rmdir(card);
+	rmdir(out);
+
+	printf("bench : %s\n", bad ? "round trip mismatches" : "all files round tripped intact");
+	return(bad ? 1 : 0);
+}
@@ -0,0 +1,96 @@
+/*
+Cached card listing, see cardlist.h
+*/
+
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cardlist.h"
+#include "crc32.h"
+
+#define LIST_TIMEOUT_MS 30000	// the device may crc every file before answering
+
+/*
+Sends LIST (LIST CRC for crcs too) and reads the records into cl.
+returns 0 with the list valid, -1 if the device did not answer with one;
+either way its closing console text and EOT are left for the caller.
+*/
+int cardListFetch(cardList *cl, serialPort *sp, int withCrc){
+	const char *cmd = withCrc ? "LIST CRC\n" : "LIST\n";
+	cardEntry e;
+	int64_t deadline;
+	int ch;
+
+	cardListInvalidate(cl);
+	serialWrite(sp, cmd, strlen(cmd));
+	deadline = serialNowMs() + LIST_TIMEOUT_MS;
+	while (1) {
+		ch = serialReadByte(sp, serialMsLeft(deadline));
+		if (ch < 0 || ch == EOT) return(-1);
+		if (ch == BOT) break;
+		putchar(ch);
+	}
+
+	while (1) {
+		if (serialReadExact(sp, &e, sizeof(e), LIST_TIMEOUT_MS) < (int)sizeof(e) ||
+				e.crcCheck != crc32Compute(&e, sizeof(e) - 4)) {
+			printf("<local><cardList> : listing damaged\n");
+			cl->count = 0;
+			return(-1);
+		}
+		if (e.fileSize < 0) break;
+		e.fileName[sizeof(e.fileName) - 1] = '\0';
+		cl->entries = (cardEntry *)realloc(cl->entries, sizeof(cardEntry) * (cl->count + 1));
+		cl->entries[cl->count++] = e;
+	}
+	cl->withCrc = withCrc;
+	cl->valid = 1;
+	return(0);
+}
+
+void cardListInvalidate(cardList *cl){
+	free(cl->entries);
+	cl->entries = NULL;
+	cl->count = 0;
+	cl->valid = 0;
+	cl->withCrc = 0;
+}
+
+void cardListPrint(const cardList *cl){
+	for (int i = 0; i < cl->count; i++) {
+		const cardEntry *e = &cl->entries[i];
+		time_t t = (time_t)e->mtime;
+		char when[32];
+
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&t));
+		if (cl->withCrc) printf("%-24s %10ld  %s  %08x\n", e->fileName, (long)e->fileSize, when, e->fileCrc);
+		else printf("%-24s %10ld  %s\n", e->fileName, (long)e->fileSize, when);
+	}
+	printf("<local><cardList> : %d files on the card\n", cl->count);
+}
+
+const cardEntry *cardListFind(const cardList *cl, const char *name){
+	for (int i = 0; cl->valid && i < cl->count; i++) {
+		if (!strcmp((const char *)cl->entries[i].fileName, name)) return(&cl->entries[i]);
+	}
+	return(NULL);
+}
+
+// 1 if the card holds 'name', 0 if it surely does not, -1 if the list is stale
+int cardListHas(const cardList *cl, const char *name){
+	if (!cl->valid) return(-1);
+	return(cardListFind(cl, name) != NULL);
+}
+
+// the first max entries matching a shell pattern, returns how many were found
+int cardListMatch(const cardList *cl, const char *pattern, const cardEntry **found, int max){
+	int n = 0;
+
+	for (int i = 0; cl->valid && i < cl->count && n < max; i++) {
+		if (fnmatch(pattern, (const char *)cl->entries[i].fileName, 0) == 0) found[n++] = &cl->entries[i];
+	}
+	return(n);
+}
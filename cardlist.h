@@ -0,0 +1,37 @@
+/*
+The host's copy of the card directory, see cardEntry in protocol.h.
+
+DIR on a device with HDR_FLAG_LIST fetches the listing as records instead
+of console text, and the host keeps it: transfers that want to know what
+the card holds (is there an old copy to send a delta against, which files
+match a pattern) look here instead of asking the device each time.
+Anything that may change the card, HTOA, MHTOA or a command the host does
+not know, throws the copy away and the next question fetches it again.
+
+	cardListFetch(&cl, sp, 0);		// after CAPS, then cleanUp(sp)
+	if (cardListHas(&cl, "pony.jpg") == 0) ... surely not on the card
+	cardListInvalidate(&cl);
+*/
+
+#ifndef CARDLIST_H
+#define CARDLIST_H
+
+#include "protocol.h"
+#include "serialio.h"
+
+typedef struct cardList {
+	int valid;		// matches the card as far as the host knows
+	int withCrc;		// entries carry fileCrc
+	int count;
+	cardEntry *entries;
+} cardList;
+
+int cardListFetch(cardList *cl, serialPort *sp, int withCrc);
+void cardListInvalidate(cardList *cl);
+void cardListPrint(const cardList *cl);
+
+const cardEntry *cardListFind(const cardList *cl, const char *name);
+int cardListHas(const cardList *cl, const char *name);
+int cardListMatch(const cardList *cl, const char *pattern, const cardEntry **found, int max);
+
+#endif
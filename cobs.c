@@ -0,0 +1,45 @@
+/*
+COBS encoding, see cobs.h
+
+Each run of up to 253 non zero bytes goes out behind a code byte, one more
+than its length; a code below 0xff stands for the run and then a zero, 0xff
+for a full run with no zero after it.  The zero implied after the last run
+is not part of the frame.
+*/
+
+#include "cobs.h"
+
+// returns the encoded length, without the delimiter
+int cobsEncode(const unsigned char *in, int len, unsigned char *out){
+	int code = 0, o = 1;
+	unsigned char c;
+
+	// the byte at out[code] is written once its run is known, after the run
+	for (int i = 0; i < len; i++) {
+		c = in[i];
+		if (c != 0) out[o++] = c;
+		if (c == 0 || o - code == 0xff) {
+			out[code] = (unsigned char)(o - code);
+			code = o++;
+		}
+	}
+	out[code] = (unsigned char)(o - code);
+	return(o);
+}
+
+// returns the decoded length, or -1 for a zero or a run past the end
+int cobsDecode(const unsigned char *in, int len, unsigned char *out){
+	int i = 0, o = 0;
+
+	while (i < len) {
+		int code = in[i++];
+
+		if (code == 0 || i + code - 1 > len) return(-1);
+		for (int k = 1; k < code; k++) {
+			if (in[i] == 0) return(-1);
+			out[o++] = in[i++];
+		}
+		if (code < 0xff && i < len) out[o++] = 0;
+	}
+	return(o);
+}
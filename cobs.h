@@ -0,0 +1,30 @@
+/*
+Consistent overhead byte stuffing for window frames.
+
+A frame is encoded so it holds no zero bytes and is sent with a zero after
+it.  The receiver reads up to the next zero and decodes what it got, so a
+byte lost or added on the line spoils that one frame, its crc fails, and
+the next frame starts in step again; nothing has to be thrown away or
+waited out.  The cost is one byte in 254 plus the delimiter.
+
+	n = cobsEncode(raw, len, wire);	// wire has len + COBS_EXTRA(len)
+	wire[n++] = COBS_DELIM;
+	...
+	len = cobsDecode(wire, n - 1, raw);	// -1 if it is not a valid encoding
+
+Decoding can be done in place.  Encoding can too when the raw frame sits
+COBS_EXTRA(len) bytes into the buffer, the output never catches it up.
+*/
+
+#ifndef COBS_H
+#define COBS_H
+
+#define COBS_DELIM 0x00
+
+// encoding overhead for len bytes, delimiter included
+#define COBS_EXTRA(len) ((len) / 254 + 2)
+
+int cobsEncode(const unsigned char *in, int len, unsigned char *out);
+int cobsDecode(const unsigned char *in, int len, unsigned char *out);
+
+#endif
@@ -0,0 +1,420 @@
+/*
+CRC32 engine, see crc32.h
+
+The crc the link has always used comes from crcbitbybitfast() below: the
+polynomial and reflection are the usual IEEE ones, but the register starts
+at zero (crcinit_direct was never set) and the result is xored with
+0xffffffff.  The table and folding paths keep exactly that behaviour, which
+in zlib terms means crc32Compute(p, len) == crc32(0xffffffff, p, len).
+
+Internally every path works on the reflected register, the public value is
+the register xored with CRC32_XOROUT, so results can be chained.
+*/
+
+#include <string.h>
+
+#include "crc32.h"
+
+#if !CRC32_REFIN || !CRC32_REFOUT
+#error "the table paths work on a reflected register"
+#endif
+
+// crcFold's constants are worked out for the IEEE polynomial only
+#if (defined(__x86_64__) || defined(__i386__)) && CRC32_POLY == 0x04c11db7
+#include <immintrin.h>
+#define CRC_HAVE_PCLMUL 1
+#endif
+
+// the crc material, from the model in crc32.h
+#define CRC_MASK (((((uint32_t)1 << (CRC32_ORDER - 1)) - 1) << 1) | 1)
+#define CRC_HIGHBIT ((uint32_t)1 << (CRC32_ORDER - 1))
+
+// bit reversal of a 32 bit constant, folded by the compiler
+#define CRC_REV1(x) ((((x) >> 1) & 0x55555555) | (((x) & 0x55555555) << 1))
+#define CRC_REV2(x) ((((x) >> 2) & 0x33333333) | (((x) & 0x33333333) << 2))
+#define CRC_REV4(x) ((((x) >> 4) & 0x0f0f0f0f) | (((x) & 0x0f0f0f0f) << 4))
+#define CRC_REV8(x) ((((x) >> 8) & 0x00ff00ff) | (((x) & 0x00ff00ff) << 8))
+#define CRC_REV16(x) ((((x) >> 16) & 0x0000ffff) | (((x) & 0x0000ffff) << 16))
+#define CRC_REFLECT32(x) CRC_REV16(CRC_REV8(CRC_REV4(CRC_REV2(CRC_REV1((uint32_t)(x))))))
+
+#define CRC_POLY_REFLECTED (CRC_REFLECT32(CRC32_POLY) >> (32 - CRC32_ORDER))
+
+static uint32_t crcTable[16][256];
+static uint32_t x2nTable[32];		// x^(2^n) mod P, for crc32Combine
+static int crcReady = 0;
+static crcPath activePath = CRC_PATH_SLICE8;
+
+uint32_t reflect (uint32_t crc, int32_t bitnum) {
+
+	// reflects the lower 'bitnum' bits of 'crc'
+
+	uint32_t i, j=1, crcout=0;
+
+	for (i=(uint32_t)1<<(bitnum-1); i; i>>=1) {
+		if (crc & i) crcout|=j;
+		j<<= 1;
+	}
+	return (crcout);
+}
+
+static uint32_t crcbitbybitfast(uint32_t crc, const unsigned char* p, size_t len) {
+
+	// fast bit by bit algorithm without augmented zero bytes.
+	// does not use lookup table, suited for polynom orders between 1...32.
+	// 'crc' is the direct (non reflected) register to continue from.
+
+	uint32_t c, bit;
+	uint32_t j;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		c = (uint32_t)*p++;
+
+#if CRC32_REFIN
+		c = reflect(c, 8);
+#endif
+
+		for (j=0x80; j; j>>=1) {
+
+			bit = crc & CRC_HIGHBIT;
+			crc<<= 1;
+			if (c & j) bit^= CRC_HIGHBIT;
+			if (bit) crc^= CRC32_POLY;
+		}
+	}
+
+	return(crc);
+}
+
+static uint32_t crcBitwise(uint32_t reg, const unsigned char *p, size_t len){
+	// the bit by bit loop runs on the direct register, convert in and out
+	uint32_t crc = crcbitbybitfast(reflect(reg, CRC32_ORDER), p, len);
+
+#if CRC32_REFOUT
+	crc = reflect(crc, CRC32_ORDER);
+#endif
+	return(crc & CRC_MASK);
+}
+
+static uint32_t crcBytewise(uint32_t reg, const unsigned char *p, size_t len){
+	while (len--) reg = (reg >> 8) ^ crcTable[0][(reg ^ *p++) & 0xff];
+	return(reg);
+}
+
+static inline uint32_t load32(const unsigned char *p){
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return(v);
+}
+
+static uint32_t crcSlice8(uint32_t reg, const unsigned char *p, size_t len){
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len >= 8) {
+		uint32_t one = load32(p) ^ reg;
+		uint32_t two = load32(p + 4);
+
+		reg = crcTable[7][one & 0xff] ^
+				crcTable[6][(one >> 8) & 0xff] ^
+				crcTable[5][(one >> 16) & 0xff] ^
+				crcTable[4][one >> 24] ^
+				crcTable[3][two & 0xff] ^
+				crcTable[2][(two >> 8) & 0xff] ^
+				crcTable[1][(two >> 16) & 0xff] ^
+				crcTable[0][two >> 24];
+		p += 8;
+		len -= 8;
+	}
+#endif
+	return(crcBytewise(reg, p, len));
+}
+
+static uint32_t crcSlice16(uint32_t reg, const unsigned char *p, size_t len){
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len >= 16) {
+		uint32_t one = load32(p) ^ reg;
+		uint32_t two = load32(p + 4);
+		uint32_t three = load32(p + 8);
+		uint32_t four = load32(p + 12);
+
+		reg = crcTable[15][one & 0xff] ^
+				crcTable[14][(one >> 8) & 0xff] ^
+				crcTable[13][(one >> 16) & 0xff] ^
+				crcTable[12][one >> 24] ^
+				crcTable[11][two & 0xff] ^
+				crcTable[10][(two >> 8) & 0xff] ^
+				crcTable[9][(two >> 16) & 0xff] ^
+				crcTable[8][two >> 24] ^
+				crcTable[7][three & 0xff] ^
+				crcTable[6][(three >> 8) & 0xff] ^
+				crcTable[5][(three >> 16) & 0xff] ^
+				crcTable[4][three >> 24] ^
+				crcTable[3][four & 0xff] ^
+				crcTable[2][(four >> 8) & 0xff] ^
+				crcTable[1][(four >> 16) & 0xff] ^
+				crcTable[0][four >> 24];
+		p += 16;
+		len -= 16;
+	}
+#endif
+	return(crcSlice8(reg, p, len));
+}
+
+#ifdef CRC_HAVE_PCLMUL
+/*
+Folding with carry-less multiplies, after Intel's "Fast CRC Computation for
+Generic Polynomials Using PCLMULQDQ Instruction".  Four 128 bit lanes are
+folded 64 bytes at a time, then reduced to one lane, then Barrett reduced to
+32 bits.  The constants are x^n mod P for the reflected IEEE polynomial.
+*/
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crcFold(uint32_t reg, const unsigned char *p, size_t len){
+	const __m128i k1k2 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);
+	const __m128i k5 = _mm_set_epi64x(0, 0x163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x1f7011641, 0x1db710641);
+	const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	// caller guarantees len >= 64 and a multiple of 16
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 16));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 32));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)reg));
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(p + 0)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(p + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(p + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(p + 48)));
+		p += 64;
+		len -= 64;
+	}
+
+	// fold the four lanes into one
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x2);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x3);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x4);
+
+	while (len >= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)p));
+		p += 16;
+		len -= 16;
+	}
+
+	// 128 -> 64 bits, also appends the 32 zero bits
+	x2 = _mm_clmulepi64_si128(k3k4, x1, 0x01);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	// 64 -> 32 bits
+	x2 = _mm_and_si128(x1, mask32);
+	x1 = _mm_srli_si128(x1, 4);
+	x2 = _mm_clmulepi64_si128(x2, k5, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return((uint32_t)_mm_extract_epi32(x1, 1));
+}
+#endif
+
+static uint32_t crcPclmul(uint32_t reg, const unsigned char *p, size_t len){
+#ifdef CRC_HAVE_PCLMUL
+	if (len >= 64) {
+		size_t bulk = len & ~(size_t)15;
+
+		reg = crcFold(reg, p, bulk);
+		p += bulk;
+		len -= bulk;
+	}
+#endif
+	return(crcSlice16(reg, p, len));
+}
+
+static uint32_t crcRun(crcPath path, uint32_t reg, const unsigned char *p, size_t len){
+	switch (path) {
+	case CRC_PATH_BITWISE:
+		return(crcBitwise(reg, p, len));
+	case CRC_PATH_SLICE16:
+		return(crcSlice16(reg, p, len));
+	case CRC_PATH_PCLMUL:
+		return(crcPclmul(reg, p, len));
+	default:
+		return(crcSlice8(reg, p, len));
+	}
+}
+
+// a * b modulo the crc polynomial, both reflected (bit 31 is x^0)
+static uint32_t gfMulModP(uint32_t a, uint32_t b){
+	uint32_t m = 0x80000000, p = 0;
+
+	for (; m != 0; m >>= 1) {
+		if (a & m) p ^= b;
+		b = (b & 1) ? (b >> 1) ^ CRC_POLY_REFLECTED : b >> 1;
+	}
+	return(p);
+}
+
+void crc32Init(void){
+	uint32_t c;
+	int n, k;
+
+	if (crcReady) return;
+
+	for (n = 0; n < 256; n++) {
+		c = (uint32_t)n;
+		for (k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ CRC_POLY_REFLECTED : c >> 1;
+		crcTable[0][n] = c;
+	}
+	for (n = 0; n < 256; n++) {
+		c = crcTable[0][n];
+		for (k = 1; k < 16; k++) {
+			c = (c >> 8) ^ crcTable[0][c & 0xff];
+			crcTable[k][n] = c;
+		}
+	}
+
+	// x^1 is bit 30 of a reflected register
+	x2nTable[0] = 0x40000000;
+	for (n = 1; n < 32; n++) x2nTable[n] = gfMulModP(x2nTable[n - 1], x2nTable[n - 1]);
+
+	crcReady = 1;
+
+	activePath = CRC_PATH_SLICE16;
+	if (crc32PathAvailable(CRC_PATH_PCLMUL)) activePath = CRC_PATH_PCLMUL;
+}
+
+int crc32PathAvailable(crcPath path){
+	if (path == CRC_PATH_PCLMUL) {
+#ifdef CRC_HAVE_PCLMUL
+		__builtin_cpu_init();
+		return(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"));
+#else
+		return(0);
+#endif
+	}
+	return(path >= 0 && path < CRC_PATH_COUNT);
+}
+
+const char *crc32PathName(crcPath path){
+	switch (path) {
+	case CRC_PATH_BITWISE: return("bitwise");
+	case CRC_PATH_SLICE8: return("slice8");
+	case CRC_PATH_SLICE16: return("slice16");
+	case CRC_PATH_PCLMUL: return("pclmul");
+	default: return("unknown");
+	}
+}
+
+crcPath crc32ActivePath(void){
+	return(activePath);
+}
+
+int crc32SetPath(crcPath path){
+	crc32Init();
+	if (!crc32PathAvailable(path)) return(-1);
+	activePath = path;
+	return(0);
+}
+
+uint32_t crc32UpdatePath(crcPath path, uint32_t crc, const void *buf, size_t len){
+	crc32Init();
+	return(crcRun(path, crc ^ CRC32_XOROUT, (const unsigned char *)buf, len) ^ CRC32_XOROUT);
+}
+
+uint32_t crc32Update(uint32_t crc, const void *buf, size_t len){
+	return(crcRun(activePath, crc ^ CRC32_XOROUT, (const unsigned char *)buf, len) ^ CRC32_XOROUT);
+}
+
+uint32_t crc32Compute(const void *buf, size_t len){
+	return(crc32Update(CRC32_START, buf, len));
+}
+
+/*
+The crc of a followed by b.  Appending lenB bytes multiplies a's register
+by x^(8 lenB) and adds in b's, which started from a zero register; the
+power is built from the squares in x2nTable.
+*/
+uint32_t crc32Combine(uint32_t crcA, uint32_t crcB, int64_t lenB){
+	uint32_t shift = 0x80000000;
+
+	crc32Init();
+	for (int k = 3; lenB > 0; lenB >>= 1, k++) {
+		if (lenB & 1) shift = gfMulModP(x2nTable[k & 31], shift);
+	}
+	return(gfMulModP(shift, crcA ^ CRC32_XOROUT) ^ crcB);
+}
+
+// the crc of len zero bytes, from runs of 1, 2, 4 ... joined as the bits of len say
+uint32_t crc32Zeros(int64_t len){
+	static const unsigned char zero[1];
+	uint32_t crc = crc32Compute(zero, 0), run = crc32Compute(zero, 1);
+
+	for (int64_t n = 1; len > 0; len >>= 1, n <<= 1) {
+		if (len & 1) crc = crc32Combine(crc, run, n);
+		if (len > 1) run = crc32Combine(run, run, n);
+	}
+	return(crc);
+}
+
+/*
+Slicing by 8 over a length the compiler knows: the loops unroll into a
+straight run of lookups with no length tests and no path switch.  Short
+fixed lengths are where the switch and the loop control cost the most
+next to the work, and below 64 bytes the folding path would hand them to
+the tables anyway.
+*/
+static inline __attribute__((always_inline)) uint32_t crcFixed(uint32_t reg, const unsigned char *p, const size_t len){
+	size_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#pragma GCC unroll 16
+	for (; i + 8 <= len; i += 8) {
+		uint32_t one = load32(p + i) ^ reg;
+		uint32_t two = load32(p + i + 4);
+
+		reg = crcTable[7][one & 0xff] ^
+				crcTable[6][(one >> 8) & 0xff] ^
+				crcTable[5][(one >> 16) & 0xff] ^
+				crcTable[4][one >> 24] ^
+				crcTable[3][two & 0xff] ^
+				crcTable[2][(two >> 8) & 0xff] ^
+				crcTable[1][(two >> 16) & 0xff] ^
+				crcTable[0][two >> 24];
+	}
+#endif
+#pragma GCC unroll 8
+	for (; i < len; i++) reg = (reg >> 8) ^ crcTable[0][(reg ^ p[i]) & 0xff];
+	return(reg);
+}
+
+#define CRC32_FIXED(len) \
+	uint32_t crc32Update##len(uint32_t crc, const void *buf){ \
+		return(crcFixed(crc ^ CRC32_XOROUT, (const unsigned char *)buf, len) ^ CRC32_XOROUT); \
+	}
+
+CRC32_FIXED(16)		// wframe header
+CRC32_FIXED(60)		// v4 frame data, V4_FRAME_SIZE less the crc
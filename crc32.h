@@ -0,0 +1,74 @@
+/*
+CRC32 engine for the host side of the serial file transfer.
+
+All paths compute the same crc the Arduino side checks (IEEE polynomial
+0x04C11DB7, reflected in and out, register preset 0, final xor 0xffffffff),
+so any of them can be swapped in for the original bit by bit code.
+
+	crc32Init() must be called once before use, it builds the tables and
+	picks the fastest path the cpu supports.
+
+Streaming use, a whole file digest built frame by frame:
+
+	uint32_t crc = CRC32_START;
+	crc = crc32Update(crc, frame1, len1);
+	crc = crc32Update(crc, frame2, len2);
+
+crc32Update(CRC32_START, p, len) is the same value as crc32Compute(p, len).
+
+Crcs of pieces computed apart, on different threads say, are joined with
+
+	crc32Combine(crc32Compute(a, lenA), crc32Compute(b, lenB), lenB)
+
+which is crc32Compute of a followed by b, in time logarithmic in lenB.
+crc32Zeros(len) is crc32Compute of len zero bytes without the bytes.
+
+The model below is fixed when compiling, nothing about it is looked up or
+tested while a frame is crced.  The lengths every frame of a kind has get
+their own function, crc32Update16 for a wframe header and crc32Update60 for
+the data of a v4 frame, with the loop unrolled and no path to pick; the
+list is at the end of crc32.c.
+*/
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the IEEE crc as the link has always had it, see crc32.c
+#define CRC32_ORDER 32
+#define CRC32_POLY 0x04c11db7
+#define CRC32_REFIN 1
+#define CRC32_REFOUT 1
+#define CRC32_XOROUT 0xffffffff
+
+#define CRC32_START 0xffffffff
+
+typedef enum crcPath {
+	CRC_PATH_BITWISE = 0,	// original bit by bit loop, reference only
+	CRC_PATH_SLICE8,	// slicing by 8 table lookup
+	CRC_PATH_SLICE16,	// slicing by 16 table lookup
+	CRC_PATH_PCLMUL,	// carry-less multiply folding, x86 only
+	CRC_PATH_COUNT
+} crcPath;
+
+void crc32Init(void);
+
+uint32_t crc32Update(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32Compute(const void *buf, size_t len);
+uint32_t crc32Combine(uint32_t crcA, uint32_t crcB, int64_t lenB);
+uint32_t crc32Zeros(int64_t len);
+
+// fixed length crc32Update, crc32UpdateN(crc, p) == crc32Update(crc, p, N)
+uint32_t crc32Update16(uint32_t crc, const void *buf);
+uint32_t crc32Update60(uint32_t crc, const void *buf);
+
+// explicit path selection, used by the benchmark
+uint32_t crc32UpdatePath(crcPath path, uint32_t crc, const void *buf, size_t len);
+int crc32PathAvailable(crcPath path);
+const char *crc32PathName(crcPath path);
+crcPath crc32ActivePath(void);
+int crc32SetPath(crcPath path);
+
+#endif
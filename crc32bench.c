@@ -0,0 +1,153 @@
+/*
+Microbenchmark for the crc32 engine.
+
+Runs every available crc path over frame sized and whole file sized buffers
+and reports bytes per cycle, and checks that all paths agree with the
+original bit by bit code.
+
+	gcc -O2 -o crc32bench crc32bench.c crc32.c
+	./crc32bench [file]
+
+With a file argument (e.g. pony.jpg) the file contents are used as the
+input, otherwise the buffer is filled with pseudo random bytes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycleCount() __rdtsc()
+#else
+static unsigned long long cycleCount(void){
+	// no cycle counter, fall back to nanoseconds
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+#endif
+
+#define BENCH_BYTES (64 * 1024 * 1024)
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = {60, 1020, 4092, 65536, 1024 * 1024};
+	const int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+	size_t bufLen = sizes[numSizes - 1];
+	unsigned char *buf;
+	int errors = 0;
+
+	crc32Init();
+
+	buf = (unsigned char *)malloc(bufLen);
+	if (buf == NULL) {
+		printf("crc32bench : out of memory\n");
+		return -1;
+	}
+
+	if (argc > 1) {
+		FILE *ptr_myfile = fopen(argv[1], "rb");
+		size_t got = 0;
+
+		if (ptr_myfile == NULL) {
+			printf("crc32bench : can not open %s\n", argv[1]);
+			return -1;
+		}
+		while (got < bufLen) {
+			size_t n = fread(buf + got, 1, bufLen - got, ptr_myfile);
+			if (n == 0) {
+				if (got == 0) break;
+				rewind(ptr_myfile);
+			}
+			got += n;
+		}
+		fclose(ptr_myfile);
+		if (got == 0) {
+			printf("crc32bench : %s is empty\n", argv[1]);
+			return -1;
+		}
+	} else {
+		srand(1);
+		for (size_t i = 0; i < bufLen; i++) buf[i] = (unsigned char)rand();
+	}
+
+	printf("crc32bench : active path %s\n", crc32PathName(crc32ActivePath()));
+	printf("%-10s", "size");
+	for (int p = 0; p < CRC_PATH_COUNT; p++) printf(" %12s", crc32PathName((crcPath)p));
+	printf("   (bytes per cycle)\n");
+
+	for (int s = 0; s < numSizes; s++) {
+		size_t len = sizes[s];
+		uint32_t reference = crc32UpdatePath(CRC_PATH_BITWISE, CRC32_START, buf, len);
+
+		printf("%-10zu", len);
+
+		for (int p = 0; p < CRC_PATH_COUNT; p++) {
+			crcPath path = (crcPath)p;
+			size_t total = BENCH_BYTES;
+			unsigned long long start, stop;
+			uint32_t crc = 0;
+			size_t done;
+
+			if (!crc32PathAvailable(path)) {
+				printf(" %12s", "n/a");
+				continue;
+			}
+
+			if (crc32UpdatePath(path, CRC32_START, buf, len) != reference) {
+				printf(" %12s", "MISMATCH");
+				errors++;
+				continue;
+			}
+
+			// the reference loop is ~100x slower, keep its run short
+			if (path == CRC_PATH_BITWISE) total /= 64;
+
+			start = cycleCount();
+			for (done = 0; done < total; done += len) {
+				crc ^= crc32UpdatePath(path, CRC32_START, buf, len);
+			}
+			stop = cycleCount();
+
+			// keep the result live so the loop is not optimised away
+			if (crc == 0x5a5a5a5a) printf(" ");
+
+			printf(" %12.3f", (double)done / (double)(stop - start));
+		}
+		printf("\n");
+	}
+
+	// the fixed length instances, against the same reference
+	for (int f = 0; f < 2; f++) {
+		size_t len = f ? 60 : 16;
+		uint32_t (*fixed)(uint32_t, const void *) = f ? crc32Update60 : crc32Update16;
+		unsigned long long start, stop;
+		uint32_t crc = 0;
+		size_t done;
+
+		printf("%-10zu fixed ", len);
+		if (fixed(CRC32_START, buf) != crc32UpdatePath(CRC_PATH_BITWISE, CRC32_START, buf, len)) {
+			printf("%12s\n", "MISMATCH");
+			errors++;
+			continue;
+		}
+		start = cycleCount();
+		for (done = 0; done < BENCH_BYTES; done += len) crc ^= fixed(CRC32_START, buf);
+		stop = cycleCount();
+		if (crc == 0x5a5a5a5a) printf(" ");
+		printf("%12.3f", (double)done / (double)(stop - start));
+
+		start = cycleCount();
+		for (done = 0; done < BENCH_BYTES; done += len) crc ^= crc32Update(CRC32_START, buf, len);
+		stop = cycleCount();
+		if (crc == 0x5a5a5a5a) printf(" ");
+		printf("   %s %.3f\n", crc32PathName(crc32ActivePath()), (double)done / (double)(stop - start));
+	}
+
+	free(buf);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,392 @@
+/*
+Multi-device daemon, see daemon.h
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "devsim.h"
+#include "host.h"
+#include "pacing.h"
+#include "script.h"
+
+typedef struct daemonJob {
+	char line[BATCH_LINE_MAX];
+	int client;		// answered and closed once the job has run
+	struct daemonJob *next;
+} daemonJob;
+
+typedef struct daemonDevice {
+	char name[64];
+	linkSettings ls;	// its ports, links and rate
+	char card[BATCH_LINE_MAX];	// -sim: its card directory
+	int fd[LINKS_MAX];
+	pid_t simPid;
+	pthread_t thread;
+	pthread_mutex_t lock;	// guards the queue and counters below
+	pthread_cond_t wake;
+	daemonJob *head, *tail;
+	int queued, busy, done, failed;
+	int stop;
+} daemonDevice;
+
+// a control connection until its line is in
+typedef struct daemonClient {
+	int fd;
+	int have;
+	char buf[BATCH_LINE_MAX];
+} daemonClient;
+
+static void answer(int fd, const char *text){
+	// a client that went away must not take the daemon with it
+	if (send(fd, text, strlen(text), MSG_NOSIGNAL) < 0) {
+		printf("<local><daemon> : answer lost: %s\n", strerror(errno));
+	}
+}
+
+static void *deviceThread(void *arg){
+	daemonDevice *d = (daemonDevice *)arg;
+	unsigned char bye[] = "QUIT\n";
+	serialPort *port = (serialPort *)malloc(sizeof(serialPort));
+	hostSession *hs = (hostSession *)malloc(sizeof(hostSession));
+
+	// the device's own session, see host.h
+	serialInit(port, d->fd[0]);
+	sessionInit(hs, port, d->ls.baud);
+	hs->hostLinks = d->ls.links;
+	for (int i = 1; i < hs->hostLinks; i++) {
+		hs->hostLink[i] = (serialPort *)malloc(sizeof(serialPort));
+		serialInit(hs->hostLink[i], d->fd[i]);
+	}
+
+	while (1) {
+		unsigned char line[BATCH_LINE_MAX + 2];
+		char reply[BATCH_LINE_MAX + 128];
+		daemonJob *job;
+		int64_t t0;
+
+		pthread_mutex_lock(&d->lock);
+		while (d->head == NULL && !d->stop) pthread_cond_wait(&d->wake, &d->lock);
+		job = d->head;
+		if (job != NULL) {
+			d->head = job->next;
+			if (d->head == NULL) d->tail = NULL;
+			d->queued--;
+			d->busy = 1;
+		}
+		pthread_mutex_unlock(&d->lock);
+		if (job == NULL) break;
+
+		printf("<local><%s> : %s\n", d->name, job->line);
+		snprintf((char *)line, sizeof(line), "%s\n", job->line);
+		hs->transferFailed = 0;
+		t0 = pacerClockUs();
+		runCommand(hs, line);
+
+		pthread_mutex_lock(&d->lock);
+		d->busy = 0;
+		if (hs->transferFailed) d->failed++;
+		else d->done++;
+		pthread_mutex_unlock(&d->lock);
+
+		snprintf(reply, sizeof(reply), "%s %s %.2f %s\n", d->name, hs->transferFailed ? "FAILED" : "done",
+				(pacerClockUs() - t0) / 1e6, job->line);
+		answer(job->client, reply);
+		close(job->client);
+		free(job);
+	}
+	runCommand(hs, bye);
+	for (int i = 1; i < hs->hostLinks; i++) free(hs->hostLink[i]);
+	cardListInvalidate(&hs->cardDir);
+	free(hs);
+	free(port);
+	return(NULL);
+}
+
+static int deviceOpen(daemonDevice *d, const linkSettings *ls, const char *spec){
+	d->ls = *ls;
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->wake, NULL);
+
+	if (ls->sim) {
+		devsimOptions sim;
+
+		snprintf(d->name, sizeof(d->name), "%s", spec);
+		snprintf(d->card, sizeof(d->card), "%s/%s", ls->cardDir, spec);
+		devsimDefaults(&sim);
+		sim.cardDir = d->card;
+		sim.baud = ls->baud;
+		sim.latencyMs = ls->latencyMs;
+		sim.v4 = ls->v4;
+		sim.bitErrors = ls->bitErrors;
+		sim.dropRate = ls->dropRate;
+		sim.dupRate = ls->dupRate;
+		sim.links = ls->links;
+		d->simPid = devsimStart(&sim, d->fd);
+		return(d->simPid < 0 ? -1 : 0);
+	}
+
+	if (settingsPorts(&d->ls, spec) < 0) return(-1);
+	snprintf(d->name, sizeof(d->name), "%s", strrchr(d->ls.ports[0], '/') != NULL ?
+			strrchr(d->ls.ports[0], '/') + 1 : d->ls.ports[0]);
+	for (int i = 0; i < d->ls.links; i++) printf("Opening port %s baud %d \n", d->ls.ports[i], d->ls.portBaud[i]);
+	return(openLinks(&d->ls, d->fd));
+}
+
+static int listenOn(const char *path){
+	struct sockaddr_un addr;
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (s < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+		printf("<local><daemon> : can not use %s\n", path);
+		if (s >= 0) close(s);
+		return(-1);
+	}
+	strcpy(addr.sun_path, path);
+	// a socket left by a daemon that did not stop cleanly
+	unlink(path);
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s, DAEMON_BACKLOG) < 0) {
+		printf("<local><daemon> : can not listen on %s: %s\n", path, strerror(errno));
+		close(s);
+		return(-1);
+	}
+	return(s);
+}
+
+/*
+One line from a client.  A job passes the connection on to the device's
+worker, anything else is answered and closed here.  returns 1 for STOP,
+whose connection is left open for the last word.
+*/
+static int controlLine(daemonDevice *devs, int count, int client, char *line){
+	char reply[SETTINGS_DEVICES_MAX * 96 + 64];
+	daemonDevice *d = NULL;
+	daemonJob *job;
+	char *cmd;
+	int len;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	while (*line == ' ') line++;
+
+	if (!strcasecmp(line, "STOP")) return(1);
+	if (!strcasecmp(line, "STATUS")) {
+		len = 0;
+		for (int i = 0; i < count; i++) {
+			pthread_mutex_lock(&devs[i].lock);
+			len += snprintf(reply + len, sizeof(reply) - len, "%s queued %d running %d done %d failed %d\n",
+					devs[i].name, devs[i].queued, devs[i].busy, devs[i].done, devs[i].failed);
+			pthread_mutex_unlock(&devs[i].lock);
+		}
+		answer(client, reply);
+		close(client);
+		return(0);
+	}
+
+	cmd = line + strcspn(line, " ");
+	if (*cmd != '\0') *cmd++ = '\0';
+	while (*cmd == ' ') cmd++;
+	for (int i = 0; i < count; i++) {
+		if (!strcmp(devs[i].name, line)) d = &devs[i];
+	}
+	if (d == NULL) {
+		snprintf(reply, sizeof(reply), "error no device %s\n", line);
+	} else if (*cmd == '\0') {
+		snprintf(reply, sizeof(reply), "error no command for %s\n", line);
+	} else if (!strncasecmp(cmd, "QUIT", 4)) {
+		snprintf(reply, sizeof(reply), "error QUIT is not a job, STOP ends the daemon\n");
+	} else {
+		job = (daemonJob *)malloc(sizeof(daemonJob));
+		snprintf(job->line, sizeof(job->line), "%s", cmd);
+		job->client = client;
+		job->next = NULL;
+
+		pthread_mutex_lock(&d->lock);
+		if (d->tail != NULL) d->tail->next = job;
+		else d->head = job;
+		d->tail = job;
+		d->queued++;
+		pthread_cond_signal(&d->wake);
+		pthread_mutex_unlock(&d->lock);
+		return(0);
+	}
+	answer(client, reply);
+	close(client);
+	return(0);
+}
+
+int daemonRun(const linkSettings *ls){
+	daemonDevice *devs;
+	struct epoll_event ev;
+	int count = ls->deviceCount;
+	int listener, ep, stopper = -1, started = 0, rc = SCRIPT_EXIT_OK;
+
+	if (count == 0) {
+		printf("error -daemon needs at least one -device\n");
+		return(SCRIPT_EXIT_USAGE);
+	}
+	devs = (daemonDevice *)calloc(count, sizeof(daemonDevice));
+	if (ls->sim) mkdir(ls->cardDir, 0755);
+
+	// devices, and any simulators, before the first thread; devsim forks
+	for (int i = 0; i < count; i++) {
+		if (deviceOpen(&devs[i], ls, ls->devices[i]) < 0) {
+			printf("<local><daemon> : can not open device %s\n", ls->devices[i]);
+			rc = SCRIPT_EXIT_USAGE;
+			count = i;
+			break;
+		}
+		for (int j = 0; j < i; j++) {
+			if (!strcmp(devs[j].name, devs[i].name)) {
+				printf("<local><daemon> : two devices named %s\n", devs[i].name);
+				rc = SCRIPT_EXIT_USAGE;
+			}
+		}
+	}
+	listener = rc == SCRIPT_EXIT_OK ? listenOn(ls->daemonSocket) : -1;
+	ep = epoll_create1(0);
+	if (listener < 0 || ep < 0) {
+		rc = SCRIPT_EXIT_USAGE;
+	} else {
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+
+		for (started = 0; started < count; started++) {
+			if (pthread_create(&devs[started].thread, NULL, deviceThread, &devs[started]) != 0) break;
+		}
+		printf("<local><daemon> : %d device%s on %s\n", started, started == 1 ? "" : "s", ls->daemonSocket);
+	}
+	fflush(stdout);
+
+	while (rc == SCRIPT_EXIT_OK && stopper < 0) {
+		struct epoll_event ready[16];
+		int n = epoll_wait(ep, ready, 16, -1);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) break;
+		for (int i = 0; i < n && stopper < 0; i++) {
+			daemonClient *c = (daemonClient *)ready[i].data.ptr;
+			char *end;
+			int got;
+
+			if (c == NULL) {
+				int fd = accept(listener, NULL, NULL);
+
+				if (fd < 0) continue;
+				c = (daemonClient *)calloc(1, sizeof(daemonClient));
+				c->fd = fd;
+				ev.events = EPOLLIN;
+				ev.data.ptr = c;
+				epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+				continue;
+			}
+
+			got = read(c->fd, c->buf + c->have, sizeof(c->buf) - 1 - c->have);
+			if (got > 0) c->have += got;
+			c->buf[c->have] = '\0';
+			end = strchr(c->buf, '\n');
+			if (got > 0 && end == NULL && c->have < (int)sizeof(c->buf) - 1) continue;
+
+			// a whole line, or all the client will send
+			epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+			if (end == NULL && got > 0) {
+				answer(c->fd, "error line too long\n");
+				close(c->fd);
+			} else if (c->have == 0) {
+				close(c->fd);
+			} else if (controlLine(devs, started, c->fd, c->buf)) {
+				stopper = c->fd;
+			}
+			free(c);
+		}
+		fflush(stdout);
+	}
+
+	// every worker finishes its queue and says QUIT
+	for (int i = 0; i < started; i++) {
+		pthread_mutex_lock(&devs[i].lock);
+		devs[i].stop = 1;
+		pthread_cond_signal(&devs[i].wake);
+		pthread_mutex_unlock(&devs[i].lock);
+	}
+	for (int i = 0; i < started; i++) pthread_join(devs[i].thread, NULL);
+	for (int i = 0; i < count; i++) {
+		if (devs[i].simPid > 0) {
+			devsimStop(devs[i].simPid, devs[i].fd, devs[i].ls.links);
+		} else {
+			for (int j = 0; j < devs[i].ls.links; j++) close(devs[i].fd[j]);
+		}
+	}
+	if (listener >= 0) {
+		close(listener);
+		unlink(ls->daemonSocket);
+	}
+	if (ep >= 0) close(ep);
+	if (stopper >= 0) {
+		answer(stopper, "stopped\n");
+		close(stopper);
+	}
+	printf("<local><daemon> : stopped\n");
+	free(devs);
+	return(rc);
+}
+
+int daemonSubmit(const linkSettings *ls){
+	int fd[SETTINGS_COMMANDS_MAX];
+	int rc = SCRIPT_EXIT_OK;
+	struct sockaddr_un addr;
+
+	if (ls->commandCount == 0) {
+		printf("error -job needs -c \"device command\"\n");
+		return(SCRIPT_EXIT_USAGE);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", ls->jobSocket);
+
+	// every job goes in before any answer is awaited, so devices work at once
+	for (int i = 0; i < ls->commandCount; i++) {
+		char line[BATCH_LINE_MAX + 2];
+
+		fd[i] = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd[i] < 0 || connect(fd[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			printf("<local><job> : no daemon on %s: %s\n", ls->jobSocket, strerror(errno));
+			while (i >= 0) close(fd[i--]);
+			return(SCRIPT_EXIT_USAGE);
+		}
+		snprintf(line, sizeof(line), "%s\n", ls->commands[i]);
+		if (send(fd[i], line, strlen(line), MSG_NOSIGNAL) < 0) rc = SCRIPT_EXIT_FAILED;
+	}
+
+	for (int i = 0; i < ls->commandCount; i++) {
+		char reply[SETTINGS_DEVICES_MAX * 96 + 64];
+		int have = 0, got;
+
+		while (have < (int)sizeof(reply) - 1 && (got = read(fd[i], reply + have, sizeof(reply) - 1 - have)) > 0) {
+			have += got;
+		}
+		reply[have] = '\0';
+		close(fd[i]);
+
+		if (have == 0) {
+			printf("<local><job> : no answer to %s\n", ls->commands[i]);
+			rc = SCRIPT_EXIT_FAILED;
+			continue;
+		}
+		fputs(reply, stdout);
+		if (!strncmp(reply, "error", 5) || strstr(reply, " FAILED ") != NULL) rc = SCRIPT_EXIT_FAILED;
+	}
+	return(rc);
+}
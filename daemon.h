@@ -0,0 +1,43 @@
+/*
+One host process serving many devices.
+
+	HostSeriaPport_v4_crc32 -daemon /tmp/hsp.sock -device /dev/ttyUSB0:921600 -device /dev/ttyUSB1,/dev/ttyUSB2 460800
+	HostSeriaPport_v4_crc32 -job /tmp/hsp.sock -c "ttyUSB0 HTOA fw.bin fw.bin" -c "ttyUSB1 VERIFY fw.bin"
+
+Every -device is a session: a worker thread that owns the device's links
+and its session (host.h): its own caps, card listing and transfer
+counters.  A device is named after its first port
+without the directory; with -sim each -device is a name and gets a
+simulated device with its card in <card dir>/<name>.
+
+Jobs come in on a unix socket, one line per connection:
+
+	<device> <console command>	run on that device; the answer,
+					"<device> done|FAILED <seconds> <command>",
+					comes when the job has run
+	STATUS				a line per device with its jobs queued,
+					running, done and failed
+	STOP				finish the queued jobs, say QUIT to every
+					device and exit
+
+Jobs for one device run one after the other in the order they came, jobs
+for different devices at the same time.  The main thread only serves the
+socket, from an epoll loop that never waits on a link.  File names in jobs
+are relative to the daemon's working directory.
+
+-job sends each -c line on a connection of its own, all before waiting, so
+jobs for different devices given together run together; it prints the
+answers in order and exits as a script does (script.h).
+*/
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "settings.h"
+
+#define DAEMON_BACKLOG 16
+
+int daemonRun(const linkSettings *ls);
+int daemonSubmit(const linkSettings *ls);
+
+#endif
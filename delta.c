@@ -0,0 +1,281 @@
+/*
+Block signatures, delta building and rebuilding, see delta.h
+
+The weak checksum is rsync's: a is the sum of the block's bytes and b the
+sum of the running a's, each kept to 16 bits, so sliding the block on by
+one byte only takes the byte leaving and the byte entering.  Blocks whose
+weak checksum collides are told apart by their crc32.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "delta.h"
+#include "fileio.h"
+#include "protocol.h"
+
+#define DELTA_TAGS 65536
+
+typedef struct sigIndex {
+	uint16_t tag;
+	int32_t block;
+} sigIndex;
+
+static uint32_t weakStart(const unsigned char *p, int len, uint32_t *a, uint32_t *b){
+	*a = 0;
+	*b = 0;
+	for (int i = 0; i < len; i++) {
+		*a += p[i];
+		*b += (uint32_t)(len - i) * p[i];
+	}
+	return((*a & 0xffff) | (*b << 16));
+}
+
+static uint16_t weakTag(uint32_t weak){
+	return((uint16_t)(weak ^ (weak >> 16)));
+}
+
+static int tagOrder(const void *x, const void *y){
+	const sigIndex *a = (const sigIndex *)x;
+	const sigIndex *b = (const sigIndex *)y;
+
+	if (a->tag != b->tag) return(a->tag < b->tag ? -1 : 1);
+	return(a->block < b->block ? -1 : a->block > b->block);
+}
+
+static int copyBytes(FILE *from, FILE *to, int64_t len){
+	unsigned char buf[16384];
+
+	while (len > 0) {
+		size_t n = len < (int64_t)sizeof(buf) ? (size_t)len : sizeof(buf);
+
+		if (fread(buf, 1, n, from) != n || fwrite(buf, 1, n, to) != n) return(-1);
+		len -= n;
+	}
+	return(0);
+}
+
+// roughly the square root of the file, so signature and lost matches stay small
+int deltaBlockSize(int64_t size){
+	int blockSize = DELTA_MIN_BLOCK;
+
+	while (blockSize < DELTA_MAX_BLOCK && (int64_t)blockSize * blockSize < size) blockSize *= 2;
+	return(blockSize);
+}
+
+/*
+The signature of 'size' bytes of old, in a scratch stream of *streamSize
+bytes rewound for sending.  A trailing part block gets no signature.
+*/
+FILE *deltaSignature(FILE *old, int64_t size, int64_t *streamSize){
+	FILE *out = tmpfile();
+	sigHead sh;
+	unsigned char *block;
+
+	if (out == NULL) return(NULL);
+	sh.blockSize = deltaBlockSize(size);
+	sh.blocks = (int32_t)(size / sh.blockSize);
+	sh.fileSize = (int32_t)size;
+	block = (unsigned char *)malloc(sh.blockSize);
+
+	fwrite(&sh, sizeof(sh), 1, out);
+
+	rewind(old);
+	for (int32_t i = 0; i < sh.blocks; i++) {
+		blockSig bs;
+		uint32_t a, b;
+
+		if (fread(block, 1, sh.blockSize, old) != (size_t)sh.blockSize) {
+			// the file shrank under us, describe what was read
+			sh.blocks = i;
+			fseek(out, 0, SEEK_SET);
+			fwrite(&sh, sizeof(sh), 1, out);
+			break;
+		}
+		bs.weak = weakStart(block, sh.blockSize, &a, &b);
+		bs.strong = crc32Compute(block, sh.blockSize);
+		fwrite(&bs, sizeof(bs), 1, out);
+	}
+	free(block);
+
+	fflush(out);
+	*streamSize = (int64_t)sizeof(sh) + (int64_t)sh.blocks * sizeof(blockSig);
+	rewind(out);
+	rewind(old);
+	return(out);
+}
+
+static void writeLiteral(FILE *out, const unsigned char *p, int64_t len){
+	deltaOp op = {DELTA_LITERAL, (int32_t)len};
+
+	if (len <= 0) return;
+	fwrite(&op, sizeof(op), 1, out);
+	fwrite(p, 1, len, out);
+}
+
+static void writeRun(FILE *out, int32_t block, int32_t *len){
+	deltaOp op = {block, *len};
+
+	if (*len <= 0) return;
+	fwrite(&op, sizeof(op), 1, out);
+	*len = 0;
+}
+
+/*
+Describes 'size' bytes of src against the signature the device sent.
+returns the delta in a scratch stream of *streamSize bytes rewound for
+sending, with *matched the bytes found on the card, or NULL if the
+signature is damaged.
+*/
+FILE *deltaBuild(FILE *sigs, int64_t sigSize, FILE *src, int64_t size, int64_t *streamSize, int64_t *matched){
+	blockSig *sig = NULL;
+	sigIndex *index = NULL;
+	int32_t *tagFirst = NULL;
+	unsigned char *copy = NULL;
+	const unsigned char *data;
+	FILE *out = NULL;
+	fileMap map;
+	sigHead sh;
+	int64_t p = 0, lit = 0;
+	int32_t runBlock = 0, runLen = 0;
+	uint32_t a = 0, b = 0;
+	int B;
+
+	*matched = 0;
+	rewind(sigs);
+	if (fread(&sh, sizeof(sh), 1, sigs) != 1 ||
+			sh.blockSize < DELTA_MIN_BLOCK || sh.blockSize > DELTA_MAX_BLOCK || sh.blocks < 0 ||
+			sigSize != (int64_t)sizeof(sh) + (int64_t)sh.blocks * (int64_t)sizeof(blockSig)) {
+		printf("<delta> : bad signature from the device\n");
+		return(NULL);
+	}
+	B = sh.blockSize;
+
+	sig = (blockSig *)malloc(sizeof(blockSig) * (sh.blocks + 1));
+	index = (sigIndex *)malloc(sizeof(sigIndex) * (sh.blocks + 1));
+	tagFirst = (int32_t *)malloc(sizeof(int32_t) * DELTA_TAGS);
+	if (fread(sig, sizeof(blockSig), sh.blocks, sigs) != (size_t)sh.blocks) {
+		printf("<delta> : short signature from the device\n");
+		goto done;
+	}
+
+	// blocks sorted by tag, tagFirst[t] the first with tag t or -1
+	for (int32_t i = 0; i < sh.blocks; i++) {
+		index[i].tag = weakTag(sig[i].weak);
+		index[i].block = i;
+	}
+	qsort(index, sh.blocks, sizeof(sigIndex), tagOrder);
+	for (int i = 0; i < DELTA_TAGS; i++) tagFirst[i] = -1;
+	for (int32_t i = sh.blocks - 1; i >= 0; i--) tagFirst[index[i].tag] = i;
+
+	data = fileMapOpen(&map, src, size);
+	if (data == NULL) {
+		copy = (unsigned char *)malloc(size > 0 ? size : 1);
+		rewind(src);
+		if (size > 0 && fread(copy, 1, size, src) != (size_t)size) goto done;
+		data = copy;
+	}
+
+	out = tmpfile();
+	if (out == NULL) goto unmap;
+
+	if (sh.blocks > 0 && size >= B) weakStart(data, B, &a, &b);
+	while (sh.blocks > 0 && p + B <= size) {
+		uint32_t weak = (a & 0xffff) | (b << 16);
+		int32_t first = tagFirst[weakTag(weak)];
+		int32_t hit = -1;
+
+		if (first >= 0) {
+			// the block after the current run first, so repeated blocks still join up
+			int32_t want = runLen > 0 ? runBlock + runLen / B : -1;
+			uint32_t strong = 0;
+			int have = 0;
+
+			if (want >= 0 && want < sh.blocks && sig[want].weak == weak) {
+				strong = crc32Compute(data + p, B);
+				have = 1;
+				if (strong == sig[want].strong) hit = want;
+			}
+			for (int32_t i = first; hit < 0 && i < sh.blocks && index[i].tag == weakTag(weak); i++) {
+				const blockSig *s = &sig[index[i].block];
+
+				if (s->weak != weak) continue;
+				if (!have) {
+					strong = crc32Compute(data + p, B);
+					have = 1;
+				}
+				if (strong == s->strong) hit = index[i].block;
+			}
+		}
+
+		if (hit >= 0) {
+			if (p > lit) {
+				writeRun(out, runBlock, &runLen);
+				writeLiteral(out, data + lit, p - lit);
+			}
+			if (runLen > 0 && hit == runBlock + runLen / B) {
+				runLen += B;
+			} else {
+				writeRun(out, runBlock, &runLen);
+				runBlock = hit;
+				runLen = B;
+			}
+			p += B;
+			lit = p;
+			*matched += B;
+			if (p + B <= size) weakStart(data + p, B, &a, &b);
+		} else {
+			if (p + B < size) {
+				a += data[p + B] - data[p];
+				b += a - (uint32_t)B * data[p];
+			}
+			p++;
+		}
+	}
+	writeRun(out, runBlock, &runLen);
+	writeLiteral(out, data + lit, size - lit);
+
+	fflush(out);
+	*streamSize = ftell(out);
+	rewind(out);
+
+unmap:
+	if (copy == NULL) fileMapClose(&map);
+done:
+	rewind(src);
+	free(copy);
+	free(tagFirst);
+	free(index);
+	free(sig);
+	return(out);
+}
+
+/*
+Writes the file described by the delta to dst, copying blocks of 'old'.
+returns the bytes written, -1 if the delta is damaged or reaches past the
+old copy.
+*/
+int64_t deltaApply(FILE *ops, int64_t opsSize, FILE *old, int blockSize, FILE *dst){
+	int64_t used = 0, written = 0;
+
+	rewind(ops);
+	while (used < opsSize) {
+		deltaOp op;
+
+		if (opsSize - used < (int64_t)sizeof(op) || fread(&op, sizeof(op), 1, ops) != 1 || op.len < 0) return(-1);
+		used += sizeof(op);
+
+		if (op.block == DELTA_LITERAL) {
+			if (op.len > opsSize - used || copyBytes(ops, dst, op.len) < 0) return(-1);
+			used += op.len;
+		} else {
+			if (old == NULL || op.block < 0 ||
+					fseek(old, (long)((int64_t)op.block * blockSize), SEEK_SET) != 0 ||
+					copyBytes(old, dst, op.len) < 0) return(-1);
+		}
+		written += op.len;
+	}
+	fflush(dst);
+	return(written);
+}
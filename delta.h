@@ -0,0 +1,31 @@
+/*
+Delta uploads: only what differs from the card's copy crosses the link.
+
+The device cuts its old copy into fixed blocks and sends a rolling and a
+crc32 checksum of each (sigHead / blockSig in protocol.h).  The host rolls
+the weak checksum over the new file a byte at a time, confirms hits with
+the crc, and describes the new file as runs of old blocks and literal
+bytes (deltaOp).  The device rebuilds the file from its old copy and the
+delta.
+
+	device:	sigs = deltaSignature(old, oldSize, &sigSize);	// then windowSend
+	host:	ops = deltaBuild(sigs, sigSize, src, size, &opsSize, &matched);
+	device:	deltaApply(ops, opsSize, old, blockSize, dst);
+*/
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define DELTA_MIN_BLOCK 256
+#define DELTA_MAX_BLOCK 16384
+
+int deltaBlockSize(int64_t size);
+
+FILE *deltaSignature(FILE *old, int64_t size, int64_t *streamSize);
+FILE *deltaBuild(FILE *sigs, int64_t sigSize, FILE *src, int64_t size, int64_t *streamSize, int64_t *matched);
+int64_t deltaApply(FILE *ops, int64_t opsSize, FILE *old, int blockSize, FILE *dst);
+
+#endif
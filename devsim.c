@@ -0,0 +1,989 @@
+/*
+Device simulator, see devsim.h
+
+The child process runs three things: two line threads, one per direction,
+that move bytes between the host's pty and the device's pty no faster than
+the simulated baud rate and 'latencyMs' late, and the device itself, a
+command loop on the far pty that mirrors the Arduino sketch.
+*/
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "crc32.h"
+#include "delta.h"
+#include "fec.h"
+#include "devsim.h"
+#include "pack.h"
+#include "protocol.h"
+#include "resume.h"
+#include "serialio.h"
+#include "stripe.h"
+#include "window.h"
+
+#define SIM_TIMEOUT_MS 5000
+#define SIM_V4_SEND_RETRIES 2		// the host's RETRYCOUNT when it receives
+#define SIM_V4_RECV_RETRIES 10		// the host gives up a frame after 10 NOKs
+#define LINE_CHUNK 64
+
+typedef struct lineChunk {
+	int64_t at;			// when the last byte reaches the far end
+	int len;
+	unsigned char data[LINE_CHUNK * 2];	// room for duplicated bytes
+} lineChunk;
+
+typedef struct lineDir {
+	int in;
+	int out;
+	int slots;
+	lineChunk *q;
+	const devsimOptions *opt;	// fault rates
+	uint64_t rng;
+	int64_t flipIn;			// bits until the next flipped one
+	int64_t dropIn;			// bytes until the next dropped one
+	int64_t dupIn;			// and the next doubled one
+} lineDir;
+
+typedef struct simDevice {
+	serialPort port;
+	serialPort *link[LINKS_MAX];	// link[0] is port, the command link
+	const devsimOptions *opt;
+	int frameSize;			// agreed by CAPS
+	int window;
+	uint32_t features;
+	int stripes;			// links both sides have
+	int oldBaud;			// rate to go back to if BAUD OK never comes
+	int64_t revertAt;
+} simDevice;
+
+static volatile int lineBaud;
+static int lineLatencyUs;
+static volatile int lineFaulty;		// a window transfer is running, see faultInject()
+
+static int64_t simClockUs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static int writeAll(int fd, const unsigned char *p, int len){
+	while (len > 0) {
+		int n = write(fd, p, len);
+
+		if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+			struct pollfd pfd = {fd, POLLOUT, 0};
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		if (n <= 0) return(-1);
+		p += n;
+		len -= n;
+	}
+	return(0);
+}
+
+// bits or bytes until the next fault at 'rate' per bit or byte, at least 1
+static int64_t faultGap(uint64_t *rng, double rate){
+	double u;
+
+	if (rate <= 0.0) return(INT64_MAX);
+	*rng ^= *rng << 13;
+	*rng ^= *rng >> 7;
+	*rng ^= *rng << 17;
+	u = ((*rng >> 11) + 1) / 9007199254740992.0;
+	return((int64_t)(log(u) / log1p(-rate)) + 1);
+}
+
+/*
+Bit errors, lost and doubled bytes on a chunk crossing the line, at the
+rates in the options.  Only window transfers are hit, the console and the
+handshakes around a transfer stay clean so a run measures the frames.  The
+faults fall at the same bytes of the stream every run.  returns the new
+length of the chunk.
+*/
+static int faultInject(lineDir *ld, unsigned char *data, int n){
+	unsigned char out[LINE_CHUNK * 2];
+	int64_t bits = (int64_t)n * 8, at = 0;
+	int o = 0;
+
+	while (ld->flipIn <= bits - at) {
+		at += ld->flipIn;
+		data[(at - 1) / 8] ^= 1 << ((at - 1) % 8);
+		ld->flipIn = faultGap(&ld->rng, ld->opt->bitErrors);
+	}
+	if (ld->flipIn != INT64_MAX) ld->flipIn -= bits - at;
+
+	for (int i = 0; i < n; i++) {
+		if (--ld->dropIn == 0) {
+			ld->dropIn = faultGap(&ld->rng, ld->opt->dropRate);
+			continue;
+		}
+		out[o++] = data[i];
+		if (--ld->dupIn == 0) {
+			ld->dupIn = faultGap(&ld->rng, ld->opt->dupRate);
+			out[o++] = data[i];
+		}
+	}
+	memcpy(data, out, o);
+	return(o);
+}
+
+/*
+One direction of the line.  Bytes are read as soon as they are written,
+stamped with the time they would finish crossing a uart at lineBaud plus
+the latency, and written out when that time comes.  The queue is only as
+deep as the bytes in flight, so a sender that outruns the line backs up in
+its own pty, just as it would in a real uart's output queue.
+*/
+static void *lineThread(void *arg){
+	lineDir *ld = (lineDir *)arg;
+	int head = 0, count = 0;
+	int64_t busyUntil = 0;
+
+	while (1) {
+		struct pollfd pfd = {ld->in, POLLIN, 0};
+		struct timespec ts, *tsp = NULL;
+		int64_t now = simClockUs();
+		int n;
+
+		while (count > 0 && ld->q[head].at <= now) {
+			if (writeAll(ld->out, ld->q[head].data, ld->q[head].len) < 0) return(NULL);
+			head = (head + 1) % ld->slots;
+			count--;
+		}
+
+		if (count > 0) {
+			int64_t wait = ld->q[head].at - now;
+			ts.tv_sec = wait / 1000000;
+			ts.tv_nsec = (wait % 1000000) * 1000;
+			tsp = &ts;
+		}
+		if (count == ld->slots) pfd.events = 0;
+
+		n = ppoll(&pfd, 1, tsp, NULL);
+		if (n < 0 && errno != EINTR) return(NULL);
+		if (n <= 0) continue;
+
+		if (pfd.revents & POLLIN) {
+			lineChunk *c = &ld->q[(head + count) % ld->slots];
+			int baud = lineBaud;
+			int64_t start;
+
+			n = read(ld->in, c->data, LINE_CHUNK);
+			if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+			if (n <= 0) return(NULL);
+
+			// the bytes left the sender now, not when the poll began
+			now = simClockUs();
+			start = now > busyUntil ? now : busyUntil;
+			busyUntil = start + (baud > 0 ? (int64_t)n * 10 * 1000000 / baud : 0);
+			c->at = busyUntil + lineLatencyUs;
+			c->len = lineFaulty ? faultInject(ld, c->data, n) : n;
+			if (c->len > 0) count++;
+		} else if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) {
+			return(NULL);
+		}
+	}
+}
+
+static void simPrint(simDevice *dev, const char *fmt, ...){
+	char text[512];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+	if (n > (int)sizeof(text) - 1) n = sizeof(text) - 1;
+	serialWrite(&dev->port, text, n);
+}
+
+static void simEnd(simDevice *dev){
+	unsigned char eot = EOT;
+	serialWrite(&dev->port, &eot, 1);
+}
+
+static void simPath(simDevice *dev, char *path, int size, const char *name){
+	snprintf(path, size, "%s/%s", dev->opt->cardDir, name);
+}
+
+static int simWindowBaud(void){
+	return(lineBaud > 0 ? lineBaud : 4000000);
+}
+
+static void simHelp(simDevice *dev){
+	simPrint(dev, "<arduino> : commands\r\n");
+	simPrint(dev, "<arduino> :   HELP                   this text\r\n");
+	simPrint(dev, "<arduino> :   DIR                    list the SD card\r\n");
+	simPrint(dev, "<arduino> :   LDIR                   list the SD card\r\n");
+	simPrint(dev, "<arduino> :   HTOA host [card] [w]   file from the host to the card\r\n");
+	simPrint(dev, "<arduino> :   ATOH card [host] [w]   file from the card to the host\r\n");
+	simPrint(dev, "<arduino> :   MHTOA / MATOH pattern  many files in one stream\r\n");
+	simPrint(dev, "<arduino> :   VERIFY pattern         crc32 of the matching card files\r\n");
+	simPrint(dev, "<arduino> :   LIST [CRC]             the card listing as records\r\n");
+	simPrint(dev, "<arduino> :   QUIT\r\n");
+	simEnd(dev);
+}
+
+static void simDir(simDevice *dev){
+	DIR *dr = opendir(dev->opt->cardDir);
+	struct dirent *de;
+
+	if (dr == NULL) {
+		simPrint(dev, "<arduino> : no SD card\r\n");
+		simEnd(dev);
+		return;
+	}
+	while ((de = readdir(dr)) != NULL) {
+		char path[512];
+		struct stat st;
+
+		if (de->d_name[0] == '.') continue;
+		simPath(dev, path, sizeof(path), de->d_name);
+		if (stat(path, &st) == 0) simPrint(dev, "%-24s %10ld\r\n", de->d_name, (long)st.st_size);
+	}
+	closedir(dr);
+	simEnd(dev);
+}
+
+// LIST, DIR as records for the host to keep
+static void simList(simDevice *dev, int nargs, char **args){
+	DIR *dr = opendir(dev->opt->cardDir);
+	int withCrc = nargs > 1 && !strcasecmp(args[1], "CRC");
+	unsigned char bot = BOT;
+	struct dirent *de;
+	cardEntry e;
+	int files = 0;
+
+	serialWrite(&dev->port, &bot, 1);
+	while (dr != NULL && (de = readdir(dr)) != NULL) {
+		char path[512];
+		struct stat st;
+
+		if (de->d_name[0] == '.') continue;
+		simPath(dev, path, sizeof(path), de->d_name);
+		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) continue;
+
+		memset(&e, 0, sizeof(e));
+		e.fileSize = (int32_t)st.st_size;
+		e.mtime = (int32_t)st.st_mtime;
+		// the entry was zeroed, a long name is cut and still ends in 0
+		memcpy(e.fileName, de->d_name, strnlen(de->d_name, sizeof(e.fileName) - 1));
+		if (withCrc) {
+			FILE *f = fopen(path, "rb");
+
+			if (f != NULL) {
+				e.fileCrc = resumeFileCrc(f, st.st_size);
+				fclose(f);
+			}
+		}
+		e.crcCheck = crc32Compute(&e, sizeof(e) - 4);
+		serialWrite(&dev->port, &e, sizeof(e));
+		files++;
+	}
+	if (dr != NULL) closedir(dr);
+	memset(&e, 0, sizeof(e));
+	e.fileSize = -1;
+	e.crcCheck = crc32Compute(&e, sizeof(e) - 4);
+	serialWrite(&dev->port, &e, sizeof(e));
+
+	simPrint(dev, "<arduino> : %d files listed\r\n", files);
+	simEnd(dev);
+}
+
+static void simCaps(simDevice *dev, int nargs, char **args){
+	caps mine;
+	int hostFrame = nargs > 1 ? atoi(args[1]) : V4_FRAME_SIZE;
+	int hostWindow = nargs > 2 ? atoi(args[2]) : 0;
+	uint32_t hostFeatures = nargs > 3 ? (uint32_t)strtoul(args[3], NULL, 10) : 0;
+	int hostLinks = nargs > 4 ? atoi(args[4]) : 1;
+	int32_t links = dev->opt->links;
+	unsigned char bot = BOT;
+
+	if (dev->opt->v4) {
+		simPrint(dev, "<arduino> : unknown command CAPS\r\n");
+		simEnd(dev);
+		return;
+	}
+
+	memset(&mine, 0, sizeof(mine));
+	mine.magic = CAPS_MAGIC;
+	mine.version = CAPS_VERSION;
+	mine.maxFrame = dev->opt->maxFrame;
+	mine.maxWindow = dev->opt->maxWindow;
+	mine.features = HDR_FLAG_WINDOW | HDR_FLAG_BAUD | HDR_FLAG_BATCH | HDR_FLAG_RESUME | HDR_FLAG_PACK | HDR_FLAG_DELTA |
+			HDR_FLAG_FEC | HDR_FLAG_VERIFY | HDR_FLAG_LIST | HDR_FLAG_COBS | HDR_FLAG_STREAM | HDR_FLAG_ADAPT | HDR_FLAG_SPARSE;
+	if (links > 1) mine.features |= HDR_FLAG_STRIPE;
+	mine.crcCheck = crc32Compute(&mine, sizeof(mine) - 4);
+
+	dev->frameSize = hostFrame < mine.maxFrame ? hostFrame : mine.maxFrame;
+	if (dev->frameSize < V4_FRAME_SIZE) dev->frameSize = V4_FRAME_SIZE;
+	dev->window = hostWindow < mine.maxWindow ? hostWindow : mine.maxWindow;
+	dev->features = hostFeatures & mine.features;
+	if (!(dev->features & HDR_FLAG_WINDOW)) dev->window = 0;
+	dev->stripes = 1;
+	if (dev->features & HDR_FLAG_STRIPE) dev->stripes = hostLinks < links ? hostLinks : links;
+
+	serialWrite(&dev->port, &bot, 1);
+	serialWrite(&dev->port, &mine, sizeof(mine));
+	if (dev->features & HDR_FLAG_STRIPE) serialWrite(&dev->port, &links, sizeof(links));
+	simPrint(dev, "<arduino> : frame %d window %d\r\n", dev->frameSize, dev->window);
+	simEnd(dev);
+}
+
+static void simBaud(simDevice *dev, int nargs, char **args){
+	if (dev->opt->v4 || nargs < 2) {
+		simPrint(dev, "<arduino> : unknown command BAUD\r\n");
+		simEnd(dev);
+		return;
+	}
+	if (!strcmp(args[1], "OK")) {
+		dev->revertAt = 0;
+		simPrint(dev, "<arduino> : baud %d kept\r\n", lineBaud);
+		simEnd(dev);
+		return;
+	}
+
+	simEnd(dev);
+	tcdrain(dev->port.fd);
+	usleep(10000);
+
+	// keep the first rate if several changes go unconfirmed
+	if (dev->revertAt == 0) dev->oldBaud = lineBaud;
+	if (dev->opt->baud > 0) lineBaud = atoi(args[1]);
+	dev->revertAt = serialNowMs() + BAUD_REVERT_MS;
+}
+
+static void simProbe(simDevice *dev, int nargs, char **args){
+	int n = nargs > 1 ? atoi(args[1]) : 0;
+	int len = nargs > 2 ? atoi(args[2]) : 0;
+	unsigned char bot = BOT;
+	unsigned char *frame;
+
+	if (dev->opt->v4 || n <= 0 || len <= 0 || len > 65536) {
+		simPrint(dev, "<arduino> : unknown command PROBE\r\n");
+		simEnd(dev);
+		return;
+	}
+
+	frame = (unsigned char *)malloc(len + 4);
+	serialWrite(&dev->port, &bot, 1);
+	for (int i = 0; i < n; i++) {
+		int got = serialReadExact(&dev->port, frame, len + 4, SIM_TIMEOUT_MS);
+		serialWrite(&dev->port, frame, got);
+		if (got < len + 4) break;
+	}
+	free(frame);
+	simEnd(dev);
+}
+
+/*
+HTOA flagged HDR_FLAG_DELTA.  returns 1 after telling the host to send the
+whole file, 0 once the delta has been received and reported.
+*/
+static int simRecvDelta(simDevice *dev, const header *h, const char *path){
+	serialPort *sp = &dev->port;
+	char side[520];
+	windowOptions wo;
+	windowStats ws;
+	header answer, ops;
+	FILE *old, *sigs = NULL, *delta = NULL, *out = NULL;
+	int64_t oldSize = 0, sigSize = 0, written = -1;
+	struct stat st;
+	unsigned char status;
+	int ok = 0, received = 0;
+
+	// a broken off transfer of this file is better finished with resume
+	snprintf(side, sizeof(side), "%s.resume", path);
+	old = fopen(path, "rb");
+	if (old != NULL && fstat(fileno(old), &st) == 0) oldSize = st.st_size;
+	if (oldSize > 0 && stat(side, &st) < 0) sigs = deltaSignature(old, oldSize, &sigSize);
+
+	memset(&answer, 0, sizeof(answer));
+	answer.bufSize = h->bufSize;
+	answer.window = h->window;
+	answer.flags = HDR_FLAG_WINDOW | (sigs != NULL ? HDR_FLAG_DELTA : 0);
+	answer.fileSize = (int32_t)sigSize;
+	memcpy(answer.fileName, h->fileName, sizeof(answer.fileName));
+	answer.crcCheck = crc32Compute(&answer, sizeof(answer) - 4);
+	serialWrite(sp, &answer, sizeof(answer));
+	if (sigs == NULL) {
+		if (old) fclose(old);
+		return(1);
+	}
+
+	memset(&ws, 0, sizeof(ws));
+	pacerInit(&ws.pace, simWindowBaud());
+	windowDefaults(&wo, h->bufSize, h->window, simWindowBaud());
+	windowOptionsFromLink(&wo, dev->features);
+	if (windowSend(sp, sigs, sigSize, &wo, &ws) == 0 &&
+			serialReadExact(sp, &ops, sizeof(ops), SIM_TIMEOUT_MS) == (int)sizeof(ops) &&
+			ops.crcCheck == crc32Compute(&ops, sizeof(ops) - 4) && (ops.flags & HDR_FLAG_DELTA) &&
+			ops.fileSize >= 0 && ops.bufSize > WF_OVERHEAD && ops.bufSize <= 65536) {
+		delta = tmpfile();
+		// the delta is counted on its own, an open ended FIN is checked against these
+		memset(&ws, 0, sizeof(ws));
+		pacerInit(&ws.pace, simWindowBaud());
+		windowDefaults(&wo, ops.bufSize, ops.window, simWindowBaud());
+		windowOptionsFromLink(&wo, dev->features);
+		if (delta != NULL && (received = windowRecv(sp, delta, ops.fileSize, &wo, &ws) == 0)) {
+			// the new file is built beside the old one, which it copies blocks from
+			snprintf(side, sizeof(side), "%s.delta", path);
+			out = fopen(side, "w+b");
+			if (out != NULL) written = deltaApply(delta, ops.fileSize, old, deltaBlockSize(oldSize), out);
+		}
+	}
+	fclose(sigs);
+	if (delta) fclose(delta);
+	fclose(old);
+
+	// and only replaces it once it checks out against the host's crc
+	if (out != NULL) {
+		ok = written == h->fileSize && resumeFileCrc(out, written) == (uint32_t)h->initX;
+		fclose(out);
+		if (!ok || rename(side, path) < 0) {
+			ok = 0;
+			unlink(side);
+		}
+	}
+
+	// the host waits for the outcome before it counts the transfer as done
+	status = ok ? OK : NOK;
+	if (received) serialWrite(sp, &status, 1);
+	if (ok) simPrint(dev, "<arduino> : saved %s %d bytes from a %d byte delta\r\n", h->fileName, h->fileSize, ops.fileSize);
+	else simPrint(dev, "<arduino> : delta for %s failed, old copy kept\r\n", h->fileName);
+	simEnd(dev);
+	return(0);
+}
+
+// HTOA and MHTOA, the device receives
+static void simRecvFile(simDevice *dev){
+	serialPort *sp = &dev->port;
+	unsigned char bot = BOT, eot = EOT, sync = SYNC, sok = SOK, nok = NOK;
+	unsigned char *buf = NULL;
+	char path[512];
+	resumeLog resume;
+	int64_t resumeFrom = 0;
+	int64_t size;
+	int resumable, stream;
+	header h;
+	FILE *f;
+	int rc = -1;
+
+	if (!serialWaitFor(sp, BOT, SIM_TIMEOUT_MS)) {
+		simPrint(dev, "<arduino> : no BOT from host\r\n");
+		simEnd(dev);
+		return;
+	}
+	serialWrite(sp, &bot, 1);
+
+	if (serialReadExact(sp, &h, sizeof(h), SIM_TIMEOUT_MS) < (int)sizeof(h) ||
+			h.bufSize <= 4 || h.bufSize > 65536 || (h.fileSize < 0 && !(h.flags & HDR_FLAG_STREAM))) {
+		simPrint(dev, "<arduino> : bad header\r\n");
+		simEnd(dev);
+		return;
+	}
+	h.fileName[sizeof(h.fileName) - 1] = '\0';
+	simPath(dev, path, sizeof(path), (char *)h.fileName);
+	size = h.fileSize;
+
+	// a stream is only the plain window transfer, its length comes at the end
+	stream = (h.flags & HDR_FLAG_STREAM) != 0;
+	if (stream && (dev->opt->v4 || !(h.flags & HDR_FLAG_WINDOW) ||
+			(h.flags & (HDR_FLAG_BATCH | HDR_FLAG_DELTA | HDR_FLAG_RESUME | HDR_FLAG_STRIPE)))) {
+		simPrint(dev, "<arduino> : bad header\r\n");
+		simEnd(dev);
+		return;
+	}
+
+	if (!dev->opt->v4 && (h.flags & HDR_FLAG_WINDOW) && (h.flags & HDR_FLAG_DELTA) &&
+			(dev->features & HDR_FLAG_DELTA) && !(h.flags & HDR_FLAG_BATCH) &&
+			simRecvDelta(dev, &h, path) == 0) return;
+
+	resumable = !dev->opt->v4 && (h.flags & HDR_FLAG_WINDOW) && (h.flags & HDR_FLAG_RESUME) &&
+			!(h.flags & HDR_FLAG_BATCH);
+
+	// a batch lands in a scratch stream and is unpacked onto the card
+	if (h.flags & HDR_FLAG_BATCH) f = tmpfile();
+	else if (resumable) f = resumeOpen(&resume, path, h.fileSize, (uint32_t)h.initX, &resumeFrom);
+	else f = fopen(path, "wb");
+	if (f == NULL) {
+		simPrint(dev, "<arduino> : can not create %s\r\n", h.fileName);
+		simEnd(dev);
+		return;
+	}
+
+	if ((h.flags & HDR_FLAG_WINDOW) && !dev->opt->v4) {
+		windowOptions wo;
+		windowStats ws;
+
+		memset(&ws, 0, sizeof(ws));
+		pacerInit(&ws.pace, simWindowBaud());
+		windowDefaults(&wo, h.bufSize, h.window, simWindowBaud());
+		windowOptionsFromLink(&wo, dev->features);
+		wo.stream = stream;
+		if (resumable) {
+			wo.start = resumeFrom;
+			wo.resume = &resume;
+		}
+		lineFaulty = 1;
+		if (h.flags & HDR_FLAG_STRIPE) rc = stripeRecv(dev->link, dev->opt->links, f, h.fileSize, &wo, &ws);
+		else rc = windowRecv(sp, f, h.fileSize, &wo, &ws);
+		lineFaulty = 0;
+		if (resumable && resumeFinish(&resume, f, rc == 0) < 0) rc = -1;
+		if (stream) size = ws.plainBytes;
+	} else {
+		int payload = h.bufSize - 4;
+		int numFrames = h.fileSize / payload;
+		int remainder = h.fileSize % payload;
+
+		buf = (unsigned char *)malloc(h.bufSize);
+		rc = 0;
+		for (int j = 0; j <= numFrames && rc == 0; j++) {
+			int len = j < numFrames ? payload : remainder;
+			int noks = 0;
+
+			while (1) {
+				uint32_t crc;
+				int ok;
+
+				// the host waits for EOT before each full frame, not the remainder
+				if (j < numFrames) serialWrite(sp, &eot, 1);
+				if (serialReadExact(sp, buf, len + 4, SIM_TIMEOUT_MS) < len + 4) {
+					rc = -1;
+					break;
+				}
+				crc = crc32Compute(buf, len);
+				ok = memcmp(&crc, buf + len, 4) == 0;
+				serialWrite(sp, &sync, 1);
+				serialWrite(sp, ok ? &sok : &nok, 1);
+				if (ok || ++noks == SIM_V4_RECV_RETRIES) break;
+			}
+			if (rc == 0) fwrite(buf, len, 1, f);
+		}
+	}
+	if (rc == 0 && (h.flags & HDR_FLAG_BATCH)) {
+		int files, bad = batchUnpack(f, h.fileSize, dev->opt->cardDir, &files);
+
+		fclose(f);
+		if (bad < 0) simPrint(dev, "<arduino> : batch stream damaged\r\n");
+		else simPrint(dev, "<arduino> : saved %d files, %d bad\r\n", files, bad);
+		simEnd(dev);
+		return;
+	}
+	fclose(f);
+	free(buf);
+
+	if (rc == 0) simPrint(dev, "<arduino> : saved %s %ld bytes\r\n", h.fileName, (long)size);
+	else simPrint(dev, "<arduino> : receiving %s failed\r\n", h.fileName);
+	simEnd(dev);
+}
+
+// ATOH, the device sends
+static void simSendFile(simDevice *dev, int nargs, char **args){
+	serialPort *sp = &dev->port;
+	unsigned char bot = BOT, sync = SYNC;
+	unsigned char *buf = NULL;
+	char path[512];
+	long size;
+	header h;
+	FILE *f;
+	int window, stripes, rc = -1;
+
+	if (nargs < 2) {
+		simPrint(dev, "<arduino> : ATOH needs a file name\r\n");
+		simEnd(dev);
+		return;
+	}
+	simPath(dev, path, sizeof(path), args[1]);
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		simPrint(dev, "<arduino> : no file %s\r\n", args[1]);
+		simEnd(dev);
+		return;
+	}
+	fseek(f, 0L, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+
+	window = dev->window;
+	if (nargs > 3) window = atoi(args[3]);
+	if (dev->opt->v4) window = 0;
+	stripes = window > 0 ? stripeCount(size, dev->stripes) : 1;
+
+	serialWrite(sp, &bot, 1);
+	if (!serialWaitFor(sp, BOT, SIM_TIMEOUT_MS)) {
+		fclose(f);
+		simPrint(dev, "<arduino> : no BOT from host\r\n");
+		simEnd(dev);
+		return;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.fileSize = (int32_t)size;
+	h.bufSize = dev->opt->v4 ? V4_FRAME_SIZE : dev->frameSize;
+	h.flags = window > 0 ? HDR_FLAG_WINDOW : 0;
+	strncpy((char *)h.fileName, nargs > 2 ? args[2] : args[1], sizeof(h.fileName) - 1);
+	h.window = window;
+	// a striped file goes out whole, it is not resumed
+	if (stripes > 1) h.flags |= HDR_FLAG_STRIPE;
+	else if (window > 0 && (dev->features & HDR_FLAG_RESUME)) {
+		h.flags |= HDR_FLAG_RESUME;
+		h.initX = (int32_t)resumeFileCrc(f, size);
+	}
+	if (window > 0 && (dev->features & HDR_FLAG_PACK) &&
+			packWorthIt(f, size, h.bufSize - WF_OVERHEAD)) h.flags |= HDR_FLAG_PACK;
+	h.crcCheck = crc32Compute(&h, sizeof(h) - 4);
+	serialWrite(sp, &h, sizeof(h));
+
+	if (window > 0) {
+		windowOptions wo;
+		windowStats ws;
+
+		memset(&ws, 0, sizeof(ws));
+		pacerInit(&ws.pace, simWindowBaud());
+		windowDefaults(&wo, h.bufSize, window, simWindowBaud());
+		windowOptionsFromLink(&wo, dev->features);
+		wo.pack = (h.flags & HDR_FLAG_PACK) != 0;
+		lineFaulty = 1;
+		if (stripes > 1) rc = stripeSend(dev->link, stripes, path, size, &wo, &ws);
+		else rc = windowSend(sp, f, size, &wo, &ws);
+		lineFaulty = 0;
+	} else {
+		int payload = h.bufSize - 4;
+		int numFrames = h.fileSize / payload;
+		int remainder = h.fileSize % payload;
+
+		buf = (unsigned char *)malloc(h.bufSize);
+		rc = 0;
+		for (int j = 0; j <= numFrames && rc == 0; j++) {
+			int len = j < numFrames ? payload : remainder;
+			uint32_t crc;
+			int noks = 0;
+
+			if (len > 0 && fread(buf, len, 1, f) != 1) {
+				rc = -1;
+				break;
+			}
+			crc = crc32Compute(buf, len);
+			memcpy(buf + len, &crc, 4);
+
+			while (1) {
+				int answer;
+
+				if (!serialWaitFor(sp, EOT, SIM_TIMEOUT_MS)) {
+					rc = -1;
+					break;
+				}
+				serialWrite(sp, buf, len + 4);
+				if (!serialWaitFor(sp, SYNC, SIM_TIMEOUT_MS)) {
+					rc = -1;
+					break;
+				}
+				serialWrite(sp, &sync, 1);
+				answer = serialReadByte(sp, SIM_TIMEOUT_MS);
+				if (answer == SOK || answer < 0 || ++noks == SIM_V4_SEND_RETRIES) break;
+			}
+		}
+	}
+	fclose(f);
+	free(buf);
+
+	if (rc == 0) simPrint(dev, "<arduino> : sent %s %ld bytes\r\n", args[1], size);
+	else simPrint(dev, "<arduino> : sending %s failed\r\n", args[1]);
+	simEnd(dev);
+}
+
+// MATOH, the device sends every card file matching the patterns
+static void simSendBatch(simDevice *dev, int nargs, char **args){
+	serialPort *sp = &dev->port;
+	unsigned char bot = BOT;
+	batchList bl = {0};
+	windowOptions wo;
+	windowStats ws;
+	int64_t size;
+	FILE *stream;
+	header h;
+	int rc;
+
+	for (int i = 1; i < nargs; i++) {
+		char path[512];
+
+		simPath(dev, path, sizeof(path), args[i]);
+		batchAdd(&bl, path);
+	}
+	stream = batchPack(&bl, &size);
+
+	serialWrite(sp, &bot, 1);
+	if (stream == NULL || !serialWaitFor(sp, BOT, SIM_TIMEOUT_MS)) {
+		if (stream) fclose(stream);
+		batchFree(&bl);
+		simPrint(dev, "<arduino> : no BOT from host\r\n");
+		simEnd(dev);
+		return;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.fileSize = (int32_t)size;
+	h.bufSize = dev->frameSize;
+	h.flags = HDR_FLAG_WINDOW | HDR_FLAG_BATCH;
+	strncpy((char *)h.fileName, nargs > 1 ? args[1] : "batch", sizeof(h.fileName) - 1);
+	h.window = dev->window > 0 ? dev->window : 1;
+	if ((dev->features & HDR_FLAG_PACK) && packWorthIt(stream, size, h.bufSize - WF_OVERHEAD)) h.flags |= HDR_FLAG_PACK;
+	h.crcCheck = crc32Compute(&h, sizeof(h) - 4);
+	serialWrite(sp, &h, sizeof(h));
+
+	memset(&ws, 0, sizeof(ws));
+	pacerInit(&ws.pace, simWindowBaud());
+	windowDefaults(&wo, h.bufSize, h.window, simWindowBaud());
+	windowOptionsFromLink(&wo, dev->features);
+	wo.pack = (h.flags & HDR_FLAG_PACK) != 0;
+	lineFaulty = 1;
+	rc = windowSend(sp, stream, size, &wo, &ws);
+	lineFaulty = 0;
+	fclose(stream);
+
+	if (rc == 0) simPrint(dev, "<arduino> : sent %d files %ld bytes\r\n", bl.count, (long)size);
+	else simPrint(dev, "<arduino> : sending batch failed\r\n");
+	batchFree(&bl);
+	simEnd(dev);
+}
+
+// VERIFY, a digest of every card file matching the patterns
+static void simVerify(simDevice *dev, int nargs, char **args){
+	unsigned char bot = BOT;
+	batchList bl = {0};
+	digest d;
+	int files = 0;
+
+	for (int i = 1; i < nargs; i++) {
+		char path[512];
+
+		simPath(dev, path, sizeof(path), args[i]);
+		batchAdd(&bl, path);
+	}
+
+	serialWrite(&dev->port, &bot, 1);
+	for (int i = 0; i < bl.count; i++) {
+		const char *base = strrchr(bl.names[i], '/');
+		FILE *f = fopen(bl.names[i], "rb");
+
+		if (f == NULL) continue;
+		memset(&d, 0, sizeof(d));
+		fseek(f, 0L, SEEK_END);
+		d.fileSize = (int32_t)ftell(f);
+		d.fileCrc = resumeFileCrc(f, d.fileSize);
+		fclose(f);
+		strncpy((char *)d.fileName, base ? base + 1 : bl.names[i], sizeof(d.fileName) - 1);
+		d.crcCheck = crc32Compute(&d, sizeof(d) - 4);
+		serialWrite(&dev->port, &d, sizeof(d));
+		files++;
+	}
+	memset(&d, 0, sizeof(d));
+	d.fileSize = -1;
+	d.crcCheck = crc32Compute(&d, sizeof(d) - 4);
+	serialWrite(&dev->port, &d, sizeof(d));
+
+	simPrint(dev, "<arduino> : %d files checked\r\n", files);
+	batchFree(&bl);
+	simEnd(dev);
+}
+
+static void simDevice_run(simDevice *dev){
+	char line[BATCH_LINE_MAX];
+
+	while (1) {
+		char *args[256];
+		int nargs = 0;
+		int64_t start = serialNowMs();
+		int timeout = 3600 * 1000;
+		int n;
+
+		if (dev->revertAt) timeout = (int)(dev->revertAt - start);
+		if (timeout < 0) timeout = 0;
+
+		n = serialReadUntil(&dev->port, line, sizeof(line) - 1, '\n', timeout);
+		if (n == 0) {
+			if (dev->revertAt && serialNowMs() >= dev->revertAt) {
+				// BAUD OK never came, the host could not hear us at the new rate
+				lineBaud = dev->oldBaud;
+				dev->revertAt = 0;
+				continue;
+			}
+			// nothing and no timeout, the host has gone
+			if (serialNowMs() - start < timeout) return;
+			continue;
+		}
+		line[n] = '\0';
+
+		for (char *tok = strtok(line, " \r\n"); tok != NULL && nargs < 256; tok = strtok(NULL, " \r\n")) {
+			args[nargs++] = tok;
+		}
+		if (nargs == 0) {
+			simEnd(dev);
+			continue;
+		}
+		for (char *c = args[0]; *c; c++) {
+			if (*c >= 'a' && *c <= 'z') *c = *c - 32;
+		}
+
+		if (!strcmp(args[0], "HELP")) {
+			simHelp(dev);
+		} else if (!strcmp(args[0], "DIR") || !strcmp(args[0], "LDIR")) {
+			simDir(dev);
+		} else if (!strcmp(args[0], "HTOA") || (!strcmp(args[0], "MHTOA") && !dev->opt->v4)) {
+			simRecvFile(dev);
+		} else if (!strcmp(args[0], "MATOH") && !dev->opt->v4) {
+			simSendBatch(dev, nargs, args);
+		} else if (!strcmp(args[0], "ATOH")) {
+			simSendFile(dev, nargs, args);
+		} else if (!strcmp(args[0], "LIST") && !dev->opt->v4) {
+			simList(dev, nargs, args);
+		} else if (!strcmp(args[0], "VERIFY") && !dev->opt->v4) {
+			simVerify(dev, nargs, args);
+		} else if (!strcmp(args[0], "CAPS")) {
+			simCaps(dev, nargs, args);
+		} else if (!strcmp(args[0], "BAUD")) {
+			simBaud(dev, nargs, args);
+		} else if (!strcmp(args[0], "PROBE")) {
+			simProbe(dev, nargs, args);
+		} else if (!strcmp(args[0], "QUIT")) {
+			simPrint(dev, "<arduino> : bye\r\n");
+			simEnd(dev);
+			tcdrain(dev->port.fd);
+			return;
+		} else {
+			simPrint(dev, "<arduino> : unknown command %s\r\n", args[0]);
+			simEnd(dev);
+		}
+	}
+}
+
+void devsimDefaults(devsimOptions *opt){
+	opt->cardDir = "simcard";
+	opt->baud = 115200;
+	opt->latencyMs = 0;
+	opt->v4 = 0;
+	opt->maxFrame = 4096;
+	opt->maxWindow = 16;
+	opt->links = 1;
+	opt->bitErrors = 0.0;
+	opt->dropRate = 0.0;
+	opt->dupRate = 0.0;
+}
+
+static lineDir *lineStart(int in, int out, const devsimOptions *opt){
+	lineDir *ld = (lineDir *)malloc(sizeof(lineDir));
+	int64_t inFlight = (int64_t)opt->baud * opt->latencyMs / 10000;
+	pthread_t tid;
+
+	// room for the bytes in flight plus a uart sized fifo
+	ld->in = in;
+	ld->out = out;
+	ld->opt = opt;
+	ld->rng = 0x9e3779b97f4a7c15ULL ^ (uint64_t)in;
+	ld->flipIn = faultGap(&ld->rng, opt->bitErrors);
+	ld->dropIn = faultGap(&ld->rng, opt->dropRate);
+	ld->dupIn = faultGap(&ld->rng, opt->dupRate);
+	ld->slots = (int)((inFlight + 1024) / LINE_CHUNK) + 2;
+	ld->q = (lineChunk *)malloc(sizeof(lineChunk) * ld->slots);
+	pthread_create(&tid, NULL, lineThread, ld);
+	pthread_detach(tid);
+	return(ld);
+}
+
+pid_t devsimStart(const devsimOptions *opt, int *hostFd){
+	int aMaster[LINKS_MAX], aSlave[LINKS_MAX], bMaster[LINKS_MAX], bSlave[LINKS_MAX];
+	int links = opt->links < 1 ? 1 : opt->links > LINKS_MAX ? LINKS_MAX : opt->links;
+	struct termios raw;
+	pid_t pid;
+
+	memset(&raw, 0, sizeof(raw));
+	cfmakeraw(&raw);
+	raw.c_cflag |= CREAD | CLOCAL;
+
+	// two ptys per link, the host's end and the device's, with a line between
+	for (int i = 0; i < links; i++) {
+		if (openpty(&aMaster[i], &aSlave[i], NULL, &raw, NULL) < 0 ||
+				openpty(&bMaster[i], &bSlave[i], NULL, &raw, NULL) < 0) {
+			printf("devsim : openpty failed: %s\n", strerror(errno));
+			return(-1);
+		}
+	}
+	mkdir(opt->cardDir, 0755);
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		printf("devsim : fork failed: %s\n", strerror(errno));
+		return(-1);
+	}
+
+	if (pid == 0) {
+		static simDevice dev;
+
+		crc32Init();
+		fecInit();
+		lineBaud = opt->baud;
+		lineLatencyUs = opt->latencyMs * 1000;
+
+		memset(&dev, 0, sizeof(dev));
+		dev.opt = opt;
+		dev.frameSize = V4_FRAME_SIZE;
+		dev.stripes = 1;
+		dev.link[0] = &dev.port;
+		serialInit(&dev.port, bSlave[0]);
+
+		for (int i = 0; i < links; i++) {
+			close(aMaster[i]);
+
+			// host to device, and device to host
+			lineStart(aSlave[i], bMaster[i], opt);
+			lineStart(bMaster[i], aSlave[i], opt);
+
+			if (i > 0) {
+				dev.link[i] = (serialPort *)malloc(sizeof(serialPort));
+				serialInit(dev.link[i], bSlave[i]);
+			}
+		}
+		simDevice_run(&dev);
+
+		// let the line deliver the last bytes before the process goes
+		usleep(100000 + lineLatencyUs);
+		_exit(0);
+	}
+
+	for (int i = 0; i < links; i++) {
+		close(aSlave[i]);
+		close(bMaster[i]);
+		close(bSlave[i]);
+		hostFd[i] = aMaster[i];
+	}
+	return(pid);
+}
+
+void devsimStop(pid_t pid, const int *hostFd, int links){
+	for (int i = 0; i < links; i++) close(hostFd[i]);
+	if (pid > 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+}
@@ -0,0 +1,43 @@
+/*
+Device simulator, the Arduino side of the protocol on a pseudo terminal.
+
+devsimStart() forks a process that plays the device: the command console
+(HELP, DIR, LDIR, QUIT ending in EOT), CAPS, BAUD / PROBE and both v4 stop
+and wait and sliding window HTOA / ATOH transfers, with a directory on the
+host standing in for the SD card.  Between the host's pty and the device
+sits a simulated line that delivers bytes no faster than the baud rate and
+adds a fixed latency in each direction.  With opt.links above 1 the
+device has that many links, each with a line of its own, and takes part
+in striped transfers (stripe.h).  The line can also flip bits and lose or
+double bytes while window transfers run, at the rates in the options.
+
+	devsimOptions opt;
+	devsimDefaults(&opt);
+	opt.baud = 115200;
+	pid = devsimStart(&opt, fd);	// fd[0 .. opt.links - 1] behave like
+					// opened serial ports
+*/
+
+#ifndef DEVSIM_H
+#define DEVSIM_H
+
+#include <sys/types.h>
+
+typedef struct devsimOptions {
+	const char *cardDir;	// directory standing in for the SD card
+	int baud;		// line speed to throttle to, 0 for no limit
+	int latencyMs;		// one way delay added to every byte
+	int v4;			// behave like v4 firmware: no CAPS, stop and wait only
+	int maxFrame;		// frame size offered in the CAPS reply
+	int maxWindow;
+	int links;		// serial links, each with its own simulated line
+	double bitErrors;	// faults on the line during window transfers: bits flipped,
+	double dropRate;	// bytes lost
+	double dupRate;		// and bytes doubled, each per bit or byte sent
+} devsimOptions;
+
+void devsimDefaults(devsimOptions *opt);
+pid_t devsimStart(const devsimOptions *opt, int *hostFd);
+void devsimStop(pid_t pid, const int *hostFd, int links);
+
+#endif
@@ -0,0 +1,185 @@
+/*
+Reed-Solomon coding, see fec.h
+
+Codewords are shortened RS(255, 247) over GF(256) with the 0x11d field
+polynomial and generator roots alpha^0 .. alpha^7.  Data bytes come first,
+highest power first, then the parity.  Decoding is the textbook chain:
+syndromes, Berlekamp-Massey for the error locator, a Chien search for the
+positions and Forney for the values.  Frames that arrive clean only pay
+for the syndromes.
+*/
+
+#include <string.h>
+
+#include "fec.h"
+
+static unsigned char gfExp[512];
+static unsigned char gfLog[256];
+static unsigned char gen[FEC_PARITY + 1];	// generator polynomial, highest power first
+
+static unsigned char gfMul(unsigned char a, unsigned char b){
+	if (a == 0 || b == 0) return(0);
+	return(gfExp[gfLog[a] + gfLog[b]]);
+}
+
+static unsigned char gfDiv(unsigned char a, unsigned char b){
+	if (a == 0) return(0);
+	return(gfExp[gfLog[a] + 255 - gfLog[b]]);
+}
+
+void fecInit(void){
+	int x = 1;
+
+	for (int i = 0; i < 255; i++) {
+		gfExp[i] = (unsigned char)x;
+		gfLog[x] = (unsigned char)i;
+		x <<= 1;
+		if (x & 0x100) x ^= 0x11d;
+	}
+	for (int i = 255; i < 512; i++) gfExp[i] = gfExp[i - 255];
+
+	// g(x) = (x - a^0)(x - a^1) ... (x - a^(FEC_PARITY - 1))
+	memset(gen, 0, sizeof(gen));
+	gen[0] = 1;
+	for (int i = 0; i < FEC_PARITY; i++) {
+		for (int j = i + 1; j > 0; j--) gen[j] ^= gfMul(gen[j - 1], gfExp[i]);
+	}
+}
+
+// parity bytes protecting len bytes
+int fecParitySize(int len){
+	return((len + FEC_DATA - 1) / FEC_DATA * FEC_PARITY);
+}
+
+static void encodeWord(unsigned char *cw, int k){
+	memset(cw + k, 0, FEC_PARITY);
+	for (int i = 0; i < k; i++) {
+		unsigned char coef = cw[i] ^ cw[k];
+
+		memmove(cw + k, cw + k + 1, FEC_PARITY - 1);
+		cw[k + FEC_PARITY - 1] = 0;
+		if (coef == 0) continue;
+		for (int j = 0; j < FEC_PARITY; j++) cw[k + j] ^= gfMul(gen[j + 1], coef);
+	}
+}
+
+/*
+Repairs one codeword of n bytes in place.  returns the bytes corrected,
+-1 if there are more errors than it can fix.
+*/
+static int decodeWord(unsigned char *cw, int n){
+	unsigned char s[FEC_PARITY], lambda[FEC_PARITY + 1], b[FEC_PARITY + 1], t[FEC_PARITY + 1];
+	unsigned char omega[FEC_PARITY];
+	int bad = 0, len = 0, m = 1, found = 0;
+	unsigned char lastD = 1;
+
+	for (int j = 0; j < FEC_PARITY; j++) {
+		unsigned char v = 0;
+
+		for (int i = 0; i < n; i++) v = gfMul(v, gfExp[j]) ^ cw[i];
+		s[j] = v;
+		bad |= v;
+	}
+	if (!bad) return(0);
+
+	// Berlekamp-Massey, lambda lowest power first
+	memset(lambda, 0, sizeof(lambda));
+	memset(b, 0, sizeof(b));
+	lambda[0] = b[0] = 1;
+	for (int r = 0; r < FEC_PARITY; r++) {
+		unsigned char d = s[r];
+
+		for (int i = 1; i <= len; i++) d ^= gfMul(lambda[i], s[r - i]);
+		if (d == 0) {
+			m++;
+			continue;
+		}
+		memcpy(t, lambda, sizeof(t));
+		for (int i = 0; i + m <= FEC_PARITY; i++) lambda[i + m] ^= gfMul(gfDiv(d, lastD), b[i]);
+		if (2 * len <= r) {
+			len = r + 1 - len;
+			memcpy(b, t, sizeof(b));
+			lastD = d;
+			m = 1;
+		} else {
+			m++;
+		}
+	}
+	if (len > FEC_PARITY / 2) return(-1);
+
+	// omega = s * lambda mod x^FEC_PARITY
+	for (int i = 0; i < FEC_PARITY; i++) {
+		omega[i] = 0;
+		for (int j = 0; j <= i && j <= len; j++) omega[i] ^= gfMul(s[i - j], lambda[j]);
+	}
+
+	// Chien search over the positions the shortened word has, Forney for each value
+	for (int e = 0; e < n; e++) {
+		unsigned char xInv = gfExp[(255 - e) % 255], v = 0, p = 1, num = 0, den = 0;
+
+		for (int i = 0; i <= len; i++) {
+			v ^= gfMul(lambda[i], p);
+			p = gfMul(p, xInv);
+		}
+		if (v != 0) continue;
+
+		p = 1;
+		for (int i = 0; i < FEC_PARITY; i++) {
+			num ^= gfMul(omega[i], p);
+			p = gfMul(p, xInv);
+		}
+		// the derivative keeps only the odd powers
+		p = 1;
+		for (int i = 1; i <= len; i += 2) {
+			den ^= gfMul(lambda[i], p);
+			p = gfMul(p, gfMul(xInv, xInv));
+		}
+		if (den == 0) return(-1);
+		cw[n - 1 - e] ^= gfMul(gfExp[e], gfDiv(num, den));
+		found++;
+	}
+	return(found == len ? found : -1);
+}
+
+// parity for len bytes of data, in fecParitySize(len) bytes
+void fecEncode(const unsigned char *data, int len, unsigned char *parity){
+	int words = (len + FEC_DATA - 1) / FEC_DATA;
+	unsigned char cw[255];
+
+	for (int w = 0; w < words; w++) {
+		int k = 0;
+
+		for (int i = w; i < len; i += words) cw[k++] = data[i];
+		encodeWord(cw, k);
+		memcpy(parity + w * FEC_PARITY, cw + k, FEC_PARITY);
+	}
+}
+
+/*
+Repairs data and parity in place.  returns the bytes corrected, 0 for a
+clean block, -1 if any codeword was beyond repair (what could be fixed
+is fixed, the crc will tell).
+*/
+int fecDecode(unsigned char *data, int len, unsigned char *parity){
+	int words = (len + FEC_DATA - 1) / FEC_DATA;
+	int fixed = 0, failed = 0;
+	unsigned char cw[255];
+
+	for (int w = 0; w < words; w++) {
+		int k = 0, rc;
+
+		for (int i = w; i < len; i += words) cw[k++] = data[i];
+		memcpy(cw + k, parity + w * FEC_PARITY, FEC_PARITY);
+		rc = decodeWord(cw, k + FEC_PARITY);
+		if (rc < 0) {
+			failed = 1;
+			continue;
+		}
+		if (rc == 0) continue;
+		fixed += rc;
+		k = 0;
+		for (int i = w; i < len; i += words) data[i] = cw[k++];
+		memcpy(parity + w * FEC_PARITY, cw + k, FEC_PARITY);
+	}
+	return(failed ? -1 : fixed);
+}
@@ -0,0 +1,33 @@
+/*
+Forward error correction for window frames.
+
+Reed-Solomon over GF(256), FEC_PARITY parity bytes to every codeword of up
+to FEC_DATA bytes, so each codeword survives FEC_PARITY / 2 damaged bytes.
+A block longer than one codeword is spread across several, byte i going to
+codeword i % n, so a burst of noise lands a byte or two in each rather than
+all in one.  The crc32 of the frame still has the last word: FEC only
+repairs what it can before the crc is checked, a frame it can not repair
+is naked and resent as before.
+
+	fecInit();
+	fecEncode(data, len, parity);		// fecParitySize(len) bytes
+	...
+	if (fecDecode(data, len, parity) < 0) ... beyond repair
+*/
+
+#ifndef FEC_H
+#define FEC_H
+
+#define FEC_PARITY 8
+#define FEC_DATA (255 - FEC_PARITY)
+
+// bytes FEC adds to a window frame of len payload bytes, header parity included
+#define FEC_FRAME_EXTRA(len) (FEC_PARITY + ((len) + 4 + FEC_DATA - 1) / FEC_DATA * FEC_PARITY)
+
+void fecInit(void);
+int fecParitySize(int len);
+
+void fecEncode(const unsigned char *data, int len, unsigned char *parity);
+int fecDecode(unsigned char *data, int len, unsigned char *parity);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+Mapped reads and positioned writes, see fileio.h
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "fileio.h"
+
+// maps the first 'size' bytes of f read only, NULL if it can not be mapped
+const unsigned char *fileMapOpen(fileMap *map, FILE *f, int64_t size){
+	struct stat st;
+	void *p;
+
+	map->base = NULL;
+	map->size = 0;
+	if (size <= 0 || fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < size) return(NULL);
+
+	// anything stdio has buffered for writing must be in the file first
+	fflush(f);
+	p = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	if (p == MAP_FAILED) return(NULL);
+	madvise(p, (size_t)size, MADV_SEQUENTIAL);
+
+	map->base = p;
+	map->size = (size_t)size;
+	return((const unsigned char *)p);
+}
+
+void fileMapClose(fileMap *map){
+	if (map->base != NULL) munmap(map->base, map->size);
+	map->base = NULL;
+	map->size = 0;
+}
+
+/*
+Reserves 'size' bytes for f in one go.  Filesystems without fallocate
+(and pipes) just carry on without it; returns -1 then, 0 otherwise.
+*/
+int filePrealloc(FILE *f, int64_t size){
+	if (size <= 0) return(0);
+	fflush(f);
+	if (fallocate(fileno(f), 0, 0, (off_t)size) < 0) {
+		if (errno != EOPNOTSUPP && errno != ENOSYS && errno != ESPIPE && errno != ENODEV) {
+			printf("<filePrealloc> : fallocate %lld bytes: %s\n", (long long)size, strerror(errno));
+		}
+		return(-1);
+	}
+	return(0);
+}
+
+// writes len bytes at offset, not moving the stdio position; returns 0 or -1
+int fileWriteAt(FILE *f, const void *buf, int len, int64_t offset){
+	const unsigned char *p = (const unsigned char *)buf;
+	int fd = fileno(f);
+
+	while (len > 0) {
+		ssize_t n = pwrite(fd, p, len, (off_t)offset);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return(-1);
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return(0);
+}
+
+/*
+Where the data of f starts again at or after offset, and in *hole where it
+stops.  A file that ends in a hole has its size as the next data; files
+that can not tell, pipes or filesystems without SEEK_DATA, are all data.
+The stdio position is kept.
+*/
+int64_t fileNextData(FILE *f, int64_t offset, int64_t *hole){
+	int fd = fileno(f);
+	off_t at = lseek(fd, 0, SEEK_CUR);
+	off_t data, end;
+	struct stat st;
+
+	*hole = INT64_MAX;
+	if (at < 0) return(offset);
+	data = lseek(fd, (off_t)offset, SEEK_DATA);
+	if (data < 0) {
+		data = errno == ENXIO && fstat(fd, &st) == 0 ? st.st_size : offset;
+	} else if ((end = lseek(fd, data, SEEK_HOLE)) >= 0) {
+		*hole = end;
+	}
+	lseek(fd, at, SEEK_SET);
+	return(data > offset ? data : offset);
+}
+
+// how many of the first len bytes of p are zero, 64 at a time while they are
+int64_t fileZeroSpan(const unsigned char *p, int64_t len){
+	int64_t i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 64 <= len; i += 64) {
+		__m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + i)), _mm_loadu_si128((const __m128i *)(p + i + 16)));
+		__m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + i + 32)), _mm_loadu_si128((const __m128i *)(p + i + 48)));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a, b), _mm_setzero_si128())) != 0xffff) break;
+	}
+#else
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+
+		memcpy(&w, p + i, 8);
+		if (w != 0) break;
+	}
+#endif
+	while (i < len && p[i] == 0) i++;
+	return(i);
+}
+
+/*
+Grows f to 'size' bytes, a hole where it was not written, and never
+shrinks it, so the threads of a striped transfer can each grow the file to
+the end of their slice at once.  The byte written to do it is the slice's
+own last one.  returns 0 or -1.
+*/
+int fileExtend(FILE *f, int64_t size){
+	static const unsigned char zero;
+	struct stat st;
+
+	if (fstat(fileno(f), &st) < 0) return(-1);
+	if (st.st_size >= size) return(0);
+	return(fileWriteAt(f, &zero, 1, size - 1));
+}
+
+/*
+Makes len bytes at offset read as zeros without writing them: the blocks
+are punched out of the file, which grows to cover them if it has to.
+Filesystems that can not punch get the zeros written.  returns 0 or -1.
+*/
+int fileZeroAt(FILE *f, int64_t offset, int64_t len){
+	static const unsigned char zero[16384];
+	int fd = fileno(f);
+
+	if (len <= 0) return(0);
+	if (fileExtend(f, offset + len) < 0) return(-1);
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)len) == 0) return(0);
+	while (len > 0) {
+		int n = len < (int64_t)sizeof(zero) ? (int)len : (int)sizeof(zero);
+
+		if (fileWriteAt(f, zero, n, offset) < 0) return(-1);
+		offset += n;
+		len -= n;
+	}
+	return(0);
+}
@@ -0,0 +1,51 @@
+/*
+File access for the transfer engines without stdio copies.
+
+The sending side maps the whole source file and frames straight out of the
+mapping; the receiving side reserves the file's full size on disk up front
+with fallocate, so a large file is laid out in one piece, and writes each
+frame in place with pwrite.  Sources that can not be mapped (pipes, empty
+files) return NULL and are read with fread as before.
+
+	fileMap map;
+	const unsigned char *p = fileMapOpen(&map, src, size);
+	...
+	fileMapClose(&map);
+
+	filePrealloc(dst, size);
+	fileWriteAt(dst, frame, len, offset);
+
+Sparse files.  The sender asks where the data runs are with SEEK_DATA /
+SEEK_HOLE and scans the rest for zeros; the receiver leaves a hole where
+the sender found zeros, punched with fallocate, and sizes the file with a
+hole rather than reserving it.
+
+	data = fileNextData(src, offset, &hole);	// data from 'data' to 'hole'
+	zeros = fileZeroSpan(p, len);			// zero bytes p starts with
+	fileExtend(dst, size);
+	fileZeroAt(dst, offset, len);
+*/
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct fileMap {
+	void *base;
+	size_t size;
+} fileMap;
+
+const unsigned char *fileMapOpen(fileMap *map, FILE *f, int64_t size);
+void fileMapClose(fileMap *map);
+
+int filePrealloc(FILE *f, int64_t size);
+int fileWriteAt(FILE *f, const void *buf, int len, int64_t offset);
+
+int64_t fileNextData(FILE *f, int64_t offset, int64_t *hole);
+int64_t fileZeroSpan(const unsigned char *p, int64_t len);
+int fileExtend(FILE *f, int64_t size);
+int fileZeroAt(FILE *f, int64_t offset, int64_t len);
+
+#endif
@@ -0,0 +1,49 @@
+/*
+Host side commands, shared by the console loop in HostSeriaPport_v4_crc32.c,
+the benchmark in bench.c and the daemon in daemon.c.
+
+Everything the host knows about one device is a hostSession, passed to
+runCommand() and on down to the transfers.  The console, scripts and the
+benchmark run one session, the daemon one per device.
+*/
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+
+#include "cardlist.h"
+#include "serialio.h"
+#include "settings.h"
+#include "window.h"
+
+typedef struct hostSession {
+	// agreed with the device by negotiateCaps(), clear capsDone to negotiate again
+	int bufSize;
+	int linkWindow;
+	uint32_t linkFeatures;
+	int capsDone;
+	int baudRate;
+	cardList cardDir;		// the card's listing as last fetched
+
+	// links to the device, hostLink[0] is the command port, and how many of
+	// them the device can stripe a transfer over
+	serialPort *hostLink[LINKS_MAX];
+	int hostLinks;
+	int linkStripes;
+
+	// counters of the last HTOA / ATOH, v4 transfers fill frames, resent and naks
+	windowStats transferStats;
+	int transferFailed;
+} hostSession;
+
+// offer parity on window frames, -fec, the same for every session
+extern int hostFec;
+
+void sessionInit(hostSession *hs, serialPort *port, int baud);
+int runCommand(hostSession *hs, unsigned char *line);
+int openLinks(const linkSettings *ls, int *fd);
+
+int benchRun(const linkSettings *ls);
+
+#endif
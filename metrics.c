@@ -0,0 +1,245 @@
+/*
+Per transfer telemetry, see metrics.h
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "metrics.h"
+#include "pacing.h"
+#include "protocol.h"
+#include "window.h"
+
+static const char *metricsPath = NULL;
+static int metricsShowProgress = 0;
+// daemon workers report at once, one record at a time goes in the file
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// where metricsReport adds its records (NULL for nowhere) and whether transfers show progress
+void metricsOutput(const char *path, int progress){
+	metricsPath = path;
+	metricsShowProgress = progress;
+}
+
+int metricsProgressOn(void){
+	return(metricsShowProgress);
+}
+
+/*
+Round trip buckets: 0 .. 3 us one each, after that every doubling is cut
+in four, so a bucket is never more than a quarter wider than its floor.
+*/
+static int bucketOf(int64_t us){
+	int k = 0;
+
+	if (us < 4) return(us < 0 ? 0 : (int)us);
+	while ((us >> k) >= 8) k++;
+	// us is (4 + sub) << k, give or take the bits below
+	if (4 * (k + 1) + (int)((us >> k) - 4) >= METRICS_BUCKETS) return(METRICS_BUCKETS - 1);
+	return(4 * (k + 1) + (int)((us >> k) - 4));
+}
+
+// the first round trip past bucket b
+static int64_t bucketTop(int b){
+	if (b < 4) return(b + 1);
+	return((int64_t)(4 + b % 4 + 1) << (b / 4 - 1));
+}
+
+/*
+One frame done, after 'retries' resends.  rttUs is its round trip, or < 0
+when it was resent and the ack can not be matched to one of the sends.
+*/
+void metricsFrame(metrics *m, int retries, int64_t rttUs){
+	m->retried[retries < METRICS_RETRIES - 1 ? retries : METRICS_RETRIES - 1]++;
+	if (rttUs < 0) return;
+	m->rtt[bucketOf(rttUs)]++;
+	m->rttCount++;
+	m->rttSumUs += rttUs;
+	if (rttUs > m->rttMaxUs) m->rttMaxUs = rttUs;
+}
+
+// crc32Compute, timed
+uint32_t metricsCrc(metrics *m, const void *buf, int len){
+	int64_t start = pacerClockUs();
+	uint32_t crc = crc32Compute((const unsigned char *)buf, len);
+
+	m->crcUs += pacerClockUs() - start;
+	m->crcBytes += len;
+	return(crc);
+}
+
+_Static_assert(V4_FRAME_SIZE - 4 == 60, "metricsCrcV4 needs the crc32Update instance for a v4 frame");
+
+// metricsCrc of the data of a V4_FRAME_SIZE frame, through its fixed length crc
+uint32_t metricsCrcV4(metrics *m, const void *buf){
+	int64_t start = pacerClockUs();
+	uint32_t crc = crc32Update60(CRC32_START, buf);
+
+	m->crcUs += pacerClockUs() - start;
+	m->crcBytes += V4_FRAME_SIZE - 4;
+	return(crc);
+}
+
+void metricsMerge(metrics *into, const metrics *from){
+	for (int i = 0; i < METRICS_BUCKETS; i++) into->rtt[i] += from->rtt[i];
+	for (int i = 0; i < METRICS_RETRIES; i++) into->retried[i] += from->retried[i];
+	into->rttCount += from->rttCount;
+	into->rttSumUs += from->rttSumUs;
+	if (from->rttMaxUs > into->rttMaxUs) into->rttMaxUs = from->rttMaxUs;
+	into->crcUs += from->crcUs;
+	into->crcBytes += from->crcBytes;
+}
+
+// the round trip 'percent' of frames came back within, to the top of its bucket
+int64_t metricsPercentileUs(const metrics *m, int percent){
+	int64_t want = (m->rttCount * percent + 99) / 100, seen = 0;
+
+	if (m->rttCount == 0) return(0);
+	for (int k = 0; k < METRICS_BUCKETS; k++) {
+		seen += m->rtt[k];
+		if (seen >= want) return(bucketTop(k) < m->rttMaxUs ? bucketTop(k) : m->rttMaxUs);
+	}
+	return(m->rttMaxUs);
+}
+
+/*
+'done' of 'total' bytes across, printed over the last line no more often
+than every METRICS_PROGRESS_MS and once more at the end.
+*/
+void metricsProgress(metrics *m, int64_t done, int64_t total){
+	int64_t now;
+
+	if (!m->progress) return;
+	now = pacerClockUs();
+	if (m->progressStartUs == 0) m->progressStartUs = now;
+	// a stream's total is -1 until it ends
+	if ((total < 0 || done < total) && now - m->progressUs < METRICS_PROGRESS_MS * 1000) return;
+	m->progressUs = now;
+
+	if (total < 0) {
+		printf("\r<local> : %ld bytes so far, %.1f KB/s", (long)done,
+				now > m->progressStartUs ? done * 1000.0 / (now - m->progressStartUs) : 0.0);
+		fflush(stdout);
+		return;
+	}
+	printf("\r<local> : %ld of %ld bytes (%.0f%%) %.1f KB/s", (long)done, (long)total,
+			total > 0 ? 100.0 * done / total : 100.0,
+			now > m->progressStartUs ? done * 1000.0 / (now - m->progressStartUs) : 0.0);
+	if (done >= total) printf("\n");
+	fflush(stdout);
+}
+
+static void jsonString(FILE *out, const char *s){
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') fputc('\\', out);
+		if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", (unsigned char)*s);
+		else fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+static void writeJson(FILE *out, const windowStats *ws, const char *who, const char *file, int64_t size,
+		int64_t elapsedUs, int failed, double goodput){
+	const metrics *m = &ws->metrics;
+
+	fprintf(out, "{\"who\":");
+	jsonString(out, who);
+	fprintf(out, ",\"file\":");
+	jsonString(out, file);
+	fprintf(out, ",\"bytes\":%ld,\"failed\":%d,\"elapsed_us\":%ld,\"goodput_bps\":%.0f",
+			(long)size, failed, (long)elapsedUs, goodput);
+	fprintf(out, ",\"frames\":%ld,\"resent\":%ld,\"corrected\":%ld,\"naks\":%ld,\"timeouts\":%ld",
+			(long)ws->frames, (long)ws->resent, (long)ws->corrected, (long)ws->naks, (long)ws->timeouts);
+	fprintf(out, ",\"resized\":%ld,\"payload\":%d", (long)ws->resized, ws->payload);
+	fprintf(out, ",\"wire_bytes\":%ld,\"plain_bytes\":%ld,\"packed_bytes\":%ld,\"zero_bytes\":%ld,\"start\":%ld",
+			(long)ws->wireBytes, (long)ws->plainBytes, (long)ws->packedBytes, (long)ws->zeroBytes, (long)ws->start);
+	fprintf(out, ",\"crc_us\":%ld,\"crc_bytes\":%ld,\"wait_us\":{", (long)m->crcUs, (long)m->crcBytes);
+	for (int i = 0; i < PACE_KINDS; i++) {
+		fprintf(out, "%s\"%s\":%ld", i ? "," : "", pacerName(i), (long)ws->pace.waitUs[i]);
+	}
+	fprintf(out, "},\"rtt_us\":{\"count\":%ld,\"mean\":%ld,\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"max\":%ld,\"buckets\":[",
+			(long)m->rttCount, (long)(m->rttCount ? m->rttSumUs / m->rttCount : 0),
+			(long)metricsPercentileUs(m, 50), (long)metricsPercentileUs(m, 90),
+			(long)metricsPercentileUs(m, 99), (long)m->rttMaxUs);
+	for (int k = 0; k < METRICS_BUCKETS; k++) fprintf(out, "%s%ld", k ? "," : "", (long)m->rtt[k]);
+	fprintf(out, "]},\"retried\":[");
+	for (int i = 0; i < METRICS_RETRIES; i++) fprintf(out, "%s%ld", i ? "," : "", (long)m->retried[i]);
+	fprintf(out, "]}\n");
+}
+
+static void csvString(FILE *out, const char *s){
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"') fputc('"', out);
+		fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+static void writeCsv(FILE *out, const windowStats *ws, const char *who, const char *file, int64_t size,
+		int64_t elapsedUs, int failed, double goodput){
+	const metrics *m = &ws->metrics;
+
+	// a new file starts with the column names
+	if (ftell(out) == 0) {
+		fprintf(out, "who,file,bytes,failed,elapsed_us,goodput_bps,frames,resent,corrected,naks,timeouts,resized,payload,"
+				"wire_bytes,plain_bytes,packed_bytes,zero_bytes,start,crc_us,crc_bytes");
+		for (int i = 0; i < PACE_KINDS; i++) fprintf(out, ",%s_us", pacerName(i));
+		fprintf(out, ",rtt_count,rtt_mean_us,rtt_p50_us,rtt_p90_us,rtt_p99_us,rtt_max_us");
+		for (int i = 0; i < METRICS_RETRIES; i++) fprintf(out, ",retried_%d", i);
+		fprintf(out, "\n");
+	}
+	fprintf(out, "%s,", who);
+	csvString(out, file);
+	fprintf(out, ",%ld,%d,%ld,%.0f,%ld,%ld,%ld,%ld,%ld,%ld,%d,%ld,%ld,%ld,%ld,%ld,%ld,%ld",
+			(long)size, failed, (long)elapsedUs, goodput,
+			(long)ws->frames, (long)ws->resent, (long)ws->corrected, (long)ws->naks, (long)ws->timeouts,
+			(long)ws->resized, ws->payload,
+			(long)ws->wireBytes, (long)ws->plainBytes, (long)ws->packedBytes, (long)ws->zeroBytes, (long)ws->start,
+			(long)m->crcUs, (long)m->crcBytes);
+	for (int i = 0; i < PACE_KINDS; i++) fprintf(out, ",%ld", (long)ws->pace.waitUs[i]);
+	fprintf(out, ",%ld,%ld,%ld,%ld,%ld,%ld", (long)m->rttCount,
+			(long)(m->rttCount ? m->rttSumUs / m->rttCount : 0),
+			(long)metricsPercentileUs(m, 50), (long)metricsPercentileUs(m, 90),
+			(long)metricsPercentileUs(m, 99), (long)m->rttMaxUs);
+	for (int i = 0; i < METRICS_RETRIES; i++) fprintf(out, ",%ld", (long)m->retried[i]);
+	fprintf(out, "\n");
+}
+
+/*
+The end of a transfer of 'size' file bytes: a summary line, and a record
+in the -metrics file if one was named.
+*/
+void metricsReport(const windowStats *ws, const char *who, const char *file, int64_t size,
+		int64_t elapsedUs, int failed){
+	const metrics *m = &ws->metrics;
+	double goodput = elapsedUs > 0 && !failed ? (size - ws->start) * 1000000.0 / elapsedUs : 0.0;
+	FILE *out;
+
+	printf("<local><%s> : goodput %.1f KB/s, crc %.1f ms", who, goodput / 1000.0, m->crcUs / 1000.0);
+	if (m->rttCount > 0) {
+		printf(", round trip mean %.1f p50 %.1f p99 %.1f max %.1f ms",
+				m->rttSumUs / 1000.0 / m->rttCount, metricsPercentileUs(m, 50) / 1000.0,
+				metricsPercentileUs(m, 99) / 1000.0, m->rttMaxUs / 1000.0);
+	}
+	printf("\n");
+
+	if (metricsPath == NULL) return;
+	pthread_mutex_lock(&metricsLock);
+	out = fopen(metricsPath, "a");
+	if (out == NULL) {
+		pthread_mutex_unlock(&metricsLock);
+		printf("<local><%s> : can not write metrics to %s\n", who, metricsPath);
+		return;
+	}
+	if (strlen(metricsPath) > 4 && !strcmp(metricsPath + strlen(metricsPath) - 4, ".csv")) {
+		writeCsv(out, ws, who, file, size, elapsedUs, failed, goodput);
+	} else {
+		writeJson(out, ws, who, file, size, elapsedUs, failed, goodput);
+	}
+	fclose(out);
+	pthread_mutex_unlock(&metricsLock);
+}
@@ -0,0 +1,54 @@
+/*
+Per transfer telemetry.
+
+Everything a transfer records goes into fixed counters carried in its
+windowStats, so the frame loops never allocate or print: a histogram of
+frame round trips (sent to acknowledged, frames that had to be resent are
+left out as their ack can not be matched to a send), the frames resent
+0, 1, 2 ... times, and the time spent in crc32.  Waits are in the pacer
+beside it.  At the end metricsReport prints a summary line and adds one
+record to the file named with -metrics, JSON lines, or CSV when the name
+ends in .csv.
+
+-progress turns on a progress line, at most one every METRICS_PROGRESS_MS,
+in place of the per frame printfs the transfers used to make.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_BUCKETS 128	// round trip buckets, four to each doubling of us
+#define METRICS_RETRIES 8	// resend counts kept apart, the last is that many or more
+#define METRICS_PROGRESS_MS 500
+
+typedef struct metrics {
+	int64_t rtt[METRICS_BUCKETS];
+	int64_t rttCount;
+	int64_t rttSumUs;
+	int64_t rttMaxUs;
+	int64_t retried[METRICS_RETRIES];
+	int64_t crcUs;		// time spent computing crcs
+	int64_t crcBytes;
+	int progress;		// print the progress line for this transfer
+	int64_t progressStartUs;
+	int64_t progressUs;	// when it was last printed
+} metrics;
+
+struct windowStats;
+
+void metricsOutput(const char *path, int progress);
+int metricsProgressOn(void);
+
+void metricsFrame(metrics *m, int retries, int64_t rttUs);
+uint32_t metricsCrc(metrics *m, const void *buf, int len);
+uint32_t metricsCrcV4(metrics *m, const void *buf);
+void metricsMerge(metrics *into, const metrics *from);
+int64_t metricsPercentileUs(const metrics *m, int percent);
+
+void metricsProgress(metrics *m, int64_t done, int64_t total);
+void metricsReport(const struct windowStats *ws, const char *who, const char *file, int64_t size,
+		int64_t elapsedUs, int failed);
+
+#endif
@@ -0,0 +1,108 @@
+/*
+Event driven pacing, see pacing.h
+*/
+
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pacing.h"
+
+static const char *paceNames[PACE_KINDS] = {"drain", "queue", "ready", "window", "pipe"};
+
+void pacerInit(pacer *pc, int baud){
+	pc->baud = baud > 0 ? baud : 115200;
+	for (int i = 0; i < PACE_KINDS; i++) {
+		pc->waitUs[i] = 0;
+		pc->waits[i] = 0;
+	}
+}
+
+int64_t pacerClockUs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+void pacerAccount(pacer *pc, int kind, int64_t startUs){
+	pc->waitUs[kind] += pacerClockUs() - startUs;
+	pc->waits[kind]++;
+}
+
+// returns once everything written has left the uart
+int pacerDrain(pacer *pc, serialPort *sp){
+	int64_t start = pacerClockUs();
+	int rc = tcdrain(sp->fd);
+
+	pacerAccount(pc, PACE_DRAIN, start);
+	return(rc);
+}
+
+/*
+Holds the caller back while more than 'limit' bytes are queued for the
+uart, so a frame that has to be resent is not stuck behind a long queue.
+Sleeps for the time the excess takes on the wire at the current baud rate.
+*/
+int pacerQueueBelow(pacer *pc, serialPort *sp, int limit){
+	int64_t start = 0, deadline = 0;
+	int queued;
+
+	while (ioctl(sp->fd, TIOCOUTQ, &queued) == 0 && queued > limit) {
+		int64_t us = (int64_t)(queued - limit) * 10 * 1000000 / pc->baud;
+
+		// twice the expected time, a port that never drains must not hang us
+		if (start == 0) {
+			start = pacerClockUs();
+			deadline = start + 2 * us + 50000;
+		} else if (pacerClockUs() > deadline) {
+			break;
+		}
+		usleep(us > 100 ? (useconds_t)us : 100);
+	}
+	if (start != 0) pacerAccount(pc, PACE_QUEUE, start);
+	return(0);
+}
+
+// discards input up to the device's ready byte, returns 1 if it came in time
+int pacerReady(pacer *pc, serialPort *sp, unsigned char ready, int timeoutMs){
+	int64_t start = pacerClockUs();
+	int rc = serialWaitFor(sp, ready, timeoutMs);
+
+	pacerAccount(pc, PACE_READY, start);
+	return(rc);
+}
+
+// the next byte from the device, or -1 on timeout
+int pacerNextByte(pacer *pc, serialPort *sp, int timeoutMs){
+	int64_t start = pacerClockUs();
+	int ch = serialReadByte(sp, timeoutMs);
+
+	pacerAccount(pc, PACE_READY, start);
+	return(ch);
+}
+
+const char *pacerName(int kind){
+	return(kind >= 0 && kind < PACE_KINDS ? paceNames[kind] : "?");
+}
+
+int64_t pacerTotalUs(const pacer *pc){
+	int64_t total = 0;
+
+	for (int i = 0; i < PACE_KINDS; i++) total += pc->waitUs[i];
+	return(total);
+}
+
+void pacerReport(const pacer *pc, int64_t elapsedUs, const char *who){
+	int64_t total = pacerTotalUs(pc);
+
+	printf("<local><%s> : pacing %.1f ms of %.1f ms (%.0f%%) :", who,
+			total / 1000.0, elapsedUs / 1000.0,
+			elapsedUs > 0 ? 100.0 * total / elapsedUs : 0.0);
+	for (int i = 0; i < PACE_KINDS; i++) {
+		if (pc->waits[i] == 0) continue;
+		printf(" %s %.1f ms (%ld)", paceNames[i], pc->waitUs[i] / 1000.0, (long)pc->waits[i]);
+	}
+	printf("\n");
+}
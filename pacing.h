@@ -0,0 +1,46 @@
+/*
+Event driven pacing for the serial link.
+
+Replaces the fixed usleep() calls between frames.  Each wait lasts only as
+long as its condition needs: the uart draining (tcdrain), the kernel output
+queue falling below a depth (TIOCOUTQ), or the device sending its ready
+byte.  Every wait is timed so a transfer can report how much of its run was
+spent pacing rather than moving data.
+*/
+
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdint.h>
+
+#include "serialio.h"
+
+enum {
+	PACE_DRAIN = 0,		// tcdrain, output fully on the wire
+	PACE_QUEUE,		// output queue above its limit
+	PACE_READY,		// waiting for the device's ready / sync byte
+	PACE_WINDOW,		// send window full, waiting for an ack
+	PACE_PIPE,		// waiting on the disk / checksum stages of a transfer
+	PACE_KINDS
+};
+
+typedef struct pacer {
+	int baud;
+	int64_t waitUs[PACE_KINDS];
+	int64_t waits[PACE_KINDS];
+} pacer;
+
+void pacerInit(pacer *pc, int baud);
+int64_t pacerClockUs(void);
+void pacerAccount(pacer *pc, int kind, int64_t startUs);
+
+int pacerDrain(pacer *pc, serialPort *sp);
+int pacerQueueBelow(pacer *pc, serialPort *sp, int limit);
+int pacerReady(pacer *pc, serialPort *sp, unsigned char ready, int timeoutMs);
+int pacerNextByte(pacer *pc, serialPort *sp, int timeoutMs);
+
+const char *pacerName(int kind);
+int64_t pacerTotalUs(const pacer *pc);
+void pacerReport(const pacer *pc, int64_t elapsedUs, const char *who);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+LZ4 block format compressor and decompressor, see pack.h
+
+A sequence is a token byte (literal count in the high nibble, match length
+- 4 in the low one, 15 meaning more length bytes follow), the literals, a
+two byte little endian match offset and any extra match length bytes.  The
+last sequence has literals only.  As in LZ4 the last 5 bytes are always
+literals and no match starts in the last 12, so any LZ4 block decoder can
+read the output.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pack.h"
+
+#define PACK_HASH_BITS 12
+#define PACK_MIN_MATCH 4
+#define PACK_LAST_LITERALS 5
+#define PACK_MATCH_LIMIT 12
+#define PACK_SAMPLES 8
+
+static uint32_t packHash(const unsigned char *p){
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return((v * 2654435761u) >> (32 - PACK_HASH_BITS));
+}
+
+static unsigned char *packLength(unsigned char *op, int n){
+	for (; n >= 255; n -= 255) *op++ = 255;
+	*op++ = (unsigned char)n;
+	return(op);
+}
+
+/*
+returns the packed length, or 0 if the frame does not get smaller (or
+does not fit in dstMax), in which case it should go raw.
+*/
+int packFrame(const unsigned char *src, int len, unsigned char *dst, int dstMax){
+	int32_t table[1 << PACK_HASH_BITS];
+	unsigned char *op = dst;
+	unsigned char *end = dst + dstMax;
+	int ip = 0, anchor = 0;
+	int limit = len - PACK_MATCH_LIMIT;
+	int matchEnd = len - PACK_LAST_LITERALS;
+
+	if (len < PACK_MATCH_LIMIT + 1 || len > 0xffff) return(0);
+	memset(table, 0xff, sizeof(table));
+
+	while (ip < limit) {
+		uint32_t h = packHash(src + ip);
+		int ref = table[h];
+		int lit, mlen;
+
+		table[h] = ip;
+		if (ref < 0 || memcmp(src + ref, src + ip, PACK_MIN_MATCH) != 0) {
+			ip++;
+			continue;
+		}
+
+		mlen = PACK_MIN_MATCH;
+		while (ip + mlen < matchEnd && src[ref + mlen] == src[ip + mlen]) mlen++;
+
+		// token, literals, offset and lengths must all fit
+		lit = ip - anchor;
+		if (op + 1 + lit / 255 + 1 + lit + 2 + (mlen - PACK_MIN_MATCH) / 255 + 1 > end) return(0);
+
+		*op = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+		*op |= (unsigned char)(mlen - PACK_MIN_MATCH >= 15 ? 15 : mlen - PACK_MIN_MATCH);
+		op++;
+		if (lit >= 15) op = packLength(op, lit - 15);
+		memcpy(op, src + anchor, lit);
+		op += lit;
+		*op++ = (unsigned char)(ip - ref);
+		*op++ = (unsigned char)((ip - ref) >> 8);
+		if (mlen - PACK_MIN_MATCH >= 15) op = packLength(op, mlen - PACK_MIN_MATCH - 15);
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+	// the rest as literals
+	{
+		int lit = len - anchor;
+
+		if (op + 1 + lit / 255 + 1 + lit > end) return(0);
+		*op++ = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+		if (lit >= 15) op = packLength(op, lit - 15);
+		memcpy(op, src + anchor, lit);
+		op += lit;
+	}
+
+	if (op - dst >= len) return(0);
+	return((int)(op - dst));
+}
+
+// returns the unpacked length, -1 if the input is corrupt or too big
+int unpackFrame(const unsigned char *src, int len, unsigned char *dst, int dstMax){
+	int ip = 0, op = 0;
+
+	while (ip < len) {
+		int token = src[ip++];
+		int lit = token >> 4;
+		int mlen = token & 15;
+		int offset, b;
+
+		if (lit == 15) {
+			do {
+				if (ip >= len) return(-1);
+				b = src[ip++];
+				lit += b;
+			} while (b == 255);
+		}
+		if (lit > len - ip || lit > dstMax - op) return(-1);
+		memcpy(dst + op, src + ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip == len) break;
+
+		if (len - ip < 2) return(-1);
+		offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op) return(-1);
+
+		if (mlen == 15) {
+			do {
+				if (ip >= len) return(-1);
+				b = src[ip++];
+				mlen += b;
+			} while (b == 255);
+		}
+		mlen += PACK_MIN_MATCH;
+		if (mlen > dstMax - op) return(-1);
+
+		// byte by byte, a match may overlap its own output
+		for (int i = 0; i < mlen; i++) dst[op + i] = dst[op - offset + i];
+		op += mlen;
+	}
+	return(op);
+}
+
+/*
+Compresses a few frame sized samples spread through the file and returns 1
+if they shrink by at least an eighth; jpegs and other packed formats are
+sent raw without spending cpu on every frame.  The file is rewound.
+*/
+int packWorthIt(FILE *f, int64_t size, int frameBytes){
+	unsigned char *raw = (unsigned char *)malloc(frameBytes);
+	unsigned char *out = (unsigned char *)malloc(frameBytes);
+	int64_t rawTotal = 0, packedTotal = 0;
+	int samples = PACK_SAMPLES;
+
+	if (raw == NULL || out == NULL || size <= 0) {
+		free(raw);
+		free(out);
+		return(0);
+	}
+	if (size <= (int64_t)frameBytes * samples) samples = (int)((size + frameBytes - 1) / frameBytes);
+
+	for (int i = 0; i < samples; i++) {
+		int64_t at = size <= (int64_t)frameBytes * PACK_SAMPLES ? (int64_t)i * frameBytes
+				: (size - frameBytes) / (samples - 1) * i;
+		int n, packed;
+
+		fseek(f, (long)at, SEEK_SET);
+		n = (int)fread(raw, 1, frameBytes, f);
+		if (n <= 0) break;
+		packed = packFrame(raw, n, out, n);
+		rawTotal += n;
+		packedTotal += packed > 0 ? packed : n;
+	}
+	rewind(f);
+	free(raw);
+	free(out);
+
+	return(rawTotal > 0 && packedTotal <= rawTotal - rawTotal / 8);
+}
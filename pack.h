@@ -0,0 +1,25 @@
+/*
+Frame compression for the sliding window transfers.
+
+The codec is the LZ4 block format: runs of literals and back references of
+at least 4 bytes up to 64 KB back, with no entropy coding, so a decoder
+fits in a few hundred bytes of AVR flash and needs no memory beyond the
+output frame.  Each frame is compressed on its own; frames that do not
+shrink go raw, flagged per frame with WFF_PACKED (protocol.h).
+
+	n = packFrame(data, len, out, len);	// 0: send it raw
+	n = unpackFrame(in, inLen, data, max);	// -1: corrupt
+*/
+
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+int packFrame(const unsigned char *src, int len, unsigned char *dst, int dstMax);
+int unpackFrame(const unsigned char *src, int len, unsigned char *dst, int dstMax);
+
+int packWorthIt(FILE *f, int64_t size, int frameBytes);
+
+#endif
@@ -0,0 +1,300 @@
+/*
+Wire structures shared by the host and the device side of the link.
+
+Everything is sent as raw little endian structs, as the original header
+always has been, so the layouts below must not gain padding.
+*/
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// single byte handshakes, defined in the host program
+extern unsigned char EOT, BOT, LOK, SYNC, OK, RSD, SOK, NOK;
+
+/*
+Transfer header, sent once per file after the BOT exchange by whichever
+side is sending.  The layout is the original v4 one, the placeholder fields
+crcX and poly now carry the protocol flags and window size; the v4 firmware
+ignores both, so a zero flags word means the original stop and wait frames.
+*/
+typedef struct header {
+	int32_t fileSize;
+	int32_t bufSize;		// frame size on the wire, crc included
+	//	int32_t numFrames;
+	int32_t flags;			// HDR_FLAG_xxx, was crcX
+	unsigned char fileName[64];
+	int32_t window;			// frames in flight for HDR_FLAG_WINDOW, was poly
+	int32_t initX;			// whole file crc32 for HDR_FLAG_RESUME
+	uint32_t crcCheck;		// crc32 of the header up to this field
+} header;
+
+#define HDR_FLAG_WINDOW 0x0001	// sliding window frames, see wframe below
+#define HDR_FLAG_BAUD 0x0002	// BAUD and PROBE commands, see below
+#define HDR_FLAG_BATCH 0x0004	// MHTOA / MATOH batch streams, see entry below
+#define HDR_FLAG_RESUME 0x0008	// initX is the file's crc32, see WFF_RESUME below
+#define HDR_FLAG_PACK 0x0010	// data frames may be compressed, see WFF_PACKED below
+#define HDR_FLAG_DELTA 0x0020	// send only what differs from the card's copy, see sigHead below
+#define HDR_FLAG_STRIPE 0x0040	// the file is split across several serial links, see stripe below
+#define HDR_FLAG_FEC 0x0080	// window frames carry Reed-Solomon parity, see wframe below
+#define HDR_FLAG_VERIFY 0x0100	// VERIFY command, see digest below
+#define HDR_FLAG_LIST 0x0200	// LIST command, see cardEntry below
+#define HDR_FLAG_COBS 0x0400	// window frames are byte stuffed and delimited, see wframe below
+#define HDR_FLAG_STREAM 0x0800	// length not known up front, see WF_IDLE below
+#define HDR_FLAG_ADAPT 0x1000	// data frames may be shorter than the agreed size, see wframe below
+#define HDR_FLAG_SPARSE 0x2000	// holes and runs of zeros go as their length, see WFF_ZERO below
+
+/*
+Batch transfers.  MHTOA and MATOH move many files with one BOT exchange and
+one header, flagged HDR_FLAG_BATCH, whose fileSize is the length of the
+whole stream.  The stream is sent with the sliding window frames and holds,
+for each file, this entry followed by the file's bytes.
+
+	MHTOA			host sends the stream to the card
+	MATOH <pattern> ...	device sends the card files matching the
+				patterns
+
+A device offering HDR_FLAG_BATCH accepts command lines of BATCH_LINE_MAX.
+*/
+typedef struct entry {
+	int32_t fileSize;
+	unsigned char fileName[64];
+	uint32_t crcCheck;		// crc32 of the file's bytes
+} entry;
+
+#define BATCH_LINE_MAX 1024
+
+/*
+Capability handshake, done once before the first transfer.  The host sends
+
+	CAPS <maxFrame> <maxWindow> <features>
+
+as an ordinary command line.  Firmware that knows the command answers with
+BOT, this struct filled in with its own limits, and then EOT like any other
+command; both sides then use the smaller frame size and window and the
+features they have in common.  v4 firmware answers with console text and
+EOT only, and the link stays at 64 byte stop and wait frames.
+*/
+typedef struct caps {
+	uint32_t magic;			// CAPS_MAGIC
+	int32_t version;
+	int32_t maxFrame;		// largest frame, crc included, the side can buffer
+	int32_t maxWindow;
+	uint32_t features;		// HDR_FLAG_xxx understood
+	uint32_t crcCheck;		// crc32 of the struct up to this field
+} caps;
+
+/*
+A host with more than one serial link to the device adds their number,
+
+	CAPS <maxFrame> <maxWindow> <features> <links>
+
+and offers HDR_FLAG_STRIPE.  A device that takes it up sends an int32 after
+the caps struct, the number of links it has itself; both sides then stripe
+over the smaller count.
+*/
+
+#define CAPS_MAGIC 0x53504143	// "CAPS"
+#define CAPS_VERSION 5
+#define V4_FRAME_SIZE 64
+
+/*
+Line speed changes, for devices that offer HDR_FLAG_BAUD.
+
+	BAUD <rate>		device answers EOT at the old rate, then switches
+	PROBE <n> <len>		device answers BOT, then echoes back each of the
+				n test frames of len bytes + crc32 the host sends,
+				then EOT
+	BAUD OK			keep the new rate
+
+A device that has not seen BAUD OK within BAUD_REVERT_MS of switching goes
+back to the old rate by itself, so a rate the link can not carry never
+strands the host.
+*/
+#define BAUD_REVERT_MS 3000
+
+/*
+Delta uploads, rsync style.  An HTOA header flagged HDR_FLAG_DELTA, with
+the new file's crc32 in initX, asks the device to describe the copy it
+already holds under that name.  The device answers with a header of its
+own.  Without HDR_FLAG_DELTA (no old copy, or a broken off transfer it
+would rather resume) the transfer carries on as a plain window one.  With
+it, 'fileSize' bytes of signature follow in window frames from the device:
+a sigHead and a blockSig for every whole block of the old copy.
+
+The host looks for those blocks at any byte offset of the new file and
+sends a second header, 'fileSize' the length of its delta, then the delta
+in window frames: deltaOp records, each either a run of old blocks to copy
+or followed by 'len' literal bytes.  The device builds the new file next to
+the old one, checks it against initX and only then replaces the old copy.
+Once the last delta frame is in it answers OK when it did, NOK when it
+kept the old copy, before its console text.
+
+	host				device
+	header DELTA, initX	->
+			<-	header DELTA, signature
+	header DELTA, delta	->
+*/
+typedef struct sigHead {
+	int32_t blockSize;
+	int32_t blocks;			// blockSig records that follow
+	int32_t fileSize;		// of the old copy
+} sigHead;
+
+typedef struct blockSig {
+	uint32_t weak;			// rolling checksum, see delta.c
+	uint32_t strong;		// crc32 of the block
+} blockSig;
+
+typedef struct deltaOp {
+	int32_t block;			// first old block to copy, or DELTA_LITERAL
+	int32_t len;			// bytes copied, or literal bytes that follow
+} deltaOp;
+
+#define DELTA_LITERAL -1
+
+/*
+Striped transfers.  A header flagged HDR_FLAG_STRIPE, on the command link
+as always, is followed on each of 'count' links by one of these, and each
+link then carries its slice of the file as an ordinary window transfer of
+its own, frames numbered from 0 at 'offset'.  Slices are contiguous and in
+index order, link 0 is the command link; which of the other links gets
+which slice does not matter, since every frame carries its file offset.
+After a delta answer declining the delta (see above) the stripes follow.
+*/
+typedef struct stripe {
+	int32_t index;
+	int32_t count;			// links carrying the file
+	int32_t offset;			// first byte of this link's slice
+	int32_t length;
+	uint32_t crcCheck;		// crc32 of the struct up to this field
+} stripe;
+
+#define LINKS_MAX 8
+
+/*
+Remote checks, for devices that offer HDR_FLAG_VERIFY.
+
+	VERIFY <pattern> ...	device answers BOT, a digest for every card
+				file matching the patterns, one more with
+				fileSize -1 to end the list, then console text
+				and EOT
+
+Patterns are matched as MATOH matches them.  The host compares sizes and
+crcs against its own copies, nothing else crosses the link.
+*/
+typedef struct digest {
+	int32_t fileSize;
+	unsigned char fileName[64];
+	uint32_t fileCrc;		// crc32 of the whole file
+	uint32_t crcCheck;		// crc32 of the struct up to this field
+} digest;
+
+/*
+Card listings, for devices that offer HDR_FLAG_LIST.
+
+	LIST [CRC]		device answers BOT, a cardEntry for every card
+				file, one more with fileSize -1 to end the list,
+				then console text and EOT
+
+fileCrc is 0 unless CRC was asked for, the device has to read every file
+for it.  DIR stays the v4 console listing.
+*/
+typedef struct cardEntry {
+	int32_t fileSize;
+	int32_t mtime;			// seconds since 1970, as the card's clock had it
+	unsigned char fileName[64];
+	uint32_t fileCrc;
+	uint32_t crcCheck;		// crc32 of the struct up to this field
+} cardEntry;
+
+/*
+Sliding window frames.
+
+Every frame is a wframe header, 'len' payload bytes and a crc32 over both.
+The sender keeps up to 'window' DATA frames in flight, the receiver answers
+with ACK frames carrying a cumulative ack in 'seq' (every frame below it
+has arrived) and a selective ack bitmap in 'offset' (bit i set means frame
+seq + 1 + i has arrived).  A NAK has the same layout and asks for the first
+missing frame to be resent at once instead of waiting for the timeout.
+
+	receiver			sender
+	ACK seq 0	(ready)	->
+			<-	DATA 0, DATA 1 ... DATA window-1
+	ACK seq n, bitmap	->
+			<-	resend holes, next DATA ...
+	...
+			<-	FIN seq numFrames
+	FINACK			->
+
+A header with HDR_FLAG_STREAM has fileSize -1: the sender reads a pipe and
+does not know the length until it ends.  DATA frames then carry whatever
+had arrived, up to a full payload, at the offset the bytes before them end
+at, and the FIN's 'offset' is the length of the whole stream, 64 bits, so
+a stream is not held to the 2 GB of fileSize.  While the pipe has nothing
+for it the sender sends WF_IDLE every timeout, the receiver takes it as a
+sign of life and does not answer.  Streams are not resumed, striped or
+sent as deltas.
+
+When the header has HDR_FLAG_RESUME the receiver's acks, until the first
+frame arrives, carry WFF_RESUME and in 'offset' the byte it already holds
+the file up to; the sender starts there, frame 0 at that offset.
+
+With HDR_FLAG_PACK a DATA frame flagged WFF_PACKED carries its payload
+compressed; it still covers the same span of the file, 'offset' and the
+frame numbering are unchanged and the crc is over the bytes on the wire.
+
+HDR_FLAG_FEC is agreed for the session in the CAPS exchange, not per
+transfer.  Once it is, every window frame either way is sent as
+
+	wframe, 8 parity bytes, payload, crc32, parity
+
+the first parity protecting the wframe alone, so 'len' can be trusted, and
+the last 8 bytes for each 247 of payload and crc, interleaved (fec.h).  The
+receiver repairs what it can and then checks the crc as before.
+
+HDR_FLAG_COBS is agreed the same way.  Every window frame, parity and all,
+is then COBS encoded (cobs.h) so it holds no 0x00, and a 0x00 follows it.
+A lost or extra byte spoils that one frame, the receiver finds the next at
+the delimiter instead of reading a wrong 'len' into the frames after and
+waiting out the timeout.
+
+HDR_FLAG_ADAPT, agreed the same way, lets the sender cut data frames to any
+payload up to the agreed one and change it from frame to frame as the line
+gets noisier or cleaner (adapt.h).  Every DATA frame still says where its
+bytes go; the receiver takes frames until the FIN, whose 'offset' is then
+the number of bytes sent, as for a stream.
+
+HDR_FLAG_SPARSE, agreed the same way, lets a DATA frame flagged WFF_ZERO
+stand for a run of zeros: its payload is a uint64 count, at most
+SPARSE_EXTENT_MAX, of zero bytes from 'offset' on.  The receiver leaves a
+hole there and writes nothing.  Data frames around the runs are cut short
+where they start, so frames are counted up to the FIN as with
+HDR_FLAG_ADAPT.
+*/
+typedef struct wframe {
+	uint8_t type;			// WF_xxx
+	uint8_t flags;
+	uint16_t len;			// payload bytes after this header
+	uint32_t seq;			// frame number, or cumulative ack
+	uint64_t offset;		// file offset of the payload, or sack bitmap
+} wframe;
+
+#define WF_DATA 0x10
+#define WF_ACK 0x11
+#define WF_NAK 0x12
+#define WF_FIN 0x13
+#define WF_FINACK 0x14
+#define WF_IDLE 0x15
+
+#define WFF_RESUME 0x01		// ack offset is the resume point, not a bitmap
+#define WFF_PACKED 0x02		// data payload is an LZ4 block, see pack.h
+#define WFF_ZERO 0x04		// data payload is the length of a run of zeros
+
+#define SPARSE_EXTENT_MAX (1 << 30)
+
+#define WF_OVERHEAD ((int)sizeof(wframe) + 4)
+#define WINDOW_MAX 64		// limited by the 64 bit sack bitmap
+
+#endif
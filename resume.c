@@ -0,0 +1,170 @@
+/*
+Resume manifests, see resume.h
+
+The manifest is plain text so a stuck transfer can be looked at by hand:
+
+	resume <fileSize> <fileCrc>
+	<offset> <len> <crc>
+	...
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "resume.h"
+
+typedef struct resumeChunkRec {
+	int64_t offset;
+	int len;
+	uint32_t crc;
+} resumeChunkRec;
+
+static int chunkOrder(const void *a, const void *b){
+	int64_t d = ((const resumeChunkRec *)a)->offset - ((const resumeChunkRec *)b)->offset;
+	return(d < 0 ? -1 : d > 0);
+}
+
+// crc32 of 'len' bytes of f from 'offset', the file position is not kept
+static uint32_t rangeCrc(FILE *f, int64_t offset, int64_t len, int *partial){
+	unsigned char buf[16384];
+	uint32_t crc = CRC32_START;
+
+	*partial = 0;
+	if (fseek(f, (long)offset, SEEK_SET) != 0) {
+		*partial = 1;
+		return(0);
+	}
+	while (len > 0) {
+		size_t n = len < (int64_t)sizeof(buf) ? (size_t)len : sizeof(buf);
+
+		if (fread(buf, 1, n, f) != n) {
+			*partial = 1;
+			break;
+		}
+		crc = crc32Update(crc, buf, n);
+		len -= n;
+	}
+	return(crc);
+}
+
+// the sender's whole file crc, sent in the header
+uint32_t resumeFileCrc(FILE *f, int64_t size){
+	int partial;
+	uint32_t crc = rangeCrc(f, 0, size, &partial);
+
+	rewind(f);
+	return(crc);
+}
+
+/*
+Opens 'file' to receive into.  With a manifest for the same size and crc
+the file is kept and *start set past the chunks that still check out,
+otherwise the file is truncated and *start is 0.  returns NULL if the file
+can not be opened.
+*/
+FILE *resumeOpen(resumeLog *rl, const char *file, int64_t fileSize, uint32_t fileCrc, int64_t *start){
+	resumeChunkRec *chunks = NULL;
+	int count = 0;
+	FILE *f = NULL;
+	FILE *old;
+
+	*start = 0;
+	snprintf(rl->path, sizeof(rl->path), "%s.resume", file);
+	rl->fileSize = fileSize;
+	rl->fileCrc = fileCrc;
+	rl->log = NULL;
+
+	old = fopen(rl->path, "r");
+	if (old != NULL) {
+		long long size;
+		unsigned int crc;
+
+		if (fscanf(old, "resume %lld %x", &size, &crc) == 2 && size == fileSize && crc == fileCrc) {
+			long long offset;
+			int len;
+
+			while (fscanf(old, "%lld %d %x", &offset, &len, &crc) == 3) {
+				chunks = (resumeChunkRec *)realloc(chunks, sizeof(*chunks) * (count + 1));
+				chunks[count].offset = offset;
+				chunks[count].len = len;
+				chunks[count].crc = crc;
+				count++;
+			}
+			f = fopen(file, "r+b");
+		} else {
+			printf("<resume> : %s is for another file, starting again\n", rl->path);
+		}
+		fclose(old);
+	}
+
+	if (f != NULL) {
+		// the verified prefix, every chunk re-read from disk
+		int kept = 0, partial;
+
+		qsort(chunks, count, sizeof(*chunks), chunkOrder);
+		for (int i = 0; i < count; i++) {
+			if (chunks[i].offset > *start) break;
+			if (chunks[i].offset + chunks[i].len <= *start) continue;
+			if (rangeCrc(f, chunks[i].offset, chunks[i].len, &partial) != chunks[i].crc || partial) break;
+			*start = chunks[i].offset + chunks[i].len;
+			chunks[kept++] = chunks[i];
+		}
+		count = kept;
+		printf("<resume> : %s has %lld of %lld bytes, resuming\n", file, (long long)*start, (long long)fileSize);
+	} else {
+		count = 0;
+		f = fopen(file, "w+b");
+	}
+
+	if (f != NULL) {
+		// rewrite the manifest with only what was kept
+		rl->log = fopen(rl->path, "w");
+		if (rl->log != NULL) {
+			fprintf(rl->log, "resume %lld %08x\n", (long long)fileSize, fileCrc);
+			for (int i = 0; i < count; i++) {
+				fprintf(rl->log, "%lld %d %08x\n", (long long)chunks[i].offset, chunks[i].len, chunks[i].crc);
+			}
+			fflush(rl->log);
+		}
+	}
+	free(chunks);
+	return(f);
+}
+
+// one verified frame, flushed at once so it survives the program dying
+void resumeChunk(resumeLog *rl, int64_t offset, int len, uint32_t crc){
+	if (rl->log == NULL) return;
+	fprintf(rl->log, "%lld %d %08x\n", (long long)offset, len, crc);
+	fflush(rl->log);
+}
+
+/*
+Ends the transfer.  A complete file is checked against the sender's whole
+file crc and the manifest removed; a broken one keeps its manifest for the
+next try.  returns 0 when the file is whole and correct.
+*/
+int resumeFinish(resumeLog *rl, FILE *f, int ok){
+	int partial;
+
+	if (rl->log != NULL) fclose(rl->log);
+	rl->log = NULL;
+
+	if (!ok) {
+		printf("<resume> : transfer broken off, %s kept for the next try\n", rl->path);
+		return(-1);
+	}
+
+	fflush(f);
+	if (ftruncate(fileno(f), (off_t)rl->fileSize) < 0 ||
+			rangeCrc(f, 0, rl->fileSize, &partial) != rl->fileCrc || partial) {
+		// a manifest that led to a bad file is no use, start clean next time
+		printf("<resume> : whole file crc does not match, discarding %s\n", rl->path);
+		unlink(rl->path);
+		return(-1);
+	}
+	unlink(rl->path);
+	return(0);
+}
@@ -0,0 +1,37 @@
+/*
+Resumable transfers.
+
+While a file is received a sidecar manifest, <file>.resume, records the
+offset, length and crc32 of every frame that has been verified and written.
+If the transfer breaks off the manifest stays; the next transfer of the
+same file (same size and whole file crc32, carried in the header) checks
+the recorded chunks against what is on disk and starts after the last one
+that still matches, so only the missing part crosses the link.
+
+	f = resumeOpen(&rl, "pony.jpg", size, fileCrc, &start);
+	opt.start = start;
+	opt.resume = &rl;
+	ok = windowRecv(sp, f, size, &opt, &stats) == 0;
+	resumeFinish(&rl, f, ok);	// drops the manifest once the crc matches
+*/
+
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct resumeLog {
+	FILE *log;		// the manifest, appended as frames verify
+	char path[300];
+	int64_t fileSize;
+	uint32_t fileCrc;	// crc32 of the whole source file
+} resumeLog;
+
+uint32_t resumeFileCrc(FILE *f, int64_t size);
+
+FILE *resumeOpen(resumeLog *rl, const char *file, int64_t fileSize, uint32_t fileCrc, int64_t *start);
+void resumeChunk(resumeLog *rl, int64_t offset, int len, uint32_t crc);
+int resumeFinish(resumeLog *rl, FILE *f, int ok);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+Frame slot rings, see ring.h
+
+The producer only ever writes tail and the consumer only head, each
+published with release ordering after the slot itself is written, so the
+other side sees a complete slot.  The eventfds are doorbells: a waiter
+empties its eventfd before looking at the ring again, so a slot published
+in between leaves it readable and the wait returns at once.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+static void ringBell(int fd){
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0) return;
+}
+
+// waits for the doorbell, returns 0 on timeout
+static int ringWait(int fd, int timeoutMs){
+	struct pollfd pfd = {fd, POLLIN, 0};
+	uint64_t count;
+
+	if (poll(&pfd, 1, timeoutMs) <= 0) return(0);
+	if (read(fd, &count, sizeof(count)) < 0) return(1);
+	return(1);
+}
+
+static void ringQuiet(int fd){
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0) return;
+}
+
+/*
+'slots' is rounded up to a power of two, each with 'bytes' of buffer.
+The ring can be handed to ringFree even when this fails.
+*/
+int ringInit(frameRing *r, int slots, int bytes){
+	uint32_t size = 2;
+
+	while (size < (uint32_t)slots) size *= 2;
+	r->size = size;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->ended, 0);
+	atomic_init(&r->cancelled, 0);
+	r->filled = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	r->freed = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	r->slot = (frameSlot *)calloc(size, sizeof(frameSlot));
+	if (r->slot == NULL || r->filled < 0 || r->freed < 0) return(-1);
+	for (uint32_t i = 0; i < size; i++) {
+		r->slot[i].buf = (unsigned char *)malloc(bytes);
+		if (r->slot[i].buf == NULL) return(-1);
+	}
+	return(0);
+}
+
+void ringFree(frameRing *r){
+	if (r->slot != NULL) {
+		for (uint32_t i = 0; i < r->size; i++) free(r->slot[i].buf);
+	}
+	free(r->slot);
+	r->slot = NULL;
+	if (r->filled >= 0) close(r->filled);
+	if (r->freed >= 0) close(r->freed);
+	r->filled = r->freed = -1;
+}
+
+/*
+The producer's next empty slot, waiting up to timeoutMs (-1 for ever) for
+the consumer to free one.  NULL on timeout or once the consumer cancels.
+*/
+frameSlot *ringSpace(frameRing *r, int timeoutMs){
+	while (1) {
+		uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+		ringQuiet(r->freed);
+		if (atomic_load_explicit(&r->cancelled, memory_order_acquire)) return(NULL);
+		if (tail - atomic_load_explicit(&r->head, memory_order_acquire) < r->size) {
+			return(&r->slot[tail & (r->size - 1)]);
+		}
+		if (!ringWait(r->freed, timeoutMs)) return(NULL);
+	}
+}
+
+/*
+For a producer reading a pipe or terminal: waits until fd has input, or
+hangs up, or the consumer cancels.  returns 1 for input, 0 once cancelled.
+*/
+int ringWaitInput(frameRing *r, int fd){
+	while (1) {
+		struct pollfd pfd[2] = {{fd, POLLIN, 0}, {r->freed, POLLIN, 0}};
+
+		ringQuiet(r->freed);
+		if (atomic_load_explicit(&r->cancelled, memory_order_acquire)) return(0);
+		if (poll(pfd, 2, -1) < 0 && errno != EINTR) return(1);
+		if (pfd[0].revents) return(1);
+	}
+}
+
+void ringPublish(frameRing *r){
+	atomic_fetch_add_explicit(&r->tail, 1, memory_order_release);
+	ringBell(r->filled);
+}
+
+void ringEnd(frameRing *r){
+	atomic_store_explicit(&r->ended, 1, memory_order_release);
+	ringBell(r->filled);
+}
+
+/*
+The consumer's next filled slot, waiting up to timeoutMs (-1 for ever,
+0 not at all).  NULL on timeout, or when the producer has ended and every
+slot has been taken.
+*/
+frameSlot *ringPeek(frameRing *r, int timeoutMs){
+	while (1) {
+		uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+		int ended;
+
+		ringQuiet(r->filled);
+		ended = atomic_load_explicit(&r->ended, memory_order_acquire);
+		if (atomic_load_explicit(&r->tail, memory_order_acquire) != head) {
+			return(&r->slot[head & (r->size - 1)]);
+		}
+		if (ended || !ringWait(r->filled, timeoutMs)) return(NULL);
+	}
+}
+
+void ringRelease(frameRing *r){
+	atomic_fetch_add_explicit(&r->head, 1, memory_order_release);
+	ringBell(r->freed);
+}
+
+void ringCancel(frameRing *r){
+	atomic_store_explicit(&r->cancelled, 1, memory_order_release);
+	ringBell(r->freed);
+}
+
+// the producer has ended and every slot it published has been taken
+int ringDrained(frameRing *r){
+	if (!atomic_load_explicit(&r->ended, memory_order_acquire)) return(0);
+	return(atomic_load_explicit(&r->tail, memory_order_acquire) == atomic_load_explicit(&r->head, memory_order_relaxed));
+}
@@ -0,0 +1,58 @@
+/*
+Single producer, single consumer rings of frame slots.
+
+Each stage of a transfer pipeline runs on its own thread and hands finished
+frames to the next over one of these.  The slots are preallocated and the
+head and tail are atomics, so passing a frame takes no lock and no copy;
+only a stage that finds its ring empty (or full) sleeps, on an eventfd the
+other side rings after every slot, which an epoll loop can wait on along
+with the serial port.
+
+	producer			consumer
+	s = ringSpace(&r, -1);		s = ringPeek(&r, -1);
+	... fill s			... use s
+	ringPublish(&r);		ringRelease(&r);
+	ringEnd(&r);			(NULL once ended and empty)
+*/
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef struct frameSlot {
+	unsigned char *buf;
+	int len;		// bytes used in buf
+	int plain;		// file bytes the slot stands for
+	int body;		// payload bytes as framed, before parity and stuffing
+	int flags;
+	uint32_t seq;
+	int64_t offset;
+} frameSlot;
+
+typedef struct frameRing {
+	frameSlot *slot;
+	uint32_t size;		// a power of two
+	_Atomic uint32_t head;	// next slot the consumer takes
+	_Atomic uint32_t tail;	// next slot the producer fills
+	_Atomic int ended;	// producer is done, what is queued is all
+	_Atomic int cancelled;	// consumer gave up, the producer should stop
+	int filled;		// eventfd, rung when a slot is published
+	int freed;		// eventfd, rung when a slot is released
+} frameRing;
+
+int ringInit(frameRing *r, int slots, int bytes);
+void ringFree(frameRing *r);
+
+frameSlot *ringSpace(frameRing *r, int timeoutMs);
+int ringWaitInput(frameRing *r, int fd);
+void ringPublish(frameRing *r);
+void ringEnd(frameRing *r);
+
+frameSlot *ringPeek(frameRing *r, int timeoutMs);
+void ringRelease(frameRing *r);
+void ringCancel(frameRing *r);
+int ringDrained(frameRing *r);
+
+#endif
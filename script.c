@@ -0,0 +1,156 @@
+/*
+Scripted runs, see script.h
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "host.h"
+#include "pacing.h"
+#include "script.h"
+#include "verify.h"
+
+// adds one command, without its line end; blank lines and # comments are left out
+void scriptAdd(scriptQueue *q, const char *line){
+	scriptCommand *c;
+	int len = (int)strcspn(line, "\r\n");
+
+	while (len > 0 && line[len - 1] == ' ') len--;
+	while (len > 0 && *line == ' ') {
+		line++;
+		len--;
+	}
+	if (len == 0 || line[0] == '#') return;
+	if (len > BATCH_LINE_MAX - 2) len = BATCH_LINE_MAX - 2;
+
+	q->cmds = (scriptCommand *)realloc(q->cmds, sizeof(scriptCommand) * (q->count + 1));
+	c = &q->cmds[q->count++];
+	memcpy(c->line, line, len);
+	c->line[len] = '\0';
+	c->status = SCRIPT_PENDING;
+	c->us = 0;
+}
+
+// reads a script file, - for stdin; returns the commands added or -1
+int scriptLoad(scriptQueue *q, const char *path){
+	FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	char line[BATCH_LINE_MAX];
+	int before = q->count;
+
+	if (f == NULL) {
+		printf("<local><script> : can not open %s\n", path);
+		return(-1);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) scriptAdd(q, line);
+	if (f != stdin) fclose(f);
+	return(q->count - before);
+}
+
+void scriptFree(scriptQueue *q){
+	free(q->cmds);
+	q->cmds = NULL;
+	q->count = 0;
+}
+
+/*
+The setup a command can do before the link is free: crc the local regular
+files it will send or check, so sendFile and verifyFiles find them in
+verify.c's memo, and they are in the page cache besides.
+*/
+static void *prepareThread(void *arg){
+	char line[BATCH_LINE_MAX];
+	char *args[64];
+	batchList bl = {0};
+	char *save = NULL;
+	int nargs = 0;
+
+	// strtok_r, the console side may be in a strtok loop of its own
+	snprintf(line, sizeof(line), "%s", (const char *)arg);
+	for (char *tok = strtok_r(line, " ", &save); tok != NULL && nargs < 64; tok = strtok_r(NULL, " ", &save)) {
+		args[nargs++] = tok;
+	}
+	if (nargs < 2) return(NULL);
+
+	if (!strcasecmp(args[0], "HTOA")) {
+		batchAdd(&bl, args[1]);
+	} else if (!strcasecmp(args[0], "VERIFY") || !strcasecmp(args[0], "MHTOA")) {
+		for (int i = 1; i < nargs; i++) batchAdd(&bl, args[i]);
+	}
+	for (int i = 0; i < bl.count; i++) {
+		struct stat st;
+		int64_t size;
+		uint32_t crc;
+
+		// reading a fifo here would take its data from the transfer, - is stdin
+		if (!strcmp(bl.names[i], "-") || stat(bl.names[i], &st) < 0 || !S_ISREG(st.st_mode)) continue;
+		verifyFileCrc(bl.names[i], &size, &crc);
+	}
+	batchFree(&bl);
+	return(NULL);
+}
+
+static const char *statusName(scriptStatus s){
+	switch (s) {
+	case SCRIPT_DONE: return("done");
+	case SCRIPT_FAILED: return("FAILED");
+	case SCRIPT_SKIPPED: return("skipped");
+	default: return("pending");
+	}
+}
+
+/*
+Runs the queue on the session's device and prints the summary.  returns the
+exit status, see script.h.
+*/
+int scriptRun(scriptQueue *q, hostSession *hs){
+	int done = 0, failed = 0, skipped = 0, quit = 0;
+	int64_t startUs = pacerClockUs();
+
+	for (int i = 0; i < q->count; i++) {
+		scriptCommand *c = &q->cmds[i];
+		unsigned char line[BATCH_LINE_MAX + 2];
+		pthread_t prep;
+		int preparing = 0;
+		int64_t t0;
+
+		if (quit || (failed > 0 && !q->keepGoing)) {
+			c->status = SCRIPT_SKIPPED;
+			skipped++;
+			continue;
+		}
+
+		// the next command's files are read while this one has the link
+		if (i + 1 < q->count) preparing = pthread_create(&prep, NULL, prepareThread, q->cmds[i + 1].line) == 0;
+
+		printf("<local><script> : %s\n", c->line);
+		snprintf((char *)line, sizeof(line), "%s\n", c->line);
+		hs->transferFailed = 0;
+		t0 = pacerClockUs();
+		quit = runCommand(hs, line);
+		c->us = pacerClockUs() - t0;
+		c->status = hs->transferFailed ? SCRIPT_FAILED : SCRIPT_DONE;
+		if (hs->transferFailed) failed++;
+		else done++;
+
+		if (preparing) pthread_join(prep, NULL);
+	}
+	if (!quit) {
+		unsigned char bye[] = "QUIT\n";
+
+		runCommand(hs, bye);
+	}
+
+	printf("<local><script> :  #  status     seconds  command\n");
+	for (int i = 0; i < q->count; i++) {
+		printf("<local><script> : %2d  %-8s %9.2f  %s\n", i + 1, statusName(q->cmds[i].status),
+				q->cmds[i].us / 1e6, q->cmds[i].line);
+	}
+	printf("<local><script> : %d done, %d failed, %d skipped in %.2f s\n",
+			done, failed, skipped, (pacerClockUs() - startUs) / 1e6);
+	return(failed > 0 ? SCRIPT_EXIT_FAILED : SCRIPT_EXIT_OK);
+}
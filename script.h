@@ -0,0 +1,55 @@
+/*
+Unattended runs: console commands from the command line or a script file
+instead of the keyboard.
+
+	HostSeriaPport_v4_crc32 /dev/ttyS5 921600 -c "HTOA a.jpg" -c "VERIFY a.jpg"
+	HostSeriaPport_v4_crc32 /dev/ttyS5 921600 -script nightly.txt [-k]
+
+A script has one command per line, blank lines and lines starting with #
+are skipped, - reads it from stdin.  The commands run in order with no
+prompts; while one is on the link the next one's local files are crced
+ahead (verify.h remembers the result), so its header goes out as soon as
+the link is free.  The first command that fails stops the run unless -k
+was given.  At the end a table gives each command's status and time, and
+the program exits with SCRIPT_EXIT_OK when every command worked,
+SCRIPT_EXIT_FAILED when one did not, SCRIPT_EXIT_USAGE when the script
+could not be read or the device could not be reached.
+*/
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdint.h>
+
+#include "host.h"
+#include "protocol.h"
+
+#define SCRIPT_EXIT_OK 0
+#define SCRIPT_EXIT_FAILED 1
+#define SCRIPT_EXIT_USAGE 2
+
+typedef enum scriptStatus {
+	SCRIPT_PENDING = 0,
+	SCRIPT_DONE,
+	SCRIPT_FAILED,
+	SCRIPT_SKIPPED
+} scriptStatus;
+
+typedef struct scriptCommand {
+	char line[BATCH_LINE_MAX];
+	scriptStatus status;
+	int64_t us;		// from sending the command to the device's EOT
+} scriptCommand;
+
+typedef struct scriptQueue {
+	int count;
+	scriptCommand *cmds;
+	int keepGoing;		// run the rest after a failure, -k
+} scriptQueue;
+
+void scriptAdd(scriptQueue *q, const char *line);
+int scriptLoad(scriptQueue *q, const char *path);
+int scriptRun(scriptQueue *q, hostSession *hs);
+void scriptFree(scriptQueue *q);
+
+#endif
@@ -0,0 +1,189 @@
+/*
+Buffered serial port reader, see serialio.h
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serialio.h"
+
+#define RING_MASK (SERIAL_RING_SIZE - 1)
+
+int64_t serialNowMs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// what is left until deadline, for a timeout; 0 once it has passed
+int serialMsLeft(int64_t deadline){
+	int64_t left = deadline - serialNowMs();
+
+	return(left > 0 ? (int)left : 0);
+}
+
+void serialInit(serialPort *sp, int fd){
+	int flags;
+
+	sp->fd = fd;
+	sp->head = 0;
+	sp->tail = 0;
+	sp->readCalls = 0;
+	sp->bytesIn = 0;
+	sp->bytesOut = 0;
+
+	// all waiting is done in poll(), reads just take what is there
+	flags = fcntl(fd, F_GETFL);
+	if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int serialAvailable(const serialPort *sp){
+	return((int)(sp->tail - sp->head));
+}
+
+/*
+Waits until the deadline for more input and reads as much as fits in the
+ring.  returns bytes added, 0 on timeout, -1 on error or hangup.
+*/
+static int serialFill(serialPort *sp, int64_t deadline){
+	while (1) {
+		struct pollfd pfd = {sp->fd, POLLIN, 0};
+		int64_t left = deadline - serialNowMs();
+		uint32_t space = SERIAL_RING_SIZE - (sp->tail - sp->head);
+		uint32_t chunk = SERIAL_RING_SIZE - (sp->tail & RING_MASK);
+		int n;
+
+		if (space == 0) return(0);
+		if (chunk > space) chunk = space;
+
+		// try first, the data is often already there
+		n = read(sp->fd, sp->ring + (sp->tail & RING_MASK), chunk);
+		if (n > 0) {
+			sp->tail += n;
+			sp->readCalls++;
+			sp->bytesIn += n;
+			return(n);
+		}
+		if (n < 0 && errno != EAGAIN && errno != EINTR) return(-1);
+
+		if (left <= 0) return(0);
+		n = poll(&pfd, 1, (int)left);
+		if (n < 0 && errno != EINTR) return(-1);
+		if (n > 0 && (pfd.revents & (POLLERR | POLLNVAL))) return(-1);
+		if (n > 0 && (pfd.revents & POLLHUP) && !(pfd.revents & POLLIN)) return(-1);
+	}
+}
+
+static void serialTake(serialPort *sp, unsigned char *dst, int len){
+	uint32_t at = sp->head & RING_MASK;
+	uint32_t first = SERIAL_RING_SIZE - at;
+
+	if (first > (uint32_t)len) first = len;
+	memcpy(dst, sp->ring + at, first);
+	memcpy(dst + first, sp->ring, len - first);
+	sp->head += len;
+}
+
+// returns len, or fewer bytes if the timeout ran out first
+int serialReadExact(serialPort *sp, void *buf, int len, int timeoutMs){
+	unsigned char *p = (unsigned char *)buf;
+	int64_t deadline = serialNowMs() + timeoutMs;
+	int got = 0;
+
+	while (got < len) {
+		int have = serialAvailable(sp);
+
+		if (have == 0) {
+			if (serialFill(sp, deadline) <= 0) break;
+			continue;
+		}
+		if (have > len - got) have = len - got;
+		serialTake(sp, p + got, have);
+		got += have;
+	}
+	return(got);
+}
+
+/*
+reads up to and including delim, or maxLen bytes without it; returns the
+count, or 0 if neither came in time.  Bytes of a line or frame still
+arriving are left in the ring then, so the next call gets it whole.
+maxLen is cut to the ring's size: a full ring with no delim in it comes
+back as it is, for the caller to throw away, rather than waiting on a
+fill that has no room.
+*/
+int serialReadUntil(serialPort *sp, void *buf, int maxLen, unsigned char delim, int timeoutMs){
+	int64_t deadline = serialNowMs() + timeoutMs;
+	uint32_t seen = 0;
+
+	if (maxLen > SERIAL_RING_SIZE) maxLen = SERIAL_RING_SIZE;
+
+	while (1) {
+		while (sp->tail - sp->head > seen) {
+			if (sp->ring[(sp->head + seen++) & RING_MASK] == delim || seen == (uint32_t)maxLen) {
+				serialTake(sp, (unsigned char *)buf, (int)seen);
+				return((int)seen);
+			}
+		}
+		if (serialFill(sp, deadline) <= 0) return(0);
+	}
+}
+
+// returns the next byte, or -1 on timeout
+int serialReadByte(serialPort *sp, int timeoutMs){
+	unsigned char ch;
+
+	if (sp->head != sp->tail) {
+		ch = sp->ring[sp->head & RING_MASK];
+		sp->head++;
+		return(ch);
+	}
+	if (serialReadExact(sp, &ch, 1, timeoutMs) < 1) return(-1);
+	return(ch);
+}
+
+// throws input away up to and including ch, returns 1 if it was seen
+int serialWaitFor(serialPort *sp, unsigned char ch, int timeoutMs){
+	int64_t deadline = serialNowMs() + timeoutMs;
+
+	while (1) {
+		while (sp->head != sp->tail) {
+			if (sp->ring[sp->head++ & RING_MASK] == ch) return(1);
+		}
+		if (serialFill(sp, deadline) <= 0) return(0);
+	}
+}
+
+void serialFlushInput(serialPort *sp){
+	tcflush(sp->fd, TCIFLUSH);
+	sp->head = sp->tail;
+}
+
+int serialWrite(serialPort *sp, const void *buf, int len){
+	const unsigned char *p = (const unsigned char *)buf;
+	int done = 0;
+
+	while (done < len) {
+		int n = write(sp->fd, p + done, len - done);
+
+		if (n > 0) {
+			done += n;
+			continue;
+		}
+		if (n < 0 && errno == EAGAIN) {
+			// output queue is full, wait for the uart to drain some
+			struct pollfd pfd = {sp->fd, POLLOUT, 0};
+			poll(&pfd, 1, 1000);
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		return(-1);
+	}
+	sp->bytesOut += done;
+	return(done);
+}
@@ -0,0 +1,45 @@
+/*
+Buffered serial port reader.
+
+Input is pulled from the port in large chunks into a ring buffer and handed
+out from there, so reading a frame costs one or two read() calls instead of
+one per byte.  Every read takes a timeout in milliseconds and waits in
+poll(), never spinning on the port's VTIME.
+
+	serialPort port;
+	serialInit(&port, fd);
+	if (serialReadExact(&port, buf, 64, 2000) < 64) ... timed out
+*/
+
+#ifndef SERIALIO_H
+#define SERIALIO_H
+
+#include <stdint.h>
+
+#define SERIAL_RING_SIZE (64 * 1024)	// power of two
+
+typedef struct serialPort {
+	int fd;
+	unsigned char ring[SERIAL_RING_SIZE];
+	uint32_t head;		// next byte to hand out
+	uint32_t tail;		// next free byte, head == tail when empty
+	int64_t readCalls;	// read() syscalls that returned data
+	int64_t bytesIn;
+	int64_t bytesOut;
+} serialPort;
+
+int64_t serialNowMs(void);
+int serialMsLeft(int64_t deadline);
+
+void serialInit(serialPort *sp, int fd);
+int serialAvailable(const serialPort *sp);
+
+int serialReadExact(serialPort *sp, void *buf, int len, int timeoutMs);
+int serialReadUntil(serialPort *sp, void *buf, int maxLen, unsigned char delim, int timeoutMs);
+int serialReadByte(serialPort *sp, int timeoutMs);
+int serialWaitFor(serialPort *sp, unsigned char ch, int timeoutMs);
+void serialFlushInput(serialPort *sp);
+
+int serialWrite(serialPort *sp, const void *buf, int len);
+
+#endif
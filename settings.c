@@ -1,25 +1,191 @@
+/*
+Port and line speed settings, see settings.h
+
+This file uses the kernel's termios2 interface and so must not include
+<termios.h>, the two define the same names.
+*/
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
 
-int main(int argc, char **argv)
+#include "settings.h"
+
+int settingsParse(int argc, char **argv, linkSettings *ls)
 {
-	printf("eerialport v4 crc32\n");
-	char *portname;
-	int speed;
-	if (argc == 1){
-		printf("eerialport using defaults /dev/ttyS5 speed 57600\n");
-        *portname = '/dev/ttyS5';
-		    speed = 57600;	
-	) else if (argc == 3) {
-		*portname = argv[1];
-			speed = atoi(argv[2]);;	
-	} else {
-		printf("error unknown input\n");
+	int positional = 0;
+
+	printf("serialport v4 crc32\n");
+
+	ls->portname = DEFAULT_PORT;
+	ls->baud = DEFAULT_BAUD;
+	ls->probeMax = 0;
+	ls->sim = 0;
+	ls->bench = 0;
+	ls->latencyMs = 0;
+	ls->v4 = 0;
+	ls->cardDir = DEFAULT_CARD_DIR;
+	ls->links = 1;
+	ls->metricsFile = NULL;
+	ls->progress = 0;
+	ls->fec = 0;
+	ls->bitErrors = 0.0;
+	ls->dropRate = 0.0;
+	ls->dupRate = 0.0;
+	ls->commandCount = 0;
+	ls->script = NULL;
+	ls->keepGoing = 0;
+	ls->daemonSocket = NULL;
+	ls->jobSocket = NULL;
+	ls->deviceCount = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-probe")) {
+			ls->probeMax = DEFAULT_PROBE_MAX;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0) ls->probeMax = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-sim")) {
+			ls->sim = 1;
+		} else if (!strcmp(argv[i], "-bench")) {
+			ls->sim = 1;
+			ls->bench = 1;
+		} else if (!strcmp(argv[i], "-latency") && i + 1 < argc) {
+			ls->latencyMs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-v4")) {
+			ls->v4 = 1;
+		} else if (!strcmp(argv[i], "-card") && i + 1 < argc) {
+			ls->cardDir = argv[++i];
+		} else if (!strcmp(argv[i], "-links") && i + 1 < argc) {
+			ls->links = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-metrics") && i + 1 < argc) {
+			ls->metricsFile = argv[++i];
+		} else if (!strcmp(argv[i], "-progress")) {
+			ls->progress = 1;
+		} else if (!strcmp(argv[i], "-fec")) {
+			ls->fec = 1;
+		} else if (!strcmp(argv[i], "-faults") && i + 1 < argc) {
+			// ber[,drop[,dup]]
+			if (sscanf(argv[++i], "%lf,%lf,%lf", &ls->bitErrors, &ls->dropRate, &ls->dupRate) < 1) {
+				printf("error -faults takes ber[,drop[,dup]]\n");
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+			if (ls->commandCount == SETTINGS_COMMANDS_MAX) {
+				printf("error more than %d -c commands, use -script\n", SETTINGS_COMMANDS_MAX);
+				return -1;
+			}
+			ls->commands[ls->commandCount++] = argv[++i];
+		} else if (!strcmp(argv[i], "-script") && i + 1 < argc) {
+			ls->script = argv[++i];
+		} else if (!strcmp(argv[i], "-k")) {
+			ls->keepGoing = 1;
+		} else if (!strcmp(argv[i], "-daemon") && i + 1 < argc) {
+			ls->daemonSocket = argv[++i];
+		} else if (!strcmp(argv[i], "-job") && i + 1 < argc) {
+			ls->jobSocket = argv[++i];
+		} else if (!strcmp(argv[i], "-device") && i + 1 < argc) {
+			if (ls->deviceCount == SETTINGS_DEVICES_MAX) {
+				printf("error more than %d -device\n", SETTINGS_DEVICES_MAX);
+				return -1;
+			}
+			ls->devices[ls->deviceCount++] = argv[++i];
+		} else if (positional == 0) {
+			ls->portname = argv[i];
+			positional++;
+		} else if (positional == 1) {
+			ls->baud = atoi(argv[i]);
+			positional++;
+		} else {
+			printf("error unknown input %s\n", argv[i]);
+			return -1;
+		}
+	}
+
+	if (ls->baud <= 0) {
+		printf("error bad baud rate\n");
 		return -1;
 	}
-	
-	printf("Opening port %s baud %d \n", portname, speed);
 
+	if (ls->sim) {
+		// there is no port to name, a lone number is the line speed
+		if (positional == 1 && atoi(ls->portname) > 0) ls->baud = atoi(ls->portname);
+		if (ls->links < 1 || ls->links > LINKS_MAX) {
+			printf("error -links takes 1 to %d\n", LINKS_MAX);
+			return -1;
+		}
+		printf("Simulated device in %s baud %d latency %d ms%s, %d link%s\n",
+				ls->cardDir, ls->baud, ls->latencyMs, ls->v4 ? " v4 firmware" : "",
+				ls->links, ls->links > 1 ? "s" : "");
+		if (ls->bitErrors > 0 || ls->dropRate > 0 || ls->dupRate > 0) {
+			printf("Line faults in transfers: bit errors %g, bytes dropped %g, doubled %g\n",
+					ls->bitErrors, ls->dropRate, ls->dupRate);
+		}
+		return 0;
+	}
+
+	if (ls->daemonSocket != NULL || ls->jobSocket != NULL) return 0;
+
+	if (settingsPorts(ls, ls->portname) < 0) return -1;
+
+	if (positional == 0) printf("serialport using defaults %s speed %d\n", ls->portname, ls->baud);
+	for (int i = 0; i < ls->links; i++) printf("Opening port %s baud %d \n", ls->ports[i], ls->portBaud[i]);
+
+	return 0;
+}
+
+// port[:baud],port[:baud] ... into ports and portBaud, the first is the command link
+int settingsPorts(linkSettings *ls, const char *spec)
+{
+	char *save = NULL;
+
+	ls->links = 0;
+	for (char *name = strtok_r(strdup(spec), ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+		char *rate = strchr(name, ':');
+
+		if (ls->links == LINKS_MAX) {
+			printf("error more than %d ports\n", LINKS_MAX);
+			return -1;
+		}
+		if (rate != NULL) *rate++ = '\0';
+		ls->ports[ls->links] = name;
+		ls->portBaud[ls->links] = rate != NULL ? atoi(rate) : ls->baud;
+		if (ls->portBaud[ls->links] <= 0) {
+			printf("error bad baud rate for %s\n", name);
+			return -1;
+		}
+		ls->links++;
+	}
+	if (ls->links == 0) {
+		printf("error no port named\n");
+		return -1;
+	}
+	ls->portname = ls->ports[0];
+	ls->baud = ls->portBaud[0];
+	return 0;
+}
+
+// sets both directions to exactly 'baud', standard rate or not
+int settingsSetBaud(int fd, int baud)
+{
+	struct termios2 tio;
+
+	if (ioctl(fd, TCGETS2, &tio) < 0) {
+		printf("Error from TCGETS2: %s\n", strerror(errno));
+		return -1;
+	}
+
+	tio.c_cflag &= ~CBAUD;
+	tio.c_cflag |= BOTHER;
+	tio.c_cflag &= ~(CBAUD << IBSHIFT);
+	tio.c_cflag |= BOTHER << IBSHIFT;
+	tio.c_ospeed = baud;
+	tio.c_ispeed = baud;
+
+	if (ioctl(fd, TCSETS2, &tio) < 0) {
+		printf("Error from TCSETS2 at %d baud: %s\n", baud, strerror(errno));
+		return -1;
+	}
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,86 @@
+/*
+Port and line speed settings.
+
+	HostSeriaPport_v4_crc32 [port[:baud][,port[:baud]...]] [baud] [-probe [maxBaud]]
+		[-sim | -bench] [-links n] [-latency ms] [-v4] [-card dir] [-faults ber[,drop[,dup]]]
+		[-metrics file] [-progress] [-fec] [-c command]... [-script file] [-k]
+	HostSeriaPport_v4_crc32 -daemon socket -device port[:baud][,port...]... [baud] [-sim ...]
+	HostSeriaPport_v4_crc32 -job socket -c "device command"...
+
+With no arguments the program uses /dev/ttyS5 at 115200.  Any baud rate
+the uart can generate may be given, not just the standard Bxxx ones; it is
+set through termios2 / BOTHER.  -probe steps the rate up towards maxBaud
+(default 2000000) while the link stays clean, see probeLink().
+
+Several ports, separated by commas, are links to the same device that
+transfers are striped across (stripe.h), the first one carries the
+commands.  Each is set up on its own, at its own :baud if one is given.
+
+-sim talks to the device simulator (devsim.h) instead of a port, with the
+line throttled to baud and -latency ms added each way; -v4 makes it act as
+v4 firmware and -card names the directory standing in for the SD card.
+-bench runs the transfer benchmark (bench.c) against the simulator.
+-links gives the simulated device that many links.  -faults has the
+simulated line flip bits, drop and double bytes while window transfers run,
+at the given rates per bit, byte and byte, e.g. -faults 1e-5,1e-6,1e-6.
+
+-metrics adds a record of every transfer to file, JSON lines or CSV, and
+-progress shows a progress line while one runs, see metrics.h.
+
+-c runs a console command, as many as are given in order, and -script
+runs a file of them; either way the program exits when they are done, -k
+keeps going past a failed one, see script.h.
+
+-fec offers Reed-Solomon parity on window frames (fec.h) so a noisy line
+repairs most damaged frames instead of resending them.
+
+-daemon serves every -device, each given like the ports above, with jobs
+taken from a unix socket; -job sends the -c lines to a running daemon,
+see daemon.h.
+*/
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "protocol.h"
+
+#define DEFAULT_PORT "/dev/ttyS5"
+#define DEFAULT_BAUD 115200
+#define DEFAULT_PROBE_MAX 2000000
+#define DEFAULT_CARD_DIR "simcard"
+#define SETTINGS_COMMANDS_MAX 64
+#define SETTINGS_DEVICES_MAX 32
+
+typedef struct linkSettings {
+	const char *portname;	// the command link, ports[0]
+	int baud;
+	int links;		// serial links to the device
+	char *ports[LINKS_MAX];
+	int portBaud[LINKS_MAX];
+	int probeMax;		// 0 unless -probe was given
+	int sim;		// run against the device simulator
+	int bench;		// run the benchmark, implies sim
+	int latencyMs;		// simulated one way line delay
+	int v4;			// simulate v4 firmware
+	const char *cardDir;	// simulated SD card
+	const char *metricsFile;	// transfer records, or NULL
+	int progress;		// show a progress line during transfers
+	int fec;		// offer frame parity to the device
+	double bitErrors;	// -faults for the simulated line, per bit
+	double dropRate;	// and per byte
+	double dupRate;
+	const char *commands[SETTINGS_COMMANDS_MAX];	// -c, run unattended
+	int commandCount;
+	const char *script;	// -script file, or NULL
+	int keepGoing;		// -k
+	const char *daemonSocket;	// -daemon control socket, or NULL
+	const char *jobSocket;		// -job, send the commands to a daemon
+	const char *devices[SETTINGS_DEVICES_MAX];	// -device port lists, or names with -sim
+	int deviceCount;
+} linkSettings;
+
+int settingsParse(int argc, char **argv, linkSettings *ls);
+int settingsPorts(linkSettings *ls, const char *spec);
+int settingsSetBaud(int fd, int baud);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+Striped transfers, see stripe.h
+
+Link 0 runs in the calling thread, every other link gets a thread of its
+own for the length of the transfer.  The window engine keeps all its state
+in the windowOptions / windowStats and serialPort it is handed, and the
+receiver writes with pwrite, so the links share nothing but the file.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "fileio.h"
+#include "protocol.h"
+#include "stripe.h"
+
+typedef struct stripeJob {
+	serialPort *sp;
+	FILE *file;
+	int64_t end;		// the slice is opt.start .. end
+	int sending;
+	windowOptions opt;
+	windowStats stats;
+	int rc;
+} stripeJob;
+
+static void *stripeWorker(void *arg){
+	stripeJob *job = (stripeJob *)arg;
+
+	if (job->sending) job->rc = windowSend(job->sp, job->file, job->end, &job->opt, &job->stats);
+	else job->rc = windowRecv(job->sp, job->file, job->end, &job->opt, &job->stats);
+	return(NULL);
+}
+
+// runs every job at once, returns -1 if any slice failed
+static int stripeRun(stripeJob *jobs, int count, windowStats *stats){
+	pthread_t tid[LINKS_MAX];
+	int started[LINKS_MAX] = {0};
+	int rc = 0;
+
+	for (int i = 0; i < count; i++) {
+		memset(&jobs[i].stats, 0, sizeof(jobs[i].stats));
+		jobs[i].stats.pace = stats->pace;
+	}
+	// one progress line, for the first slice
+	jobs[0].stats.metrics.progress = stats->metrics.progress;
+	for (int i = 1; i < count; i++) {
+		started[i] = pthread_create(&tid[i], NULL, stripeWorker, &jobs[i]) == 0;
+		if (!started[i]) jobs[i].rc = -1;
+	}
+	stripeWorker(&jobs[0]);
+	for (int i = 1; i < count; i++) {
+		if (started[i]) pthread_join(tid[i], NULL);
+	}
+
+	stats->pace = jobs[0].stats.pace;
+	for (int i = 0; i < count; i++) {
+		const windowStats *ws = &jobs[i].stats;
+
+		if (jobs[i].rc < 0) {
+			printf("<local><stripe> : link %d failed on bytes %ld .. %ld\n",
+					i, (long)jobs[i].opt.start, (long)jobs[i].end);
+			rc = -1;
+		}
+		stats->frames += ws->frames;
+		stats->resent += ws->resent;
+		stats->naks += ws->naks;
+		stats->timeouts += ws->timeouts;
+		stats->wireBytes += ws->wireBytes;
+		stats->plainBytes += ws->plainBytes;
+		stats->packedBytes += ws->packedBytes;
+		stats->zeroBytes += ws->zeroBytes;
+		stats->corrected += ws->corrected;
+		stats->resized += ws->resized;
+		if (ws->payload) stats->payload = ws->payload;
+		metricsMerge(&stats->metrics, &ws->metrics);
+	}
+	return(rc);
+}
+
+// links worth using for a file of 'size' bytes
+int stripeCount(int64_t size, int links){
+	int64_t most = size / STRIPE_MIN_BYTES;
+
+	if (links > LINKS_MAX) links = LINKS_MAX;
+	if (most < links) links = (int)most;
+	return(links > 1 ? links : 1);
+}
+
+/*
+Sends 'size' bytes of the file at 'path' over the first 'count' links,
+each opening the file for itself.  returns 0 when every slice is across.
+*/
+int stripeSend(serialPort **link, int count, const char *path, int64_t size, const windowOptions *opt, windowStats *stats){
+	stripeJob jobs[LINKS_MAX];
+	int payload = windowPayload(opt);
+	int rc = 0;
+
+	if (count < 1 || count > LINKS_MAX) return(-1);
+	for (int i = 0; i < count; i++) {
+		// slices start on a frame boundary so only the last frame of the file is short
+		int64_t from = size * i / count / payload * payload;
+		int64_t to = i == count - 1 ? size : size * (i + 1) / count / payload * payload;
+		stripe st;
+
+		st.index = i;
+		st.count = count;
+		st.offset = (int32_t)from;
+		st.length = (int32_t)(to - from);
+		st.crcCheck = crc32Compute((unsigned char *)&st, sizeof(st) - 4);
+		serialWrite(link[i], &st, sizeof(st));
+
+		jobs[i].sp = link[i];
+		jobs[i].file = fopen(path, "rb");
+		jobs[i].end = to;
+		jobs[i].sending = 1;
+		jobs[i].opt = *opt;
+		jobs[i].opt.start = from;
+		jobs[i].rc = 0;
+		if (jobs[i].file == NULL) rc = -1;
+	}
+
+	if (rc == 0) rc = stripeRun(jobs, count, stats);
+	else printf("<local><stripe> : can not open %s\n", path);
+
+	for (int i = 0; i < count; i++) {
+		if (jobs[i].file) fclose(jobs[i].file);
+	}
+	return(rc);
+}
+
+/*
+Receives a striped file of 'size' bytes into dst, on as many of the
+'links' as the sender's stripe records name.  returns 0 when every slice
+has arrived.
+*/
+int stripeRecv(serialPort **link, int links, FILE *dst, int64_t size, const windowOptions *opt, windowStats *stats){
+	stripeJob jobs[LINKS_MAX];
+	stripe slice[LINKS_MAX];
+	int count = 1;
+
+	memset(slice, 0, sizeof(slice));
+	for (int i = 0; i < count; i++) {
+		stripe st;
+
+		if (serialReadExact(link[i], &st, sizeof(st), STRIPE_TIMEOUT_MS) < (int)sizeof(st) ||
+				st.crcCheck != crc32Compute((unsigned char *)&st, sizeof(st) - 4)) {
+			printf("<local><stripe> : no stripe record on link %d\n", i);
+			return(-1);
+		}
+		if (i == 0) count = st.count;
+		if (st.count != count || count < 1 || count > links || count > LINKS_MAX ||
+				st.index < 0 || st.index >= count || slice[st.index].count != 0) {
+			printf("<local><stripe> : bad stripe record on link %d\n", i);
+			return(-1);
+		}
+		slice[st.index] = st;
+
+		jobs[i].sp = link[i];
+		jobs[i].file = dst;
+		jobs[i].sending = 0;
+		jobs[i].opt = *opt;
+		jobs[i].opt.start = st.offset;
+		jobs[i].opt.resume = NULL;
+		jobs[i].end = (int64_t)st.offset + st.length;
+		jobs[i].rc = 0;
+	}
+
+	// the slices must cover the file end to end
+	for (int i = 0; i < count; i++) {
+		int64_t from = i == 0 ? 0 : (int64_t)slice[i - 1].offset + slice[i - 1].length;
+
+		if (slice[i].offset != from || slice[i].length < 0 ||
+				(i == count - 1 && (int64_t)slice[i].offset + slice[i].length != size)) {
+			printf("<local><stripe> : stripes do not cover the file\n");
+			return(-1);
+		}
+	}
+
+	filePrealloc(dst, size);
+	return(stripeRun(jobs, count, stats));
+}
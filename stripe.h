@@ -0,0 +1,32 @@
+/*
+Striped transfers: one file over several serial links at once.
+
+The file is cut into one contiguous slice per link (stripe in protocol.h)
+and every slice goes as its own sliding window transfer, with its own
+crcs, acks and resends, on a thread of its own.  The receiver writes each
+frame at its file offset, so the slices need no joining afterwards.
+
+	n = stripeCount(size, links);		// 1: not worth striping
+	stripeSend(link, n, path, size, &opt, &stats);
+	...
+	stripeRecv(link, links, dst, size, &opt, &stats);
+*/
+
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "serialio.h"
+#include "window.h"
+
+#define STRIPE_MIN_BYTES (64 * 1024)	// smallest slice worth a link of its own
+#define STRIPE_TIMEOUT_MS 2000
+
+int stripeCount(int64_t size, int links);
+
+int stripeSend(serialPort **link, int count, const char *path, int64_t size, const windowOptions *opt, windowStats *stats);
+int stripeRecv(serialPort **link, int links, FILE *dst, int64_t size, const windowOptions *opt, windowStats *stats);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+Parallel whole file crcs, see verify.h
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "fileio.h"
+#include "resume.h"
+#include "verify.h"
+
+// a file's crc, good while the file keeps its size and mtime
+typedef struct verifyMemo {
+	dev_t dev;
+	ino_t ino;
+	int64_t size;
+	int64_t mtimeNs;
+	uint32_t crc;
+} verifyMemo;
+
+static verifyMemo memo[VERIFY_MEMO];
+static int memoNext = 0;
+static pthread_mutex_t memoLock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct verifySlice {
+	const unsigned char *p;
+	int64_t len;
+	uint32_t crc;
+} verifySlice;
+
+static void *sliceThread(void *arg){
+	verifySlice *vs = (verifySlice *)arg;
+
+	vs->crc = crc32Compute(vs->p, (size_t)vs->len);
+	return(NULL);
+}
+
+// crc32Compute of len bytes, split over as many threads as the cpus and the size allow
+uint32_t verifyCrc(const unsigned char *p, int64_t len){
+	verifySlice slice[VERIFY_THREADS];
+	pthread_t tid[VERIFY_THREADS];
+	int started[VERIFY_THREADS];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = (int)(len / VERIFY_SLICE_MIN);
+	int64_t each;
+	uint32_t crc;
+
+	if (threads > VERIFY_THREADS) threads = VERIFY_THREADS;
+	if (cpus > 0 && threads > cpus) threads = (int)cpus;
+	if (threads < 2) return(crc32Compute(p, (size_t)len));
+
+	each = len / threads;
+	for (int i = 0; i < threads; i++) {
+		slice[i].p = p + i * each;
+		slice[i].len = i < threads - 1 ? each : len - i * each;
+	}
+	// the first slice is done here, this thread would only wait otherwise
+	for (int i = 1; i < threads; i++) {
+		started[i] = pthread_create(&tid[i], NULL, sliceThread, &slice[i]) == 0;
+		if (!started[i]) sliceThread(&slice[i]);
+	}
+	sliceThread(&slice[0]);
+
+	crc = slice[0].crc;
+	for (int i = 1; i < threads; i++) {
+		if (started[i]) pthread_join(tid[i], NULL);
+		crc = crc32Combine(crc, slice[i].crc, slice[i].len);
+	}
+	return(crc);
+}
+
+static int memoFind(const struct stat *st, int64_t size, uint32_t *crc){
+	int found = 0;
+
+	pthread_mutex_lock(&memoLock);
+	for (int i = 0; i < VERIFY_MEMO && !found; i++) {
+		verifyMemo *m = &memo[i];
+
+		if (m->size == size && m->dev == st->st_dev && m->ino == st->st_ino &&
+				m->mtimeNs == (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec) {
+			*crc = m->crc;
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock(&memoLock);
+	return(found);
+}
+
+static void memoAdd(const struct stat *st, int64_t size, uint32_t crc){
+	pthread_mutex_lock(&memoLock);
+	memo[memoNext].dev = st->st_dev;
+	memo[memoNext].ino = st->st_ino;
+	memo[memoNext].size = size;
+	memo[memoNext].mtimeNs = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+	memo[memoNext].crc = crc;
+	memoNext = (memoNext + 1) % VERIFY_MEMO;
+	pthread_mutex_unlock(&memoLock);
+}
+
+/*
+crc32 of the first 'size' bytes of an open file, mapped if it can be and
+read through stdio if not, or remembered from the last time this file was
+asked for.  Files are known by inode, size and mtime, so a file changed
+since is read again.  The stdio position is left at the start.
+*/
+uint32_t verifyCrcOf(FILE *f, int64_t size){
+	const unsigned char *p;
+	struct stat st;
+	fileMap map;
+	uint32_t crc;
+	int known = fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size == size;
+
+	if (known && memoFind(&st, size, &crc)) {
+		rewind(f);
+		return(crc);
+	}
+
+	p = fileMapOpen(&map, f, size);
+	if (p != NULL) {
+		crc = verifyCrc(p, size);
+		fileMapClose(&map);
+		rewind(f);
+	} else {
+		crc = resumeFileCrc(f, size);
+	}
+	if (known) memoAdd(&st, size, crc);
+	return(crc);
+}
+
+// size and crc32 of the file at 'path', returns -1 if it can not be opened
+int verifyFileCrc(const char *path, int64_t *size, uint32_t *crc){
+	FILE *f = fopen(path, "rb");
+
+	if (f == NULL) return(-1);
+	fseek(f, 0L, SEEK_END);
+	*size = ftell(f);
+	rewind(f);
+	*crc = verifyCrcOf(f, *size);
+	fclose(f);
+	return(0);
+}
@@ -0,0 +1,31 @@
+/*
+Whole file digests for VERIFY, see digest in protocol.h.
+
+The card reports the crc32 of each file it holds and the host compares it
+with its own copy, so checking a directory costs a few bytes per file on
+the wire instead of pulling every file back with ATOH.  The host side maps
+the file and crcs it in slices on up to VERIFY_THREADS threads, the slices
+joined with crc32Combine, so the local half is over long before the card
+has read its copy.  The last VERIFY_MEMO files' crcs are remembered, so a
+file crced ahead of time (see script.h) or checked twice is read once.
+
+	int64_t size;
+	uint32_t crc;
+	if (verifyFileCrc("pony.jpg", &size, &crc) == 0) ...
+*/
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define VERIFY_THREADS 8
+#define VERIFY_SLICE_MIN (1 << 20)	// smaller files are not worth a thread
+#define VERIFY_MEMO 32
+
+uint32_t verifyCrc(const unsigned char *p, int64_t len);
+uint32_t verifyCrcOf(FILE *f, int64_t size);
+int verifyFileCrc(const char *path, int64_t *size, uint32_t *crc);
+
+#endif
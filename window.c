@@ -0,0 +1,909 @@
+/*
+Sliding window transfer engine, see window.h and protocol.h
+
+Both ends run as a pipeline of threads joined by the rings of ring.h, so
+the disk, the checksums and the link all work at once.  The sender's disk
+stage reads the file (from a mapping when it can), its checksum stage packs
+and frames, and the link keeps a copy of every frame in flight so resends
+never go back through the stages.  The receiver checks frames on the link
+and hands them to a disk stage that writes each in place at its offset in a
+preallocated file, so frames arriving out of order need no reassembly.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adapt.h"
+#include "cobs.h"
+#include "crc32.h"
+#include "fec.h"
+#include "fileio.h"
+#include "pack.h"
+#include "pacing.h"
+#include "protocol.h"
+#include "ring.h"
+#include "serialio.h"
+#include "window.h"
+
+#define PIPE_SLOTS 8	// frames each stage may run ahead of the next
+#define SPARSE_BLOCK 512	// zeros shorter than this stay in the data frames
+
+_Static_assert(sizeof(wframe) == 16, "frameRead crcs the header with crc32Update16");
+
+// the longest frame before and after stuffing
+#define FRAME_RAW_MAX (WF_OVERHEAD + 0xffff + FEC_FRAME_EXTRA(0xffff))
+#define FRAME_WIRE_MAX (FRAME_RAW_MAX + COBS_EXTRA(FRAME_RAW_MAX))
+
+typedef struct wslot {
+	unsigned char *buf;	// complete frame as written to the link
+	int len;
+	int acked;
+	int retries;
+	int plain;		// file bytes it carries
+	int zero;		// a zero extent, says nothing about frame sizes
+	int64_t sentAt;
+	int64_t firstUs;	// first sent, for the round trip
+} wslot;
+
+// bytes on the wire for a frame of len payload bytes, at most
+static int frameWireSize(int len, int fec, int cobs){
+	int raw = WF_OVERHEAD + len + (fec ? FEC_FRAME_EXTRA(len) : 0);
+
+	return(raw + (cobs ? COBS_EXTRA(raw) : 0));
+}
+
+/*
+Builds a frame in buf, which needs frameWireSize() bytes, and returns its
+length on the wire.  With fec the header is followed by its parity and the
+payload and crc by theirs, see HDR_FLAG_FEC in protocol.h; with cobs the
+whole is stuffed and ends in COBS_DELIM, see HDR_FLAG_COBS.  crc time goes
+to m if not NULL.
+*/
+static int frameBuild(unsigned char *out, uint8_t type, uint8_t flags, uint32_t seq, uint64_t offset,
+		const unsigned char *payload, int len, metrics *m, int fec, int cobs){
+	int raw = WF_OVERHEAD + len + (fec ? FEC_FRAME_EXTRA(len) : 0);
+	// stuffed frames are built a little way in and encoded forward over themselves
+	unsigned char *buf = cobs ? out + COBS_EXTRA(raw) : out;
+	wframe hdr;
+	uint32_t crc;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.type = type;
+	hdr.flags = flags;
+	hdr.len = (uint16_t)len;
+	hdr.seq = seq;
+	hdr.offset = offset;
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	if (len > 0) memcpy(buf + sizeof(hdr), payload, len);
+
+	crc = m ? metricsCrc(m, buf, sizeof(hdr) + len) : crc32Compute(buf, sizeof(hdr) + len);
+	memcpy(buf + sizeof(hdr) + len, &crc, 4);
+
+	if (fec) {
+		memmove(buf + sizeof(hdr) + FEC_PARITY, buf + sizeof(hdr), len + 4);
+		fecEncode(buf, sizeof(hdr), buf + sizeof(hdr));
+		fecEncode(buf + sizeof(hdr) + FEC_PARITY, len + 4, buf + sizeof(hdr) + FEC_PARITY + len + 4);
+	}
+	if (!cobs) return(raw);
+
+	raw = cobsEncode(buf, raw, out);
+	out[raw++] = COBS_DELIM;
+	return(raw);
+}
+
+static int sendControl(serialPort *sp, uint8_t type, uint8_t flags, uint32_t seq, uint64_t bitmap,
+		const windowOptions *opt, windowStats *stats){
+	unsigned char buf[WF_OVERHEAD + FEC_FRAME_EXTRA(0) + COBS_EXTRA(WF_OVERHEAD + FEC_FRAME_EXTRA(0))];
+	int len = frameBuild(buf, type, flags, seq, bitmap, NULL, 0, &stats->metrics, opt->fec, opt->cobs);
+
+	stats->wireBytes += len;
+	return(serialWrite(sp, buf, len));
+}
+
+/*
+A stuffed frame: everything up to the next COBS_DELIM, decoded in place and
+split into hdr, payload with its crc, and parity.  returns 1, 0 on timeout
+or -1 for anything wrong with it; the frame after starts at the delimiter
+whatever happened to this one, so nothing is flushed.  A delimiter on its
+own is skipped.  timeoutMs is for the whole frame.
+*/
+static int frameReadCobs(serialPort *sp, wframe *hdr, unsigned char *payload, unsigned char *parity,
+		int maxPayload, int timeoutMs, const windowOptions *opt, int *fixed){
+	unsigned char wire[FRAME_WIRE_MAX];
+	int64_t deadline = serialNowMs() + timeoutMs;
+	int headLen = sizeof(wframe) + (opt->fec ? FEC_PARITY : 0);
+	int n;
+
+	do {
+		n = serialReadUntil(sp, wire, sizeof(wire), COBS_DELIM, serialMsLeft(deadline));
+		if (n == 0) return(0);
+	} while (n == 1);
+	if (wire[n - 1] != COBS_DELIM) return(-1);
+
+	n = cobsDecode(wire, n - 1, wire);
+	if (n < headLen) return(-1);
+	if (opt->fec) *fixed = fecDecode(wire, sizeof(wframe), wire + sizeof(wframe));
+	memcpy(hdr, wire, sizeof(*hdr));
+	if (*fixed < 0 || hdr->type < WF_DATA || hdr->type > WF_IDLE || hdr->len > maxPayload ||
+			n != headLen + hdr->len + 4 + (opt->fec ? fecParitySize(hdr->len + 4) : 0)) return(-1);
+
+	memcpy(payload, wire + headLen, hdr->len + 4);
+	if (opt->fec) memcpy(parity, wire + headLen + hdr->len + 4, n - headLen - hdr->len - 4);
+	return(1);
+}
+
+/*
+Reads one frame into hdr and payload, which takes the crc too and so needs
+room for maxPayload + 4 bytes.  returns 1 for a good frame, 0 on timeout,
+-1 for a frame whose crc failed (the stream is still in step) and -2 for
+garbage, after which pending input is thrown away so the next frame starts
+clean.  timeoutMs is for the whole frame, not for each read.  Stuffed frames (opt->cobs) are never garbage, a damaged one is -1.
+With opt->fec damage is repaired first where it can be, and frames saved
+that way are counted in stats->corrected.
+*/
+static int frameRead(serialPort *sp, wframe *hdr, unsigned char *payload, int maxPayload, int timeoutMs,
+		const windowOptions *opt, windowStats *stats){
+	unsigned char head[sizeof(wframe) + FEC_PARITY];
+	unsigned char parity[FEC_FRAME_EXTRA(0xffff)];
+	int headLen = sizeof(wframe) + (opt->fec ? FEC_PARITY : 0);
+	int64_t deadline = serialNowMs() + timeoutMs;
+	int64_t crcStart;
+	int got, fixed = 0;
+	uint32_t crc;
+
+	if (opt->cobs) {
+		got = frameReadCobs(sp, hdr, payload, parity, maxPayload, timeoutMs, opt, &fixed);
+		if (got <= 0) return(got);
+	} else {
+		got = serialReadExact(sp, head, headLen, timeoutMs);
+		if (got == 0) return(0);
+		if (got == headLen && opt->fec) fixed = fecDecode(head, sizeof(wframe), head + sizeof(wframe));
+		memcpy(hdr, head, sizeof(*hdr));
+		if (got < headLen || fixed < 0 || hdr->type < WF_DATA || hdr->type > WF_IDLE ||
+				hdr->len > maxPayload) {
+			serialFlushInput(sp);
+			return(-2);
+		}
+
+		if (serialReadExact(sp, payload, hdr->len + 4, serialMsLeft(deadline)) < hdr->len + 4) {
+			serialFlushInput(sp);
+			return(-2);
+		}
+		if (opt->fec) {
+			int n = fecParitySize(hdr->len + 4);
+
+			if (serialReadExact(sp, parity, n, serialMsLeft(deadline)) < n) {
+				serialFlushInput(sp);
+				return(-2);
+			}
+		}
+	}
+	if (opt->fec) {
+		// what can not be repaired is left to the crc
+		int n = fecDecode(payload, hdr->len + 4, parity);
+		if (n > 0) fixed += n;
+	}
+
+	crcStart = pacerClockUs();
+	crc = crc32Update16(CRC32_START, hdr);
+	crc = crc32Update(crc, payload, hdr->len);
+	stats->metrics.crcUs += pacerClockUs() - crcStart;
+	stats->metrics.crcBytes += sizeof(*hdr) + hdr->len;
+
+	if (memcmp(&crc, payload + hdr->len, 4) != 0) return(-1);
+	if (fixed > 0) stats->corrected++;
+	return(1);
+}
+
+void windowDefaults(windowOptions *opt, int frameSize, int window, int baud){
+	int64_t flightMs;
+
+	if (window < 1) window = 1;
+	if (window > WINDOW_MAX) window = WINDOW_MAX;
+	if (frameSize < WF_OVERHEAD + 1) frameSize = WF_OVERHEAD + 1;
+	if (frameSize > WF_OVERHEAD + 0xffff) frameSize = WF_OVERHEAD + 0xffff;
+
+	opt->frameSize = frameSize;
+	opt->window = window;
+
+	// a whole window on the wire plus slack for the device to answer
+	flightMs = (int64_t)window * frameSize * 10 * 1000 / (baud > 0 ? baud : 115200);
+	opt->timeoutMs = (int)(2 * flightMs + WINDOW_SLACK_MS);
+	opt->retryLimit = 10;
+	opt->start = 0;
+	opt->resume = NULL;
+	opt->pack = 0;
+	opt->fec = 0;
+	opt->cobs = 0;
+	opt->stream = 0;
+	opt->adapt = 0;
+	opt->sparse = 0;
+}
+
+// frames are counted as they go and the FIN says how many bytes they carried
+static int framesOpen(const windowOptions *opt){
+	return(opt->stream || opt->adapt || opt->sparse);
+}
+
+int windowPayload(const windowOptions *opt){
+	return(opt->frameSize - WF_OVERHEAD);
+}
+
+// the session wide features agreed in CAPS, HDR_FLAG_xxx, every transfer uses alike
+void windowOptionsFromLink(windowOptions *opt, uint32_t features){
+	opt->fec = (features & HDR_FLAG_FEC) != 0;
+	opt->cobs = (features & HDR_FLAG_COBS) != 0;
+	opt->adapt = (features & HDR_FLAG_ADAPT) != 0;
+	opt->sparse = (features & HDR_FLAG_SPARSE) != 0;
+}
+
+/*
+Sender stages.  The disk stage reads file bytes into one ring, the checksum
+stage packs and frames them into the next, and windowSend only writes
+finished frames to the link and minds the acks.  Each stage stops when its
+input ends or its output is cancelled, passing the news along.
+*/
+typedef struct sendPipe {
+	FILE *src;
+	const unsigned char *mapped;	// or NULL, read with fread
+	int64_t start;
+	int64_t fileSize;
+	int64_t numFrames;
+	int payload;		// the most a frame can carry, the slots' size
+	_Atomic int chunk;	// what the next frame is cut to, see adapt.h
+	int pack;
+	int fec;
+	int cobs;
+	int stream;		// read src until it ends, numFrames is not known
+	int sparse;		// find holes and zero runs, see zeroRun
+	int64_t dataAt;		// the data run around the disk stage, see fileNextData
+	int64_t holeAt;
+	int readFailed;		// set before the disk ring is ended
+	unsigned char *packed;
+	unsigned char *held;	// a stream's bytes read behind a run of zeros
+	frameRing disk;		// file bytes, disk stage to checksum stage
+	frameRing wire;		// finished frames, checksum stage to the link
+	metrics crc;		// the checksum stage's crc time
+	pthread_t diskTid;
+	pthread_t crcTid;
+	int diskUp;
+	int crcUp;
+} sendPipe;
+
+/*
+Zero bytes from offset on that are worth an extent: the rest of a hole and
+whole SPARSE_BLOCKs of zeros after it, up to SPARSE_EXTENT_MAX.  0 when
+that is less than a block, unless the zeros end the file.  Holes are found
+with fileNextData and never read.
+*/
+static int64_t zeroRun(sendPipe *pp, int64_t offset){
+	int64_t end = pp->fileSize, at = offset;
+
+	if (end - offset > SPARSE_EXTENT_MAX) end = offset + SPARSE_EXTENT_MAX;
+	while (at < end) {
+		int64_t scan, n;
+
+		if (at >= pp->holeAt) pp->dataAt = fileNextData(pp->src, at, &pp->holeAt);
+		if (pp->dataAt > at) {
+			at = pp->dataAt < end ? pp->dataAt : end;
+			continue;
+		}
+		scan = (pp->holeAt < end ? pp->holeAt : end) - at;
+		n = fileZeroSpan(pp->mapped + at, scan);
+		if (n < scan) {
+			at += n / SPARSE_BLOCK * SPARSE_BLOCK;
+			break;
+		}
+		at += n;
+	}
+	return(at - offset >= SPARSE_BLOCK || at == pp->fileSize ? at - offset : 0);
+}
+
+// a data frame from offset ends where a hole or a block of zeros starts
+static int dataRun(sendPipe *pp, int64_t offset, int len){
+	if (pp->holeAt - offset < len) len = (int)(pp->holeAt - offset);
+	for (int k = SPARSE_BLOCK; k + SPARSE_BLOCK <= len; k += SPARSE_BLOCK) {
+		if (fileZeroSpan(pp->mapped + offset + k, SPARSE_BLOCK) == SPARSE_BLOCK) return(k);
+	}
+	return(len);
+}
+
+/*
+A stream is read with read() rather than fread, so a frame goes as soon as
+the pipe has anything for it instead of waiting for a whole payload.  Each
+read waits in poll() first, so a cancelled transfer gets the stage out of a
+pipe that has gone quiet.  With sparse, reads that come back all zeros, and
+holes when the stream is a file, add up to one extent that goes ahead of
+the next bytes that are not.
+*/
+static void streamStage(sendPipe *pp){
+	int fd = fileno(pp->src);
+	int64_t offset = 0, zeros = 0;
+	uint32_t f = 0;
+
+	while (1) {
+		frameSlot *s = ringSpace(&pp->disk, -1);
+		int64_t at = offset + zeros, hole = 0;
+		ssize_t len = 0;
+		int zero;
+
+		if (s == NULL) return;
+		if (pp->sparse) {
+			if (at >= pp->holeAt) pp->dataAt = fileNextData(pp->src, at, &pp->holeAt);
+			if (pp->dataAt > at) {
+				hole = pp->dataAt - at < SPARSE_EXTENT_MAX ? pp->dataAt - at : SPARSE_EXTENT_MAX;
+				if (lseek(fd, at + hole, SEEK_SET) < 0) hole = 0;
+			}
+		}
+		if (hole == 0) {
+			// a quiet pipe must not keep the stage from seeing the transfer fail
+			if (!ringWaitInput(&pp->disk, fd)) return;
+			do len = read(fd, s->buf, atomic_load(&pp->chunk));
+			while (len < 0 && errno == EINTR);
+			if (len < 0) {
+				printf("<local><windowSend> : read error at byte %ld\n", (long)at);
+				pp->readFailed = 1;
+				break;
+			}
+		}
+		zero = hole > 0 || (pp->sparse && len > 0 && fileZeroSpan(s->buf, len) == len);
+		if (zero && zeros + hole + len <= SPARSE_EXTENT_MAX) {
+			zeros += hole + len;
+			continue;
+		}
+
+		// the run ends: it goes in this slot, the bytes read after it in the next
+		if (zeros > 0) {
+			if (len > 0) memcpy(pp->held, s->buf, len);
+			s->flags = WFF_ZERO;
+			s->plain = (int)zeros;
+			s->seq = f++;
+			s->offset = offset;
+			offset += zeros;
+			zeros = zero ? hole + len : 0;
+			ringPublish(&pp->disk);
+			if (zero || len == 0) continue;
+			if ((s = ringSpace(&pp->disk, -1)) == NULL) return;
+			memcpy(s->buf, pp->held, len);
+		}
+		if (len == 0) break;
+		s->flags = 0;
+		s->plain = (int)len;
+		s->seq = f++;
+		s->offset = offset;
+		offset += len;
+		ringPublish(&pp->disk);
+	}
+}
+
+static void *diskStage(void *arg){
+	sendPipe *pp = (sendPipe *)arg;
+
+	if (pp->stream) {
+		streamStage(pp);
+		ringEnd(&pp->disk);
+		return(NULL);
+	}
+	for (int64_t f = 0, offset = pp->start; f < pp->numFrames && offset < pp->fileSize; f++) {
+		frameSlot *s = ringSpace(&pp->disk, -1);
+		int len = atomic_load(&pp->chunk);
+		int64_t zeros = 0;
+
+		// cancelled, the checksum stage still has to hear the ring ended
+		if (s == NULL) break;
+		if (len > pp->fileSize - offset) len = (int)(pp->fileSize - offset);
+		// holes and zero runs only in a mapping, anything else is read through
+		if (pp->sparse && pp->mapped != NULL && (zeros = zeroRun(pp, offset)) == 0) len = dataRun(pp, offset, len);
+		if (zeros > 0) {
+			len = (int)zeros;
+		} else if (pp->mapped != NULL) {
+			memcpy(s->buf, pp->mapped + offset, len);
+		} else if (fread(s->buf, len, 1, pp->src) != 1) {
+			printf("<local><windowSend> : read error at frame %ld\n", (long)f);
+			pp->readFailed = 1;
+			break;
+		}
+		s->flags = zeros > 0 ? WFF_ZERO : 0;
+		s->plain = len;
+		s->seq = (uint32_t)f;
+		s->offset = offset;
+		offset += len;
+		ringPublish(&pp->disk);
+	}
+	ringEnd(&pp->disk);
+	return(NULL);
+}
+
+static void *checksumStage(void *arg){
+	sendPipe *pp = (sendPipe *)arg;
+	frameSlot *in;
+
+	while ((in = ringPeek(&pp->disk, -1)) != NULL) {
+		frameSlot *out = ringSpace(&pp->wire, -1);
+		const unsigned char *body = in->buf;
+		int bodyLen = in->plain, flags = 0;
+		uint64_t span = (uint64_t)in->plain;
+
+		if (out == NULL) {
+			ringCancel(&pp->disk);
+			return(NULL);
+		}
+
+		// an extent is just its length, data is packed only when it comes out smaller
+		if (in->flags & WFF_ZERO) {
+			body = (const unsigned char *)&span;
+			bodyLen = sizeof(span);
+			flags = WFF_ZERO;
+		} else if (pp->pack) {
+			int n = packFrame(in->buf, in->plain, pp->packed, in->plain);
+			if (n > 0) {
+				body = pp->packed;
+				bodyLen = n;
+				flags = WFF_PACKED;
+			}
+		}
+		out->len = frameBuild(out->buf, WF_DATA, flags, in->seq, (uint64_t)in->offset, body, bodyLen, &pp->crc, pp->fec, pp->cobs);
+		out->plain = in->plain;
+		out->body = bodyLen;
+		out->flags = in->flags;
+		out->seq = in->seq;
+		ringRelease(&pp->disk);
+		ringPublish(&pp->wire);
+	}
+	ringEnd(&pp->wire);
+	return(NULL);
+}
+
+static int pipeStart(sendPipe *pp){
+	int rc = ringInit(&pp->disk, PIPE_SLOTS, pp->payload);
+
+	if (ringInit(&pp->wire, PIPE_SLOTS, frameWireSize(pp->payload, pp->fec, pp->cobs)) < 0) rc = -1;
+	pp->packed = (unsigned char *)malloc(pp->payload);
+	if (pp->stream && pp->sparse) pp->held = (unsigned char *)malloc(pp->payload);
+	if (rc < 0 || pp->packed == NULL || (pp->stream && pp->sparse && pp->held == NULL)) return(-1);
+	pp->diskUp = pthread_create(&pp->diskTid, NULL, diskStage, pp) == 0;
+	pp->crcUp = pp->diskUp && pthread_create(&pp->crcTid, NULL, checksumStage, pp) == 0;
+	return(pp->crcUp ? 0 : -1);
+}
+
+static void pipeStop(sendPipe *pp){
+	ringCancel(&pp->wire);
+	ringCancel(&pp->disk);
+	if (pp->crcUp) pthread_join(pp->crcTid, NULL);
+	if (pp->diskUp) pthread_join(pp->diskTid, NULL);
+	ringFree(&pp->wire);
+	ringFree(&pp->disk);
+	free(pp->packed);
+	free(pp->held);
+}
+
+/*
+A frame is acknowledged, its round trip only counts if it was sent once.
+With adapt the line's error rate is updated and the stages told when the
+frames should change size.
+*/
+static void frameAcked(wslot *s, windowStats *stats, int64_t nowUs, frameAdapt *adapt, sendPipe *pp){
+	if (s->acked) return;
+	s->acked = 1;
+	metricsFrame(&stats->metrics, s->retries, s->retries == 0 ? nowUs - s->firstUs : -1);
+	if (adapt != NULL && !s->zero && adaptSent(adapt, s->len, s->retries)) {
+		atomic_store(&pp->chunk, adapt->payload);
+		stats->resized++;
+		stats->payload = adapt->payload;
+	}
+}
+
+int windowSend(serialPort *sp, FILE *src, int64_t fileSize, const windowOptions *opt, windowStats *stats){
+	int payload = windowPayload(opt);
+	int window = opt->window;
+	int64_t numFrames, start = opt->start;
+	int64_t base = 0, next = 0, acked = 0;
+	int timeoutMs = opt->timeoutMs, guardMs = timeoutMs / 4;
+	int wire = frameWireSize(payload, opt->fec, opt->cobs);
+	unsigned char *frames, ackBuf[4];
+	fileMap map;
+	sendPipe pp;
+	wslot *slots;
+	wframe ack;
+	frameAdapt adapt;
+	int rc, tries, piped = 0, result = -1;
+
+	// pipes and the like can not be mapped and are read with fread
+	memset(&pp, 0, sizeof(pp));
+	if (opt->stream) fileSize = -1;
+	pp.mapped = fileMapOpen(&map, src, fileSize);
+
+	frames = (unsigned char *)malloc((size_t)window * wire);
+	slots = (wslot *)calloc(window, sizeof(wslot));
+	if (frames == NULL || slots == NULL) goto done;
+	for (int i = 0; i < window; i++) slots[i].buf = frames + (size_t)i * wire;
+
+	// the receiver opens with an ack of frame 0 once it is ready
+	int64_t waitStart = pacerClockUs();
+	for (tries = 0; ; tries++) {
+		rc = frameRead(sp, &ack, ackBuf, 0, opt->timeoutMs, opt, stats);
+		if (rc == 1 && ack.type == WF_ACK) break;
+		stats->timeouts++;
+		if (tries == opt->retryLimit) {
+			printf("<local><windowSend> : receiver never became ready\n");
+			goto done;
+		}
+	}
+	pacerAccount(&stats->pace, PACE_READY, waitStart);
+
+	// a resuming receiver says where it wants the file from
+	if ((ack.flags & WFF_RESUME) && (int64_t)ack.offset <= fileSize) start = (int64_t)ack.offset;
+	stats->start = start;
+	if (!opt->stream && pp.mapped == NULL && fseek(src, (long)start, SEEK_SET) != 0) goto done;
+	// a stream's frames, or frames of changing size or span, are counted once the stages end
+	numFrames = framesOpen(opt) ? INT64_MAX : (fileSize - start + payload - 1) / payload;
+	adaptInit(&adapt, payload, frameWireSize(0, opt->fec, opt->cobs));
+	stats->payload = payload;
+
+	pp.src = src;
+	pp.start = start;
+	pp.fileSize = fileSize;
+	pp.numFrames = numFrames;
+	pp.payload = payload;
+	atomic_init(&pp.chunk, payload);
+	pp.pack = opt->pack;
+	pp.fec = opt->fec;
+	pp.cobs = opt->cobs;
+	pp.stream = opt->stream;
+	pp.sparse = opt->sparse;
+	piped = 1;
+	if (pipeStart(&pp) < 0) {
+		printf("<local><windowSend> : can not start the disk and checksum stages\n");
+		goto done;
+	}
+
+	while (base < numFrames) {
+		int64_t now;
+		int64_t oldest;
+		int waitMs, biggest;
+
+		// keep the window full with whatever the stages have ready
+		while (next < numFrames && next < base + window) {
+			wslot *s = &slots[next % window];
+			frameSlot *f;
+
+			// only an empty window waits for the stages, a stream's no longer than a timeout
+			waitStart = pacerClockUs();
+			f = ringPeek(&pp.wire, next > base ? 0 : opt->stream ? opt->timeoutMs : -1);
+			if (next == base) pacerAccount(&stats->pace, PACE_PIPE, waitStart);
+			if (f == NULL) {
+				if (next > base) break;
+				if (opt->stream && !ringDrained(&pp.wire)) {
+					// the pipe is quiet, the receiver must not take us for gone
+					sendControl(sp, WF_IDLE, 0, (uint32_t)next, 0, opt, stats);
+					continue;
+				}
+				if (framesOpen(opt) && !pp.readFailed) {
+					numFrames = next;
+					break;
+				}
+				printf("<local><windowSend> : no frame %ld from the disk stage\n", (long)next);
+				goto done;
+			}
+
+			// only a couple of frames queued in the kernel, so resends go out promptly
+			pacerQueueBelow(&stats->pace, sp, 2 * opt->frameSize);
+
+			memcpy(s->buf, f->buf, f->len);
+			s->len = f->len;
+			s->plain = f->plain;
+			s->zero = (f->flags & WFF_ZERO) != 0;
+			stats->plainBytes += f->plain;
+			if (s->zero) stats->zeroBytes += f->plain;
+			else stats->packedBytes += f->body;
+			ringRelease(&pp.wire);
+
+			s->acked = 0;
+			s->retries = 0;
+			s->sentAt = serialNowMs();
+			s->firstUs = pacerClockUs();
+			if (serialWrite(sp, s->buf, s->len) < 0) goto done;
+			stats->frames++;
+			stats->wireBytes += s->len;
+			next++;
+		}
+		// a stream that ended with every frame acknowledged
+		if (base == numFrames) break;
+
+		// wait for an ack no longer than the oldest frame has left to live
+		now = serialNowMs();
+		oldest = now;
+		biggest = 0;
+		for (int64_t f = base; f < next; f++) {
+			if (!slots[f % window].acked && slots[f % window].sentAt < oldest) oldest = slots[f % window].sentAt;
+			if (slots[f % window].len > biggest) biggest = slots[f % window].len;
+		}
+		// smaller frames in flight are answered sooner, and a lost one is resent sooner
+		if (opt->adapt && opt->timeoutMs > WINDOW_SLACK_MS) {
+			timeoutMs = WINDOW_SLACK_MS + (int)((int64_t)(opt->timeoutMs - WINDOW_SLACK_MS) * biggest / wire);
+			guardMs = timeoutMs / 4;
+		}
+		waitMs = (int)(oldest + timeoutMs - now) + 1;
+		waitStart = pacerClockUs();
+
+		// with room in the window a frame from the stages ends the wait too
+		if (next < numFrames && next < base + window && serialAvailable(sp) == 0) {
+			struct pollfd pfd[2] = {{sp->fd, POLLIN, 0}, {pp.wire.filled, POLLIN, 0}};
+			int n = poll(pfd, 2, waitMs);
+
+			if (n > 0 && !(pfd[0].revents & POLLIN)) continue;
+			if (n == 0) waitMs = 0;
+		}
+		rc = frameRead(sp, &ack, ackBuf, 0, waitMs, opt, stats);
+		if (next - base >= window) pacerAccount(&stats->pace, PACE_WINDOW, waitStart);
+
+		// repeats of the resume ready carry no bitmap
+		if (rc == 1 && (ack.type == WF_ACK || ack.type == WF_NAK) && !(ack.flags & WFF_RESUME)) {
+			int64_t cum = ack.seq;
+			int64_t highest = cum;
+			int64_t ackUs = pacerClockUs();
+
+			if (cum > base && cum <= next) {
+				for (int64_t f = base; f < cum; f++) {
+					frameAcked(&slots[f % window], stats, ackUs, opt->adapt ? &adapt : NULL, &pp);
+					acked += slots[f % window].plain;
+				}
+				base = cum;
+			}
+
+			for (int i = 0; i < 64; i++) {
+				int64_t f = cum + 1 + i;
+				if (!(ack.offset & ((uint64_t)1 << i))) continue;
+				if (f >= base && f < next) frameAcked(&slots[f % window], stats, ackUs, opt->adapt ? &adapt : NULL, &pp);
+				if (f > highest) highest = f;
+			}
+			if (opt->stream) metricsProgress(&stats->metrics, stats->plainBytes, -1);
+			else metricsProgress(&stats->metrics, acked, fileSize - start);
+
+			if (ack.type == WF_NAK) stats->naks++;
+
+			// a hole below frames that did arrive, or a nak, means resend now
+			now = serialNowMs();
+			for (int64_t f = base; f < next; f++) {
+				wslot *s = &slots[f % window];
+
+				if (s->acked) continue;
+				if (f >= highest && !(ack.type == WF_NAK && f == base)) continue;
+				if (now - s->sentAt < guardMs) continue;
+
+				if (++s->retries > opt->retryLimit) {
+					printf("<local><windowSend> : frame %ld failed %d times\n", (long)f, s->retries);
+					goto done;
+				}
+				s->sentAt = now;
+				if (serialWrite(sp, s->buf, s->len) < 0) goto done;
+				stats->resent++;
+				stats->wireBytes += s->len;
+			}
+		}
+
+		// resend anything that has waited too long
+		now = serialNowMs();
+		for (int64_t f = base; f < next; f++) {
+			wslot *s = &slots[f % window];
+
+			if (s->acked || now - s->sentAt < timeoutMs) continue;
+			stats->timeouts++;
+			if (++s->retries > opt->retryLimit) {
+				printf("<local><windowSend> : frame %ld timed out %d times\n", (long)f, s->retries);
+				goto done;
+			}
+			s->sentAt = now;
+			if (serialWrite(sp, s->buf, s->len) < 0) goto done;
+			stats->resent++;
+			stats->wireBytes += s->len;
+		}
+	}
+
+	// everything is acknowledged, tell the receiver it can stop, and a stream's length
+	if (opt->stream) metricsProgress(&stats->metrics, stats->plainBytes, stats->plainBytes);
+	for (tries = 0; tries < 3; tries++) {
+		int64_t deadline;
+
+		sendControl(sp, WF_FIN, 0, (uint32_t)numFrames, framesOpen(opt) ? (uint64_t)stats->plainBytes : 0, opt, stats);
+		deadline = serialNowMs() + opt->timeoutMs;
+		while ((rc = frameRead(sp, &ack, ackBuf, 0, (int)(deadline - serialNowMs()) + 1, opt, stats)) != 0) {
+			if (rc == 1 && ack.type == WF_FINACK) break;
+		}
+		if (rc == 1) break;
+		stats->timeouts++;
+	}
+	// without a FINACK the receiver may not have taken the last frames
+	if (tries == 3) {
+		printf("<local><windowSend> : FIN never acknowledged\n");
+		goto done;
+	}
+	result = 0;
+
+done:
+	if (piped) {
+		pipeStop(&pp);
+		metricsMerge(&stats->metrics, &pp.crc);
+	}
+	fileMapClose(&map);
+	free(frames);
+	free(slots);
+	return(result);
+}
+
+/*
+Receiver disk stage.  Frames that passed their crc and unpacked to the
+right size are handed over and written, and logged in the manifest, here,
+so a slow disk only holds up the link once the ring is full.
+*/
+typedef struct recvPipe {
+	FILE *dst;
+	resumeLog *resume;
+	frameRing disk;
+	_Atomic int failed;
+	pthread_t tid;
+} recvPipe;
+
+static void *writeStage(void *arg){
+	recvPipe *rp = (recvPipe *)arg;
+	frameSlot *s;
+
+	while ((s = ringPeek(&rp->disk, -1)) != NULL) {
+		int zero = (s->flags & WFF_ZERO) != 0;
+
+		if ((zero ? fileZeroAt(rp->dst, s->offset, s->plain) : fileWriteAt(rp->dst, s->buf, s->plain, s->offset)) < 0) {
+			printf("<local><windowRecv> : write error at frame %ld\n", (long)s->seq);
+			atomic_store(&rp->failed, 1);
+			ringCancel(&rp->disk);
+			return(NULL);
+		}
+		if (rp->resume) resumeChunk(rp->resume, s->offset, s->plain, zero ? crc32Zeros(s->plain) : crc32Compute(s->buf, s->plain));
+		ringRelease(&rp->disk);
+	}
+	return(NULL);
+}
+
+int windowRecv(serialPort *sp, FILE *dst, int64_t fileSize, const windowOptions *opt, windowStats *stats){
+	int payload = windowPayload(opt);
+	int window = opt->window;
+	// a stream's length, and the count of frames that change size or span, come with the FIN
+	int64_t numFrames = framesOpen(opt) ? INT64_MAX : (fileSize - opt->start + payload - 1) / payload;
+	int64_t base = 0;
+	unsigned char *data, *have;
+	int idle = 0, piped = 0, result = -1;
+	recvPipe rp;
+	wframe hdr;
+
+	rp.dst = dst;
+	rp.resume = opt->resume;
+	atomic_init(&rp.failed, 0);
+	data = (unsigned char *)malloc(payload + 4);
+	have = (unsigned char *)calloc(window, 1);
+	if (ringInit(&rp.disk, PIPE_SLOTS, payload) < 0 || data == NULL || have == NULL) goto done;
+	if (pthread_create(&rp.tid, NULL, writeStage, &rp) != 0) goto done;
+	piped = 1;
+
+	// the whole file reserved at once, frames then land in place; a sparse one only sized
+	if (opt->sparse && !opt->stream) fileExtend(dst, fileSize);
+	else if (!opt->stream) filePrealloc(dst, fileSize);
+
+	// ready, and where to start when resuming
+	stats->start = opt->start;
+	if (opt->resume) sendControl(sp, WF_ACK, WFF_RESUME, 0, (uint64_t)opt->start, opt, stats);
+	else sendControl(sp, WF_ACK, 0, 0, 0, opt, stats);
+
+	while (1) {
+		uint64_t bitmap = 0;
+		int rc = frameRead(sp, &hdr, data, payload, opt->timeoutMs, opt, stats);
+
+		if (rc == 0) {
+			// nothing arrived, the sender may have missed our last ack
+			stats->timeouts++;
+			if (++idle > opt->retryLimit) {
+				if (base == numFrames) result = 0;
+				else printf("<local><windowRecv> : sender went quiet at frame %ld\n", (long)base);
+				goto done;
+			}
+		} else if (rc == 1 && hdr.type == WF_FIN) {
+			sendControl(sp, WF_FINACK, 0, hdr.seq, 0, opt, stats);
+			if (framesOpen(opt) && (int64_t)hdr.seq == base) {
+				numFrames = base;
+				if ((int64_t)hdr.offset != stats->plainBytes ||
+						(!opt->stream && stats->plainBytes != fileSize - opt->start)) {
+					printf("<local><windowRecv> : %ld bytes sent, %ld here\n",
+							(long)hdr.offset, (long)stats->plainBytes);
+					goto done;
+				}
+				if (opt->stream) metricsProgress(&stats->metrics, stats->plainBytes, stats->plainBytes);
+			}
+			if (base == numFrames) {
+				result = 0;
+				goto done;
+			}
+			continue;
+		} else if (rc == 1 && hdr.type == WF_DATA) {
+			int64_t f = hdr.seq;
+
+			idle = 0;
+			if (f >= base && f < base + window && f < numFrames && !have[f % window]) {
+				int64_t expect = f == numFrames - 1 ? fileSize - opt->start - f * payload : payload;
+				int64_t waitStart = pacerClockUs();
+				frameSlot *s = ringSpace(&rp.disk, -1);
+				int len = hdr.len;
+
+				pacerAccount(&stats->pace, PACE_PIPE, waitStart);
+				if (s == NULL) goto done;
+				if (hdr.flags & WFF_ZERO) {
+					// an extent, nothing to copy or write
+					uint64_t span;
+
+					memcpy(&span, data, sizeof(span));
+					len = hdr.len == sizeof(span) && span <= SPARSE_EXTENT_MAX ? (int)span : -1;
+				} else if (hdr.flags & WFF_PACKED) {
+					len = unpackFrame(data, hdr.len, s->buf, payload);
+				} else {
+					memcpy(s->buf, data, len);
+				}
+				if (opt->stream ? len <= 0 : framesOpen(opt) ? len <= 0 || (int64_t)hdr.offset < opt->start ||
+						(int64_t)hdr.offset + len > fileSize : len != expect) {
+					// crc was good but it does not unpack to the frame's size
+					rc = -1;
+					stats->naks++;
+					goto reply;
+				}
+				stats->plainBytes += len;
+				if (hdr.flags & WFF_ZERO) stats->zeroBytes += len;
+				else stats->packedBytes += hdr.len;
+
+				s->plain = len;
+				s->flags = hdr.flags & WFF_ZERO;
+				s->seq = (uint32_t)f;
+				s->offset = (int64_t)hdr.offset;
+				ringPublish(&rp.disk);
+				have[f % window] = 1;
+				stats->frames++;
+				while (base < numFrames && have[base % window]) {
+					have[base % window] = 0;
+					base++;
+				}
+				metricsProgress(&stats->metrics, stats->plainBytes, opt->stream ? -1 : fileSize - opt->start);
+			}
+		} else if (rc == 1 && hdr.type == WF_IDLE) {
+			idle = 0;
+			continue;
+		} else if (rc < 0) {
+			idle = 0;
+			stats->naks++;
+		} else {
+			continue;
+		}
+
+reply:
+		for (int i = 0; i < 64 && i + 1 < window; i++) {
+			if (have[(base + 1 + i) % window]) bitmap |= (uint64_t)1 << i;
+		}
+		// until data flows a lost ready must not read as a start from 0
+		if (opt->resume && stats->frames == 0) {
+			sendControl(sp, rc < 0 ? WF_NAK : WF_ACK, WFF_RESUME, 0, (uint64_t)opt->start, opt, stats);
+			continue;
+		}
+		sendControl(sp, rc < 0 ? WF_NAK : WF_ACK, 0, (uint32_t)base, bitmap, opt, stats);
+	}
+
+done:
+	// the transfer is only done once the disk stage has written it all
+	if (piped) {
+		ringEnd(&rp.disk);
+		pthread_join(rp.tid, NULL);
+		if (atomic_load(&rp.failed)) result = -1;
+	}
+	ringFree(&rp.disk);
+	free(data);
+	free(have);
+	return(result);
+}
@@ -0,0 +1,65 @@
+/*
+Sliding window transfer engine, frame format in protocol.h
+
+Replaces the per frame EOT / SYNC / SOK round trip of the v4 protocol with
+sequence numbered frames, a configurable number of them in flight, and
+cumulative plus selective acks so only damaged or lost frames are resent.
+*/
+
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "metrics.h"
+#include "pacing.h"
+#include "resume.h"
+#include "serialio.h"
+
+#define WINDOW_SLACK_MS 200	// added to a window's time on the wire for the receiver to answer
+
+typedef struct windowOptions {
+	int frameSize;		// bytes per frame on the wire, header and crc included
+	int window;		// frames in flight, 1 .. WINDOW_MAX
+	int timeoutMs;		// resend an unacknowledged frame after this long
+	int retryLimit;		// give up after this many resends of one frame
+	int64_t start;		// file offset frame 0 is at, a resuming receiver's ack moves the sender's
+	resumeLog *resume;	// receiver: manifest to log verified frames in, or NULL
+	int pack;		// sender: compress frames that shrink, see pack.h
+	int fec;		// frames carry Reed-Solomon parity, see fec.h
+	int cobs;		// frames are byte stuffed and delimited, see cobs.h
+	int stream;		// length unknown, see HDR_FLAG_STREAM; fileSize is ignored
+	int adapt;		// frames sized to the line's error rate, see HDR_FLAG_ADAPT
+	int sparse;		// holes and zero runs go as extents, see HDR_FLAG_SPARSE
+} windowOptions;
+
+typedef struct windowStats {
+	int64_t frames;		// distinct data frames
+	int64_t resent;		// data frames sent again
+	int64_t naks;		// NAKs sent or received
+	int64_t timeouts;	// waits that ran out
+	int64_t wireBytes;	// bytes written to the link
+	int64_t start;		// offset the transfer began at, > 0 when resumed
+	int64_t plainBytes;	// file bytes carried by distinct data frames
+	int64_t packedBytes;	// the same after compression, zero extents left out
+	int64_t zeroBytes;	// file bytes carried by zero extents
+	int64_t corrected;	// frames repaired by fec instead of resent
+	int64_t resized;	// times the sender changed the frame size
+	int payload;		// the payload it ended with
+	pacer pace;		// time spent waiting on the link or the receiver
+	metrics metrics;	// round trips, resends per frame, crc time
+} windowStats;
+
+void windowDefaults(windowOptions *opt, int frameSize, int window, int baud);
+int windowPayload(const windowOptions *opt);
+void windowOptionsFromLink(windowOptions *opt, uint32_t features);
+
+/*
+With opt->stream the sender reads src to its end and the receiver takes
+frames until the FIN, both leave the length in stats->plainBytes.
+*/
+int windowSend(serialPort *sp, FILE *src, int64_t fileSize, const windowOptions *opt, windowStats *stats);
+int windowRecv(serialPort *sp, FILE *dst, int64_t fileSize, const windowOptions *opt, windowStats *stats);
+
+#endif